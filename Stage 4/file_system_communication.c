@@ -7,475 +7,3038 @@
  * Notes                 :   This file creates simple framework that abstracts communication via file system
  *                           between programs to simple API like calls.
  *                           It utilizes callbacks of subscribed functions.
- *                           Single threaded implementation only.
+ *                           Streams live in an Fsc_Context and move frames over the file system (flag/ack
+ *                           files or rename) or a shared memory ring, optionally on a pool of update workers.
  * TODO:
- * Known issues          :   -Need to implement data stream removal function
- *                           -Create data stream should return pointer to created stream for easier management.
+ * Known issues          :   none
  *******************************************************************************/
 
+#define _GNU_SOURCE
+
 #include <stdlib.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdarg.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#endif
 #include "file_system_communication.h"
 
-static bool logging_enabled = false;
+// shared memory streams without a wake bridge (not mapped yet, no futex) are checked in slices of this length
+#define SHARED_MEMORY_POLL_INTERVAL_MS 1
+// idle shared memory readers look this often whether the writer replaced the segment, mismatched segments are retried as often
+#define SHARED_MEMORY_SEGMENT_CHECK_MS 1000
+// WAIT_SPIN_THEN_YIELD checks this many times with a pause in between before it starts yielding the core
+#define SPIN_CHECKS_BEFORE_YIELD 1000
+// first allocation of the buffer file frames are built or read in, doubles when needed
+#define FRAME_BUFFER_INITIAL_SIZE 4096
+
+// buckets of the stream registry, doubled when it is 3/4 full
+#define STREAM_INDEX_INITIAL_SIZE 16
+
+// longest trace file path set_trace_output accepts, including the temporary suffix
+#define MAX_TRACE_PATH_LENGTH 4096
+// one trace event line, a complete event and its flow event
+#define MAX_TRACE_EVENT_LENGTH 1024
+
+// every file system call made by the protocols goes through this so stats.syscalls stays honest
+#define COUNT_SYSCALL(stream) ((stream)->stats.syscalls++)
+
+/**
+ * Everything the framework knows, one per fsc_context_create. Contexts share nothing,
+ * so every thread (or logical node) can drive its own set of streams without locks between them.
+ */
+struct Fsc_Context
+{
+    /**
+     * lowest severity printed, LOG_LEVEL_INFO by default so the per frame debug lines stay quiet
+     */
+    int log_level;
+    /**
+     * inotify descriptor watching directories of file streams, -1 until first wait_and_update_streams
+     */
+    int event_watch_fd;
+    /**
+     * timerfd armed at the next due time of rate scheduled streams, -1 until first needed
+     */
+    int schedule_timer_fd;
+    /**
+     * eventfd written by the wake bridges of blocking shared memory streams, -1 if not available
+     */
+    int wake_event_fd;
+    /**
+     * CLOCK_MONOTONIC time wait_and_update_streams last woke up, 0 while waiting
+     */
+    long long last_wake_ns;
+    /**
+     * close_data_streams prints the latency histograms of every stream here, NULL for no report
+     */
+    FILE *latency_report_output;
+    /**
+     * latest traced frame a reader of the context took, writers continue its trace. Guarded by trace_lock
+     */
+    Frame_Trace input_trace;
+    pthread_mutex_t trace_lock;
+    /**
+     * Chrome trace event file of set_trace_output, -1 when callbacks are not traced
+     */
+    int trace_fd;
+    /**
+     * linked list head pointer to the first data stream
+     */
+    Data_Stream *head_data_stream;
+    Data_Stream *tail_data_stream;
+    /**
+     * hash index of the streams on (name, type), chained through next_in_bucket
+     */
+    Data_Stream **stream_index;
+    size_t stream_index_size;
+    size_t stream_count;
+    /**
+     * set while update_streams walks the list, removals are deferred until it is done
+     */
+    bool is_updating_streams;
+    bool has_removed_streams;
+    /**
+     * guards the hash index and deferred removals, workers may remove streams from on_ready
+     */
+    pthread_mutex_t registry_lock;
+    /**
+     * worker pool of set_update_worker_threads, streams wait in a queue linked through next_task
+     */
+    pthread_t *update_workers;
+    unsigned int update_worker_count;
+    pthread_mutex_t update_queue_lock;
+    pthread_cond_t update_queue_ready;
+    Data_Stream *update_queue_head;
+    Data_Stream *update_queue_tail;
+    bool is_pool_stopping;
+};
+
+/**
+ * context whose update worker runs on this thread, NULL on every other thread
+ */
+static __thread Fsc_Context *worker_context = NULL;
+
+/**
+ * numbers the traces started by this process, shared by all contexts so trace ids stay unique
+ */
+static unsigned long long started_trace_count = 0;
+
+static void _send_line(Data_Stream *context, const char *fmt, ...);
+static void _send_line_to_frame(Data_Stream *context, const char *fmt, ...);
+static char *_read_line_from_frame(Data_Stream *context, char *line_buffer, int max_count);
+static int _read_frame(Data_Stream *context, const char **data, size_t *length);
+static int _send_struct(Data_Stream *context, const Message_Descriptor *descriptor, const void *message);
+static int _read_struct(Data_Stream *context, const Message_Descriptor *descriptor, void *message);
+static unsigned char *_reserve_frame_space(Data_Stream *context, size_t length);
+static void _update_stream(Data_Stream *stream);
+static void _dispatch_stream(Data_Stream *stream);
+static void *_update_worker(void *argument);
+static void _stop_update_workers(Fsc_Context *fsc);
+static Data_Stream * _allocate_new_data_stream(Fsc_Context *fsc);
+static void _free_data_stream(Data_Stream *stream);
+static void _unlink_data_stream(Data_Stream *stream);
+static void _free_removed_streams(Fsc_Context *fsc);
+static unsigned int _hash_stream_key(const char *stream_name, enum Stream_type stream_type);
+static Data_Stream *_find_indexed_stream(Fsc_Context *fsc, const char *stream_name, enum Stream_type stream_type, unsigned int key_hash);
+static int _index_stream(Data_Stream *stream);
+static void _unindex_stream(Data_Stream *stream);
+static int _grow_stream_index(Fsc_Context *fsc);
+static void _populate_data_stream_with_defaults(Data_Stream *stream);
+static bool _is_stream_name_valid(Fsc_Context *fsc, const char *stream_name, enum Stream_type stream_type);
+static bool _are_options_valid(const Data_Stream_Options *options);
+static void _populate_stream_data(Data_Stream *stream, const char *stream_name, enum Stream_type stream_type, void (*on_ready)(Data_Stream *), const Data_Stream_Options *options);
+static void _select_slot(Data_Stream *stream);
+static void _build_slot_path(const Data_Stream *stream, unsigned int slot, const char *extension, char *path, size_t size);
+static int _open_slot_files(Data_Stream *stream);
+static void _close_slot_files(Data_Stream *stream);
+static void _handle_write_protocol(Data_Stream *stream);
+static void _handle_read_protocol(Data_Stream *stream);
+static void _handle_rename_write_protocol(Data_Stream *stream);
+static void _handle_rename_read_protocol(Data_Stream *stream);
+static int _publish_frame_file(Data_Stream *stream, const char *temp_file_path);
+static void _handle_shared_memory_write_protocol(Data_Stream *stream);
+static void _handle_shared_memory_read_protocol(Data_Stream *stream);
+static void _handle_latest_write_protocol(Data_Stream *stream);
+static void _handle_latest_read_protocol(Data_Stream *stream);
+static void _handle_shared_memory_latest_write_protocol(Data_Stream *stream);
+static void _handle_shared_memory_latest_read_protocol(Data_Stream *stream);
+static bool _accept_latest_sequence(Data_Stream *stream, unsigned long long sequence);
+static bool _is_write_stream(const Data_Stream *stream);
+static bool _attach_shared_memory(Data_Stream *stream);
+static void _check_shared_memory_segment(Data_Stream *stream);
+static void _detach_shared_memory(Data_Stream *stream);
+static bool _wait_for_stream_event(Fsc_Context *fsc, int timeout_ms);
+static bool _init_event_watch(Fsc_Context *fsc);
+static void _watch_stream_directory(Data_Stream *stream);
+static bool _drain_stream_events(Fsc_Context *fsc);
+static bool _is_shared_memory_stream_ready(Fsc_Context *fsc, long long now_ns);
+static bool _has_shared_memory_work(Data_Stream *stream, unsigned long long sequence, long long now_ns);
+static void _wake_stream_wait(Fsc_Context *fsc);
+static void _call_on_ready(Data_Stream *stream);
+static void _record_latency(Data_Stream *stream, enum Stream_latency latency, long long value_ns);
+static void _record_slot_ack(Data_Stream *stream, unsigned int slot);
+static void _record_ring_acks(Data_Stream *stream);
+static unsigned long long _inherit_frame_trace(Data_Stream *stream, long long start_ns);
+static void _take_frame_trace(Data_Stream *stream);
+static void _publish_ring_frame(Data_Stream *stream);
+static void _take_ring_stamp(Data_Stream *stream, const Shared_Memory_Frame_Stamp *stamp);
+static int _open_trace_file(const char *trace_path);
+static void _write_trace_events(Data_Stream *stream, long long start_ns, long long end_ns, bool is_trace_start);
+static void _escape_json(const char *text, char *escaped, size_t size);
+static long _thread_id(void);
+static void _begin_frame_header(Data_Stream *stream);
+static void _stamp_frame_header(Data_Stream *stream);
+static bool _read_frame_header(Data_Stream *stream, unsigned long long *sequence);
+static void _charge_wait_cpu(Fsc_Context *fsc, long long cpu_ns);
+static void _start_wake_bridge(Data_Stream *stream);
+static void _stop_wake_bridge(Data_Stream *stream);
+static void *_wake_bridge(void *argument);
+static long long _thread_cpu_ns(void);
+static int _start_thread(pthread_t *thread, void *(*routine)(void *), void *argument);
+static void _cpu_relax(void);
+static long long _monotonic_ns(void);
+static bool _is_stream_due(Data_Stream *stream, long long now_ns);
+static void _advance_stream_schedule(Data_Stream *stream, long long tick_ns);
+static long long _next_future_due_ns(Fsc_Context *fsc, long long now_ns);
+static bool _arm_schedule_timer(Fsc_Context *fsc, long long due_ns);
+static Stream_Slot_Files *_current_slot(Data_Stream *stream);
+static bool _is_data_ready(Data_Stream *stream, Stream_Slot_Files *slot);
+static bool _was_data_read(Data_Stream *stream, Stream_Slot_Files *slot);
+static bool _read_signal(Data_Stream *stream, int fd);
+static int _write_signal(Data_Stream *stream, int fd, bool signal);
+static int _write_frame_file(Data_Stream *stream, int fd);
+static int _read_frame_file(Data_Stream *stream, int fd);
+static int _grow_frame_buffer(Data_Stream *stream, size_t minimum_size);
+#if LOG_COMPILE_LEVEL <= LOG_LEVEL_ERROR
+static void _log_line(FILE *output, const char *fmt, ...);
+#endif
+
+// per frame chatter is debug level, below LOG_COMPILE_LEVEL the calls and their arguments are compiled out
+#if LOG_COMPILE_LEVEL <= LOG_LEVEL_DEBUG
+#define _log_informative(fsc, ...) do { if ((fsc)->log_level <= LOG_LEVEL_DEBUG) _log_line(stdout, __VA_ARGS__); } while (0)
+#else
+#define _log_informative(fsc, ...) ((void)0)
+#endif
+#if LOG_COMPILE_LEVEL <= LOG_LEVEL_ERROR
+#define _log_error(...) _log_line(stderr, __VA_ARGS__)
+#else
+#define _log_error(...) ((void)0)
+#endif
+
+/**
+ * Creates an empty context, streams are created in it and updated through it.
+ * One context must only be driven from one thread at a time, use one context per thread for more
+ * \return new context, NULL if it fails
+ */
+Fsc_Context *fsc_context_create(void)
+{
+    Fsc_Context *fsc = calloc(1, sizeof(Fsc_Context));
+    if (fsc == NULL)
+    {
+        _log_error("ERROR: Failed to allocate framework context\n");
+        return NULL;
+    }
+
+    fsc->log_level = LOG_LEVEL_INFO;
+    fsc->event_watch_fd = -1;
+    fsc->schedule_timer_fd = -1;
+    fsc->trace_fd = -1;
+    fsc->latency_report_output = stdout;
+
+#ifdef __linux__
+    fsc->wake_event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fsc->wake_event_fd < 0)
+        _log_error("ERROR: Failed to create wake eventfd, shared memory streams will be polled\n");
+#else
+    fsc->wake_event_fd = -1;
+#endif
+
+    if (pthread_mutex_init(&fsc->registry_lock, NULL))
+    {
+        free(fsc);
+        return NULL;
+    }
+    if (pthread_mutex_init(&fsc->update_queue_lock, NULL))
+    {
+        pthread_mutex_destroy(&fsc->registry_lock);
+        free(fsc);
+        return NULL;
+    }
+    if (pthread_cond_init(&fsc->update_queue_ready, NULL))
+    {
+        pthread_mutex_destroy(&fsc->update_queue_lock);
+        pthread_mutex_destroy(&fsc->registry_lock);
+        free(fsc);
+        return NULL;
+    }
+    if (pthread_mutex_init(&fsc->trace_lock, NULL))
+    {
+        pthread_cond_destroy(&fsc->update_queue_ready);
+        pthread_mutex_destroy(&fsc->update_queue_lock);
+        pthread_mutex_destroy(&fsc->registry_lock);
+        free(fsc);
+        return NULL;
+    }
+
+    return fsc;
+}
+
+/**
+ * Closes all streams of the context and frees it, the context must not be used afterwards
+ */
+void fsc_context_destroy(Fsc_Context *fsc)
+{
+    if (fsc == NULL)
+        return;
+
+    close_data_streams(fsc);
+
+    if (fsc->wake_event_fd >= 0)
+        close(fsc->wake_event_fd);
+    set_trace_output(fsc, NULL, NULL);
+
+    pthread_mutex_destroy(&fsc->trace_lock);
+    pthread_cond_destroy(&fsc->update_queue_ready);
+    pthread_mutex_destroy(&fsc->update_queue_lock);
+    pthread_mutex_destroy(&fsc->registry_lock);
+    free(fsc);
+}
+
+/**
+ * Enables or disables logging within the File System Communication framework
+ * \param fsc context whose logging is changed
+ * \param enabled true to enable logging, false to disable
+ */
+void set_file_system_com_framework_logging(Fsc_Context *fsc, bool enabled)
+{
+    set_framework_log_level(fsc, enabled ? LOG_LEVEL_DEBUG : LOG_LEVEL_INFO);
+}
+
+/**
+ * Picks the lowest severity the framework prints for this context, errors always go to stderr.
+ * Debug lines (every frame) are only there if LOG_COMPILE_LEVEL kept them.
+ * \param fsc context whose logging is changed
+ * \param level LOG_LEVEL_DEBUG to LOG_LEVEL_NONE
+ */
+void set_framework_log_level(Fsc_Context *fsc, int level)
+{
+    fsc->log_level = level;
+}
+
+/**
+ * Picks where close_data_streams reports the latency histograms of the streams, stdout by default
+ * \param fsc context whose report is redirected
+ * \param output open stream to print to, NULL to skip the report
+ */
+void set_latency_report_output(Fsc_Context *fsc, FILE *output)
+{
+    fsc->latency_report_output = output;
+}
+
+/**
+ * Appends a Chrome trace event (chrome://tracing, ui.perfetto.dev) for every callback of the context's
+ * streams to trace_path, flow arrows link the callbacks that handled frames of one trace.
+ * Every process of the robot can append to the same file, it is a JSON array left without its closing
+ * bracket which the viewers accept. Remove the file before a new run. Call it before updating the streams
+ * \param fsc context whose callbacks are traced
+ * \param trace_path file to append to, created if missing, NULL to stop tracing
+ * \param process_name shown for this process in the viewer, NULL for its pid only
+ * \return non zero if the file could not be opened, tracing is off then
+ */
+int set_trace_output(Fsc_Context *fsc, const char *trace_path, const char *process_name)
+{
+    if (fsc->trace_fd >= 0)
+    {
+        close(fsc->trace_fd);
+        fsc->trace_fd = -1;
+    }
+    if (trace_path == NULL)
+        return 0;
+
+    int fd = _open_trace_file(trace_path);
+    if (fd < 0)
+    {
+        _log_error("ERROR: Failed to open trace file %s\n", trace_path);
+        return 1;
+    }
+
+    if (process_name != NULL)
+    {
+        char name[2 * MAX_NAME_LENGTH];
+        char event[MAX_TRACE_EVENT_LENGTH];
+        _escape_json(process_name, name, sizeof(name));
+        int length = snprintf(event, sizeof(event), "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"%s\"}},\n",
+                              (int)getpid(), name);
+        if (write(fd, event, (size_t)length) != length)
+            _log_error("ERROR: Failed to write trace file %s\n", trace_path);
+    }
+
+    fsc->trace_fd = fd;
+    return 0;
+}
+
+/**
+ * Switches update_streams between running every stream itself (0, default) and handing ready streams
+ * to thread_count worker threads. In worker mode on_ready runs on the workers, update_streams returns
+ * without waiting for them and skips streams that are still busy. Callbacks of one stream never overlap.
+ * Streams have to be created from the thread calling update_streams.
+ * \param fsc context whose streams the workers update
+ * \param thread_count number of workers, 0 to go back to single threaded
+ * \return non zero if the workers could not be started, the framework is single threaded then
+ */
+int set_update_worker_threads(Fsc_Context *fsc, unsigned int thread_count)
+{
+    _stop_update_workers(fsc);
+
+    if (thread_count == 0)
+        return 0;
+
+    if (thread_count > MAX_UPDATE_WORKER_THREADS)
+    {
+        _log_error("ERROR: At most %d update worker threads\n", MAX_UPDATE_WORKER_THREADS);
+        return 1;
+    }
+
+    fsc->update_workers = malloc(thread_count * sizeof(pthread_t));
+    if (fsc->update_workers == NULL)
+    {
+        _log_error("ERROR: Failed to allocate update worker threads\n");
+        return 1;
+    }
+
+    for (unsigned int worker = 0; worker < thread_count; worker++)
+    {
+        if (_start_thread(&fsc->update_workers[worker], _update_worker, fsc))
+        {
+            _log_error("ERROR: Failed to start update worker thread %u\n", worker);
+            _stop_update_workers(fsc);
+            return 1;
+        }
+        fsc->update_worker_count++;
+    }
+
+    return 0;
+}
+
+/**
+ * Will safely close all data streams of the context and return memory, the context can be reused.
+ * Prints the latency histograms of every stream first (publish to consume, callback, ack round trip),
+ * see set_latency_report_output
+ * \param fsc context to close the streams of
+ * \return 0 on success
+ */
+int close_data_streams(Fsc_Context *fsc)
+{
+    // workers finish the streams they were given first
+    _stop_update_workers(fsc);
+
+    // free all linked list nodes
+    Data_Stream *current = fsc->head_data_stream;
+    while (current != NULL) {
+        Data_Stream *next = current->next;
+        if (fsc->latency_report_output != NULL && current->latency_histograms != NULL)
+            print_stream_latencies(current, fsc->latency_report_output);
+        _free_data_stream(current);
+        current = next;
+    }
+
+    fsc->head_data_stream = NULL;
+    fsc->tail_data_stream = NULL;
+
+    free(fsc->stream_index);
+    fsc->stream_index = NULL;
+    fsc->stream_index_size = 0;
+    fsc->stream_count = 0;
+    fsc->has_removed_streams = false;
+
+    if (fsc->event_watch_fd >= 0)
+    {
+        close(fsc->event_watch_fd);
+        fsc->event_watch_fd = -1;
+    }
+    if (fsc->schedule_timer_fd >= 0)
+    {
+        close(fsc->schedule_timer_fd);
+        fsc->schedule_timer_fd = -1;
+    }
+    return 0;
+}
+
 /**
- * linked list head pointer to the first data stream
+ * Returns the options used by create_new_data_stream, file system transport
  */
-static Data_Stream *head_data_stream = NULL;
+Data_Stream_Options default_data_stream_options(void)
+{
+    Data_Stream_Options options;
+    options.transport = FILE_SYSTEM_TRANSPORT;
+    options.frame_capacity = SHARED_MEMORY_DEFAULT_FRAME_CAPACITY;
+    options.queue_depth = 0;
+    options.publication = SIGNAL_FILE_PUBLICATION;
+    options.rate_hz = 0;
+    options.deadline_ms = 0;
+    options.wait_strategy = WAIT_BLOCKING;
+    options.wait_interval_ms = 0;
+    return options;
+}
+
+/**
+ * Creates new data stream with specified name
+ * and will invoke on_ready every time new frame can be sent
+ * \param fsc context that owns the stream, see fsc_context_create
+ * \param stream_name max size 80, determines names of the files used in the protocol
+ * \param stream_type READ_ONLY_STREAM or WRITE_ONLY_STREAM wether you want to provide or receive data,
+ *                    LATEST_VALUE_READ_STREAM or LATEST_VALUE_WRITE_STREAM if only the newest frame matters
+ * \param on_ready fuction that will be called everytime data is ready to be written to or read from
+ * \return handle of the new stream, owned by the framework until removed or closed. NULL if it fails
+ */
+Data_Stream *create_new_data_stream(Fsc_Context *fsc, const char *stream_name, enum Stream_type stream_type, void (*on_ready)(Data_Stream *))
+{
+    Data_Stream_Options options = default_data_stream_options();
+    return create_new_data_stream_with_options(fsc, stream_name, stream_type, on_ready, &options);
+}
+
+/**
+ * Same as create_new_data_stream but lets the caller pick the transport and its settings
+ * \param options settings of the stream, NULL for defaults. Both ends of the stream have to use the same transport
+ * \return handle of the new stream, NULL if it fails
+ */
+Data_Stream *create_new_data_stream_with_options(Fsc_Context *fsc, const char *stream_name, enum Stream_type stream_type, void (*on_ready)(Data_Stream *), const Data_Stream_Options *options)
+{
+    Data_Stream_Options defaults = default_data_stream_options();
+    if (options == NULL)
+    {
+        options = &defaults;
+    }
+
+    if (!_is_stream_name_valid(fsc, stream_name, stream_type) || !_are_options_valid(options))
+    {
+        return NULL;
+    }
+
+    Data_Stream *new_data_stream = _allocate_new_data_stream(fsc);
+    if (!new_data_stream)
+    {
+        _log_error("ERROR: Failed to create new data stream\n");
+        return NULL;
+    }
+
+    _populate_stream_data(new_data_stream, stream_name, stream_type, on_ready, options);
+
+    pthread_mutex_lock(&fsc->registry_lock);
+    int index_result = _index_stream(new_data_stream);
+    pthread_mutex_unlock(&fsc->registry_lock);
+    if (index_result)
+    {
+        _unlink_data_stream(new_data_stream);
+        _free_data_stream(new_data_stream);
+        return NULL;
+    }
+
+    // latest value frames are copied out of the ring, the writer may overwrite the slot any time
+    if (stream_type == LATEST_VALUE_READ_STREAM && options->transport == SHARED_MEMORY_TRANSPORT)
+    {
+        if (_grow_frame_buffer(new_data_stream, options->frame_capacity))
+        {
+            remove_data_stream(new_data_stream);
+            return NULL;
+        }
+    }
+
+    // writers remember when each queued frame went out, its ack closes the round trip
+    if (stream_type == WRITE_ONLY_STREAM)
+    {
+        new_data_stream->slot_publish_ns = calloc(new_data_stream->queue_depth, sizeof(long long));
+        if (new_data_stream->slot_publish_ns == NULL)
+        {
+            _log_error("ERROR: Failed to allocate publish times of stream %s\n", stream_name);
+            remove_data_stream(new_data_stream);
+            return NULL;
+        }
+    }
+
+    // handshake streams on the file system keep their files open until closed
+    if ((stream_type == READ_ONLY_STREAM || stream_type == WRITE_ONLY_STREAM) && options->transport == FILE_SYSTEM_TRANSPORT
+        && options->publication == SIGNAL_FILE_PUBLICATION)
+    {
+        if (_open_slot_files(new_data_stream))
+        {
+            remove_data_stream(new_data_stream);
+            return NULL;
+        }
+    }
+
+    // streams created after the first wait need their directory watched as well
+    if (fsc->event_watch_fd >= 0)
+    {
+        _watch_stream_directory(new_data_stream);
+    }
+    
+    _log_informative(fsc, "DEBUG: Created new data stream with name %s\n", stream_name);
+    return new_data_stream;
+}
+
+/**
+ * Looks up a stream by the name and type it was created with
+ * \return handle of the stream, NULL if there is no such stream
+ */
+Data_Stream *find_data_stream(Fsc_Context *fsc, const char *stream_name, enum Stream_type stream_type)
+{
+    pthread_mutex_lock(&fsc->registry_lock);
+    Data_Stream *stream = _find_indexed_stream(fsc, stream_name, stream_type, _hash_stream_key(stream_name, stream_type));
+    pthread_mutex_unlock(&fsc->registry_lock);
+    return stream;
+}
+
+/**
+ * Histogram of one latency of the stream, read it while the stream is not being updated
+ * \return NULL if nothing was recorded yet
+ */
+const Latency_Histogram *get_stream_latency_histogram(const Data_Stream *stream, enum Stream_latency latency)
+{
+    if (stream->latency_histograms == NULL || latency >= STREAM_LATENCY_COUNT)
+        return NULL;
+    return &stream->latency_histograms[latency];
+}
+
+/**
+ * \param percentile 0 to 100, e.g. 99.9
+ * \return latency in nanoseconds at or below which the given share of samples lies, 0 without samples
+ */
+unsigned long long get_stream_latency_percentile(const Data_Stream *stream, enum Stream_latency latency, double percentile)
+{
+    const Latency_Histogram *histogram = get_stream_latency_histogram(stream, latency);
+    return histogram != NULL ? latency_histogram_percentile(histogram, percentile) : 0;
+}
+
+/**
+ * Prints the latencies that apply to the stream's type, one line each
+ */
+void print_stream_latencies(const Data_Stream *stream, FILE *output)
+{
+    static const char *const latency_names[STREAM_LATENCY_COUNT] = { "publish to consume", "callback", "ack round trip", "origin to consume" };
+    static const Latency_Histogram empty;
+
+    fprintf(output, "Latencies of stream %s:\n", stream->stream_name);
+    for (int latency = 0; latency < STREAM_LATENCY_COUNT; latency++)
+    {
+        if ((latency == PUBLISH_TO_CONSUME_LATENCY || latency == ORIGIN_TO_CONSUME_LATENCY) && _is_write_stream(stream))
+            continue;
+        if (latency == ACK_ROUND_TRIP_LATENCY && stream->stream_type != WRITE_ONLY_STREAM)
+            continue;
+
+        const Latency_Histogram *histogram = get_stream_latency_histogram(stream, (enum Stream_latency)latency);
+        latency_histogram_print(histogram != NULL ? histogram : &empty, latency_names[latency], output);
+    }
+}
+
+/**
+ * Closes one stream and returns its memory, the handle must not be used afterwards.
+ * Safe to call from on_ready, the stream is then freed once update_streams finishes
+ * \param stream handle returned by create_new_data_stream
+ * \return non zero if the stream is not registered
+ */
+int remove_data_stream(Data_Stream *stream)
+{
+    if (stream == NULL)
+    {
+        _log_error("ERROR: Stream to remove is not registered\n");
+        return 1;
+    }
+
+    Fsc_Context *fsc = stream->owner;
+    pthread_mutex_lock(&fsc->registry_lock);
+
+    if (stream->is_removed)
+    {
+        pthread_mutex_unlock(&fsc->registry_lock);
+        _log_error("ERROR: Stream to remove is not registered\n");
+        return 1;
+    }
+
+    _unindex_stream(stream);
+    __atomic_store_n(&stream->is_active, false, __ATOMIC_RELEASE);
+    stream->is_removed = true;
+
+    // list is being walked or the stream is still in use by a worker, unlink it later
+    if (worker_context == fsc || fsc->is_updating_streams || __atomic_load_n(&stream->is_dispatched, __ATOMIC_ACQUIRE))
+    {
+        fsc->has_removed_streams = true;
+        pthread_mutex_unlock(&fsc->registry_lock);
+        return 0;
+    }
+
+    _unlink_data_stream(stream);
+    pthread_mutex_unlock(&fsc->registry_lock);
+
+    _free_data_stream(stream);
+    return 0;
+}
+
+/**
+ * Calls the appropriate protocol for each data stream of the context if they are active once
+ * Place in a loop to call continuously
+ * \param fsc context to update
+ */
+void update_streams(Fsc_Context *fsc)
+{
+    if (!fsc->head_data_stream)
+    {
+        _log_error("ERROR: Data streams not initialized or null\n");
+        return;
+    }
+
+    _log_informative(fsc, "DEBUG: Calling each data stream\n");
+
+    fsc->is_updating_streams = true;
+    long long now_ns = _monotonic_ns();
+
+    // linked list version
+    Data_Stream *current = fsc->head_data_stream;
+    while (current != NULL) {
+        // Skip inactive or un configured streams and scheduled streams before their tick
+        if (__atomic_load_n(&current->is_active, __ATOMIC_ACQUIRE) && current->on_ready != NULL && _is_stream_due(current, now_ns)) {
+            if (fsc->update_worker_count > 0)
+                _dispatch_stream(current);
+            else
+                _update_stream(current);
+        }
+        // between ticks, acks in shared memory cost nothing to look at and keep the round trip exact
+        else if (current->is_active && current->transport == SHARED_MEMORY_TRANSPORT && current->stream_type == WRITE_ONLY_STREAM
+            && current->is_ring_attached && !__atomic_load_n(&current->is_dispatched, __ATOMIC_ACQUIRE)) {
+            _record_ring_acks(current);
+        }
+        current = current->next;
+    }
+
+    fsc->is_updating_streams = false;
+
+    // streams removed by their callbacks
+    pthread_mutex_lock(&fsc->registry_lock);
+    if (fsc->has_removed_streams)
+        _free_removed_streams(fsc);
+    pthread_mutex_unlock(&fsc->registry_lock);
+}
+
+/**
+ * Runs the protocol matching the stream's type and transport once
+ */
+static void _update_stream(Data_Stream *stream)
+{
+    long long tick_ns = stream->period_ns > 0 ? _monotonic_ns() : 0;
+    unsigned long long frames = stream->stats.frames;
+
+    bool is_shared_memory = stream->transport == SHARED_MEMORY_TRANSPORT;
+    bool is_renamed = stream->publication == RENAME_PUBLICATION;
+
+    switch (stream->stream_type) {
+    case WRITE_ONLY_STREAM:
+        if (is_shared_memory)
+            _handle_shared_memory_write_protocol(stream);
+        else
+            is_renamed ? _handle_rename_write_protocol(stream) : _handle_write_protocol(stream);
+        break;
+    case READ_ONLY_STREAM:
+        if (is_shared_memory)
+            _handle_shared_memory_read_protocol(stream);
+        else
+            is_renamed ? _handle_rename_read_protocol(stream) : _handle_read_protocol(stream);
+        break;
+    case LATEST_VALUE_WRITE_STREAM:
+        is_shared_memory ? _handle_shared_memory_latest_write_protocol(stream) : _handle_latest_write_protocol(stream);
+        break;
+    case LATEST_VALUE_READ_STREAM:
+        is_shared_memory ? _handle_shared_memory_latest_read_protocol(stream) : _handle_latest_read_protocol(stream);
+        break;
+    }
+
+    // writers keep trying until the tick produced a frame, readers spend the tick either way
+    if (stream->period_ns > 0 && (stream->stats.frames != frames || !_is_write_stream(stream)))
+        _advance_stream_schedule(stream, tick_ns);
+}
+
+/**
+ * Worker mode, queues the stream for the next free worker unless it is still queued or running
+ */
+static void _dispatch_stream(Data_Stream *stream)
+{
+    Fsc_Context *fsc = stream->owner;
+    // only this thread sets the flag, workers clear it when they are done with the stream
+    if (__atomic_load_n(&stream->is_dispatched, __ATOMIC_ACQUIRE))
+        return;
+    __atomic_store_n(&stream->is_dispatched, true, __ATOMIC_RELAXED);
+
+    pthread_mutex_lock(&fsc->update_queue_lock);
+    stream->next_task = NULL;
+    if (fsc->update_queue_tail == NULL)
+        fsc->update_queue_head = stream;
+    else
+        fsc->update_queue_tail->next_task = stream;
+    fsc->update_queue_tail = stream;
+    pthread_cond_signal(&fsc->update_queue_ready);
+    pthread_mutex_unlock(&fsc->update_queue_lock);
+}
+
+/**
+ * Worker thread, runs queued streams until the pool is stopped and the queue is empty
+ */
+static void *_update_worker(void *argument)
+{
+    Fsc_Context *fsc = argument;
+    worker_context = fsc;
+
+    pthread_mutex_lock(&fsc->update_queue_lock);
+    while (true)
+    {
+        while (fsc->update_queue_head == NULL && !fsc->is_pool_stopping)
+            pthread_cond_wait(&fsc->update_queue_ready, &fsc->update_queue_lock);
+
+        if (fsc->update_queue_head == NULL)
+            break; // stopping and nothing left
+
+        Data_Stream *stream = fsc->update_queue_head;
+        fsc->update_queue_head = stream->next_task;
+        if (fsc->update_queue_head == NULL)
+            fsc->update_queue_tail = NULL;
+        pthread_mutex_unlock(&fsc->update_queue_lock);
+
+        if (__atomic_load_n(&stream->is_active, __ATOMIC_ACQUIRE))
+            _update_stream(stream);
+
+        // the wait skips streams on a worker, a frame that came in meanwhile has to wake it now.
+        // The registry stays locked until the check is done, a handed back stream may be removed and freed
+        bool is_ring_attached = stream->transport == SHARED_MEMORY_TRANSPORT && stream->is_ring_attached;
+        unsigned long long sequence = stream->sequence;
+        pthread_mutex_lock(&fsc->registry_lock);
+        __atomic_store_n(&stream->is_dispatched, false, __ATOMIC_SEQ_CST);
+        bool has_work = is_ring_attached && _has_shared_memory_work(stream, sequence, _monotonic_ns());
+        pthread_mutex_unlock(&fsc->registry_lock);
+        if (has_work)
+            _wake_stream_wait(fsc);
+
+        pthread_mutex_lock(&fsc->update_queue_lock);
+    }
+    pthread_mutex_unlock(&fsc->update_queue_lock);
+
+    return NULL;
+}
+
+/**
+ * Lets the workers finish the queued streams and joins them, does nothing if there are none
+ */
+static void _stop_update_workers(Fsc_Context *fsc)
+{
+    if (fsc->update_workers == NULL)
+        return;
+
+    pthread_mutex_lock(&fsc->update_queue_lock);
+    fsc->is_pool_stopping = true;
+    pthread_cond_broadcast(&fsc->update_queue_ready);
+    pthread_mutex_unlock(&fsc->update_queue_lock);
+
+    for (unsigned int worker = 0; worker < fsc->update_worker_count; worker++)
+        pthread_join(fsc->update_workers[worker], NULL);
+
+    free(fsc->update_workers);
+    fsc->update_workers = NULL;
+    fsc->update_worker_count = 0;
+    fsc->is_pool_stopping = false;
+}
+
+/**
+ * Event driven version of update_streams, place in a loop instead of update_streams + sleep.
+ * Updates the streams, blocks until a .flag or .ack file changes in a watched directory
+ * (or a frame is renamed into place or removed by its reader),
+ * a shared memory frame arrives, a rate scheduled stream is due or timeout_ms passes, and updates the streams again.
+ * With rate scheduled streams wait_and_update_streams(fsc, -1) is the whole main loop.
+ * How it waits is up to the wait strategies of the streams: blocking (inotify, a wake bridge thread per
+ * shared memory stream turning its futex into an eventfd, timerfd), timed sleep, spin then yield or busy spin.
+ * Wait CPU time and wake to callback latency are kept in the stream stats.
+ * A signal caught by the calling thread ends the wait early, so a handler can stop that loop.
+ * \param fsc context to update
+ * \param timeout_ms longest time to block, negative to wait until something happens
+ * \return 0 if woken up by an event, 1 on timeout
+ */
+int wait_and_update_streams(Fsc_Context *fsc, int timeout_ms)
+{
+    update_streams(fsc);
+
+    __atomic_store_n(&fsc->last_wake_ns, 0, __ATOMIC_RELEASE);
+    long long cpu_ns = _thread_cpu_ns();
+
+    bool was_woken = _wait_for_stream_event(fsc, timeout_ms);
+
+    _charge_wait_cpu(fsc, _thread_cpu_ns() - cpu_ns);
+    if (was_woken)
+        __atomic_store_n(&fsc->last_wake_ns, _monotonic_ns(), __ATOMIC_RELEASE);
+
+    // on_ready may have removed the last stream during the first update
+    if (fsc->head_data_stream != NULL)
+        update_streams(fsc);
+    return was_woken ? 0 : 1;
+}
+
+/**
+ * Function called by framework users to write data to file system. Behaves same as fprintf.
+ * The line is formatted into the stream's frame buffer, the protocol writes the whole frame
+ * with one pwrite after on_ready returns. Buffer only grows, so steady state frames allocate nothing.
+ * \param context contains all the function calls and provides necessary context for the function to be executed on the right files
+ * \param fmt format string
+ * \param ... parameters specified in format string
+ */
+static void _send_line(Data_Stream *context, const char *fmt, ...)
+{
+    size_t space_left = context->frame_buffer_size - context->frame_length;
+
+    va_list args;
+    va_start(args, fmt);
+    int length = context->frame_buffer != NULL
+        ? vsnprintf(context->frame_buffer + context->frame_length, space_left, fmt, args)
+        : vsnprintf(NULL, 0, fmt, args);
+    va_end(args);
+
+    if (length < 0)
+        return;
+
+    if ((size_t)length >= space_left)
+    {
+        // line did not fit, grow the buffer and format it again
+        size_t needed = context->frame_length + (size_t)length + 1;
+        if (_grow_frame_buffer(context, needed > context->frame_buffer_size * 2 ? needed : context->frame_buffer_size * 2))
+            return;
+
+        va_start(args, fmt);
+        vsnprintf(context->frame_buffer + context->frame_length, context->frame_buffer_size - context->frame_length, fmt, args);
+        va_end(args);
+    }
+
+    context->frame_length += (size_t)length;
+}
+
+/**
+ * send_line of streams whose frame lives in memory (frame_data), formats straight into the frame.
+ * Output that does not fit into frame_capacity is cut off and reported.
+ */
+static void _send_line_to_frame(Data_Stream *context, const char *fmt, ...)
+{
+    size_t space_left = context->frame_capacity - context->frame_length;
+
+    va_list args;
+    va_start(args, fmt);
+
+    int written = vsnprintf(context->frame_data + context->frame_length, space_left, fmt, args);
+
+    va_end(args);
+
+    if (written < 0)
+        return;
+
+    if ((size_t)written >= space_left)
+    {
+        _log_error("ERROR: Frame of stream %s exceeds %zu bytes, line was cut off\n", context->stream_name, context->frame_capacity);
+        // vsnprintf always terminates, the terminator is not part of the frame
+        context->frame_length += space_left > 0 ? space_left - 1 : 0;
+        return;
+    }
+
+    context->frame_length += (size_t)written;
+}
+
+/**
+ * read_line of streams whose frame lives in memory (frame_data). Behaves same as fgets
+ * \return returns null if end of the frame was reached
+ */
+static char *_read_line_from_frame(Data_Stream *context, char *line_buffer, int max_count)
+{
+    if (max_count <= 0 || context->frame_offset >= context->frame_length)
+        return NULL;
+
+    size_t available = context->frame_length - context->frame_offset;
+    size_t limit = (size_t)max_count - 1;
+    const char *start = context->frame_data + context->frame_offset;
+
+    // copy up to and including the new line, same as fgets
+    const char *new_line = memchr(start, '\n', available < limit ? available : limit);
+    size_t count = new_line != NULL ? (size_t)(new_line - start) + 1 : (available < limit ? available : limit);
+
+    memcpy(line_buffer, start, count);
+    line_buffer[count] = '\0';
+    context->frame_offset += count;
+
+    return line_buffer;
+}
+
+/**
+ * read_frame of every stream. File frames were read into frame_buffer with one pread,
+ * shared memory frames point straight into the ring (or the copy of a latest value frame)
+ * \return non zero if there is no frame, called outside of on_ready or on a write stream
+ */
+static int _read_frame(Data_Stream *context, const char **data, size_t *length)
+{
+    if (_is_write_stream(context) || context->frame_data == NULL)
+        return 1;
+
+    *data = context->frame_data + context->frame_offset;
+    *length = context->frame_length - context->frame_offset;
+    context->frame_offset = context->frame_length;
+    return 0;
+}
+
+/**
+ * send_struct of every stream, encodes the message right behind its Typed_Frame_Header in the frame
+ * \return non zero if called on a read stream or the frame can't hold the message
+ */
+static int _send_struct(Data_Stream *context, const Message_Descriptor *descriptor, const void *message)
+{
+    if (!_is_write_stream(context))
+        return 1;
+
+    size_t record_length = sizeof(Typed_Frame_Header) + descriptor->wire_size;
+    unsigned char *record = _reserve_frame_space(context, record_length);
+    if (record == NULL)
+        return 1;
+
+    Typed_Frame_Header header = { descriptor->type_id, descriptor->wire_size };
+    memcpy(record, &header, sizeof(header));
+    descriptor->encode(message, record + sizeof(header));
+
+    context->frame_length += record_length;
+    return 0;
+}
+
+/**
+ * read_struct of every stream, decodes the message at the read position of the frame
+ * \return non zero at the end of the frame or if the next message does not match the descriptor
+ */
+static int _read_struct(Data_Stream *context, const Message_Descriptor *descriptor, void *message)
+{
+    if (_is_write_stream(context) || context->frame_data == NULL)
+        return 1;
+
+    size_t available = context->frame_length - context->frame_offset;
+    if (available < sizeof(Typed_Frame_Header))
+        return 1;
+
+    const char *record = context->frame_data + context->frame_offset;
+    Typed_Frame_Header header;
+    memcpy(&header, record, sizeof(header));
+
+    if (header.type_id != descriptor->type_id || header.length != descriptor->wire_size
+        || available - sizeof(header) < header.length)
+    {
+        _log_error("ERROR: Next message of stream %s is not a %s\n", context->stream_name, descriptor->name);
+        return 1;
+    }
+
+    descriptor->decode((const unsigned char *)record + sizeof(header), message);
+    context->frame_offset += sizeof(header) + header.length;
+    return 0;
+}
+
+/**
+ * Makes room for length more bytes at the end of the frame being written.
+ * Shared memory frames are limited to frame_capacity, file frames grow the frame buffer
+ * \return where the bytes go, caller adds length to frame_length once written. NULL if there is no room
+ */
+static unsigned char *_reserve_frame_space(Data_Stream *context, size_t length)
+{
+    if (context->transport == SHARED_MEMORY_TRANSPORT)
+    {
+        if (length > context->frame_capacity - context->frame_length)
+        {
+            _log_error("ERROR: Frame of stream %s exceeds %zu bytes\n", context->stream_name, context->frame_capacity);
+            return NULL;
+        }
+        return (unsigned char *)context->frame_data + context->frame_length;
+    }
+
+    size_t needed = context->frame_length + length;
+    if (needed > context->frame_buffer_size
+        && _grow_frame_buffer(context, needed > context->frame_buffer_size * 2 ? needed : context->frame_buffer_size * 2))
+        return NULL;
+
+    return (unsigned char *)context->frame_buffer + context->frame_length;
+}
+
+/**
+ * Creates a new data stream and adds it to the linked list
+ * \return pointer to newly created data stream or NULL on failure
+ */
+static Data_Stream * _allocate_new_data_stream(Fsc_Context *fsc)
+{
+    Data_Stream *tmp = malloc(sizeof(Data_Stream));
+    if (!tmp)
+    {
+        _log_error("ERROR: Failed to allocate memory for new data stream\n");
+        return NULL;
+    }
+
+    _populate_data_stream_with_defaults(tmp);
+    tmp->owner = fsc;
+
+    // appended at the tail so streams are updated in creation order
+    if (fsc->tail_data_stream == NULL)
+    {
+        fsc->head_data_stream = tmp;
+    }
+    else
+    {
+        fsc->tail_data_stream->next = tmp;
+        tmp->previous = fsc->tail_data_stream;
+    }
+    fsc->tail_data_stream = tmp;
+
+    return tmp;
+}
+
+/**
+ * Releases everything the stream holds and the stream itself, stream has to be unlinked already
+ */
+static void _free_data_stream(Data_Stream *stream)
+{
+    _stop_wake_bridge(stream);
+    // writer owns the shared memory object, reader only unmaps it
+    shared_memory_ring_detach(&stream->ring, _is_write_stream(stream));
+    _close_slot_files(stream);
+    free(stream->latency_histograms);
+    free(stream->slot_publish_ns);
+    free(stream->frame_buffer);
+    free(stream);
+}
+
+/**
+ * Takes the stream out of the update list
+ */
+static void _unlink_data_stream(Data_Stream *stream)
+{
+    Fsc_Context *fsc = stream->owner;
+    if (stream->previous != NULL)
+        stream->previous->next = stream->next;
+    else
+        fsc->head_data_stream = stream->next;
+
+    if (stream->next != NULL)
+        stream->next->previous = stream->previous;
+    else
+        fsc->tail_data_stream = stream->previous;
+
+    stream->next = stream->previous = NULL;
+}
+
+/**
+ * Frees streams whose removal was deferred while update_streams was running, registry_lock has to be held
+ */
+static void _free_removed_streams(Fsc_Context *fsc)
+{
+    bool is_any_in_use = false;
+
+    Data_Stream *current = fsc->head_data_stream;
+    while (current != NULL)
+    {
+        Data_Stream *next = current->next;
+        if (current->is_removed)
+        {
+            // worker still runs its protocol, try again after the next update
+            if (__atomic_load_n(&current->is_dispatched, __ATOMIC_ACQUIRE))
+            {
+                is_any_in_use = true;
+            }
+            else
+            {
+                _unlink_data_stream(current);
+                _free_data_stream(current);
+            }
+        }
+        current = next;
+    }
+    fsc->has_removed_streams = is_any_in_use;
+}
+
+/**
+ * FNV-1a hash of the stream name followed by its type
+ */
+static unsigned int _hash_stream_key(const char *stream_name, enum Stream_type stream_type)
+{
+    uint32_t hash = 2166136261u;
+    for (const unsigned char *c = (const unsigned char *)stream_name; *c != '\0'; c++)
+    {
+        hash ^= *c;
+        hash *= 16777619u;
+    }
+    hash ^= (uint32_t)stream_type;
+    hash *= 16777619u;
+    return hash;
+}
+
+/**
+ * \return registered stream with given name and type, NULL if there is none
+ */
+static Data_Stream *_find_indexed_stream(Fsc_Context *fsc, const char *stream_name, enum Stream_type stream_type, unsigned int key_hash)
+{
+    if (fsc->stream_index == NULL)
+        return NULL;
+
+    Data_Stream *current = fsc->stream_index[key_hash & (fsc->stream_index_size - 1)];
+    while (current != NULL)
+    {
+        if (current->key_hash == key_hash && current->stream_type == stream_type && !strcmp(current->stream_name, stream_name))
+            return current;
+        current = current->next_in_bucket;
+    }
+    return NULL;
+}
+
+/**
+ * Adds the stream to the hash index, growing it when it gets too full. The index on (name, type) makes
+ * create, find and remove O(1), the linked list next to it keeps the creation order for updates
+ * \return 0 if all goes well
+ */
+static int _index_stream(Data_Stream *stream)
+{
+    Fsc_Context *fsc = stream->owner;
+    if ((fsc->stream_count + 1) * 4 > fsc->stream_index_size * 3 && _grow_stream_index(fsc))
+        return 1;
+
+    stream->key_hash = _hash_stream_key(stream->stream_name, stream->stream_type);
+    Data_Stream **bucket = &fsc->stream_index[stream->key_hash & (fsc->stream_index_size - 1)];
+    stream->next_in_bucket = *bucket;
+    *bucket = stream;
+    fsc->stream_count++;
+    return 0;
+}
+
+/**
+ * Removes the stream from the hash index
+ */
+static void _unindex_stream(Data_Stream *stream)
+{
+    Fsc_Context *fsc = stream->owner;
+    Data_Stream **link = &fsc->stream_index[stream->key_hash & (fsc->stream_index_size - 1)];
+    while (*link != NULL)
+    {
+        if (*link == stream)
+        {
+            *link = stream->next_in_bucket;
+            stream->next_in_bucket = NULL;
+            fsc->stream_count--;
+            return;
+        }
+        link = &(*link)->next_in_bucket;
+    }
+}
+
+/**
+ * Doubles the hash index (power of two sizes) and moves every stream to its new bucket
+ * \return 0 if all goes well
+ */
+static int _grow_stream_index(Fsc_Context *fsc)
+{
+    size_t new_size = fsc->stream_index_size ? fsc->stream_index_size * 2 : STREAM_INDEX_INITIAL_SIZE;
+    Data_Stream **new_index = calloc(new_size, sizeof(Data_Stream *));
+    if (new_index == NULL)
+    {
+        _log_error("ERROR: Failed to grow stream registry to %zu buckets\n", new_size);
+        return 1;
+    }
+
+    for (size_t bucket = 0; bucket < fsc->stream_index_size; bucket++)
+    {
+        Data_Stream *current = fsc->stream_index[bucket];
+        while (current != NULL)
+        {
+            Data_Stream *next = current->next_in_bucket;
+            Data_Stream **new_bucket = &new_index[current->key_hash & (new_size - 1)];
+            current->next_in_bucket = *new_bucket;
+            *new_bucket = current;
+            current = next;
+        }
+    }
+
+    free(fsc->stream_index);
+    fsc->stream_index = new_index;
+    fsc->stream_index_size = new_size;
+    return 0;
+}
+
+/**
+ * Sets provided data stream with safe known default values
+ */
+static void _populate_data_stream_with_defaults(Data_Stream *stream)
+{
+    stream->next = NULL;
+    stream->owner = NULL;
+    stream->previous = NULL;
+    stream->next_in_bucket = NULL;
+    stream->key_hash = 0;
+    stream->is_removed = false;
+    stream->is_dispatched = false;
+    stream->next_task = NULL;
+    stream->is_active = false;
+    stream->is_first_write = true;
+    stream->stream_type = READ_ONLY_STREAM;
+    stream->transport = FILE_SYSTEM_TRANSPORT;
+    stream->publication = SIGNAL_FILE_PUBLICATION;
+    stream->queue_depth = 1;
+    stream->sequence = 0;
+    stream->period_ns = 0;
+    stream->deadline_ns = 0;
+    stream->next_due_ns = 0;
+    stream->wait_strategy = WAIT_BLOCKING;
+    stream->wait_interval_ms = DEFAULT_WAIT_INTERVAL_MS;
+    stream->handled_wake_ns = 0;
+    stream->is_waiting_for_space = false;
+    stream->wake_bridge_events = 0;
+    stream->has_wake_bridge = false;
+    stream->is_bridge_stopping = false;
+    stream->latency_histograms = NULL;
+    stream->frame_publish_ns = 0;
+    memset(&stream->frame_trace, 0, sizeof(stream->frame_trace));
+    stream->slot_publish_ns = NULL;
+    stream->acked_sequence = 0;
+    stream->skipped_frames = 0;
+    memset(&stream->stats, 0, sizeof(stream->stats));
+    stream->on_ready = NULL;
+    stream->slot_files = NULL;
+    memset(&stream->published_file, 0, sizeof(stream->published_file));
+    memset(&stream->ring, 0, sizeof(stream->ring));
+    stream->is_ring_attached = false;
+    stream->has_ring_error = false;
+    stream->ring_check_ns = 0;
+    stream->frame_data = NULL;
+    stream->frame_length = 0;
+    stream->frame_capacity = 0;
+    stream->frame_offset = 0;
+    stream->frame_buffer = NULL;
+    stream->frame_buffer_size = 0;
+    stream->stream_name[0] = '\0';
+    stream->flag_file_path[0] = '\0';
+    stream->data_file_path[0] = '\0';
+    stream->ack_file_path[0] = '\0';
+    stream->send_line = _send_line;
+    stream->read_line = _read_line_from_frame;
+    stream->read_frame = _read_frame;
+    stream->send_struct = _send_struct;
+    stream->read_struct = _read_struct;
+}
+
+
+
+/**
+ * Makes sure the name is not over MAX_NAME_LENGTH
+ * and that there is no other data stream of the same stream type with same name
+ * \return true if name is valid otherwise false
+ */
+static bool _is_stream_name_valid(Fsc_Context *fsc, const char *stream_name, enum Stream_type stream_type)
+{
+    // makes sure we don't overflow on the name
+    if (strlen(stream_name) >= MAX_NAME_LENGTH)
+    {
+        _log_error("ERROR: Stream name exceeds maximum length\n");
+        return false;
+    }
+
+    if (find_data_stream(fsc, stream_name, stream_type) != NULL)
+    {
+        _log_error("ERROR: Stream with the same name and type already exists\n");
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Makes sure the transport settings can be used
+ * \return true if options are valid otherwise false
+ */
+static bool _are_options_valid(const Data_Stream_Options *options)
+{
+    if (options->transport != FILE_SYSTEM_TRANSPORT && options->transport != SHARED_MEMORY_TRANSPORT)
+    {
+        _log_error("ERROR: Unknown stream transport\n");
+        return false;
+    }
+
+    if (options->transport == SHARED_MEMORY_TRANSPORT && (options->frame_capacity == 0 || options->frame_capacity > UINT32_MAX))
+    {
+        _log_error("ERROR: Shared memory frame capacity has to be between 1 and %u bytes\n", UINT32_MAX);
+        return false;
+    }
+
+    if (options->publication != SIGNAL_FILE_PUBLICATION && options->publication != RENAME_PUBLICATION)
+    {
+        _log_error("ERROR: Unknown frame publication\n");
+        return false;
+    }
+
+    if (options->wait_strategy != WAIT_BLOCKING && options->wait_strategy != WAIT_TIMED_SLEEP
+        && options->wait_strategy != WAIT_SPIN_THEN_YIELD && options->wait_strategy != WAIT_BUSY_SPIN)
+    {
+        _log_error("ERROR: Unknown wait strategy\n");
+        return false;
+    }
+
+    // written this way so NaN fails as well
+    if (!(options->rate_hz >= 0) || !(options->deadline_ms >= 0))
+    {
+        _log_error("ERROR: Stream rate and deadline can't be negative\n");
+        return false;
+    }
+
+    if (options->queue_depth > MAX_QUEUE_DEPTH)
+    {
+        _log_error("ERROR: Queue depth can be at most %d\n", MAX_QUEUE_DEPTH);
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * populate given data stream with provided data and activates it
+ */
+static void _populate_stream_data(Data_Stream *stream, const char *stream_name, enum Stream_type stream_type, void (*on_ready)(Data_Stream *), const Data_Stream_Options *options)
+{
+    // Assign the stream name, in a safe way to prevent buffer overflow
+    snprintf(stream->stream_name, sizeof(stream->stream_name), "%s", stream_name);
+
+    if (options->transport == SHARED_MEMORY_TRANSPORT)
+    {
+        // data path is informative only, frames live in /dev/shm
+        size_t directory_length = STRLEN_LITERAL(SHARED_MEMORY_RING_DIRECTORY);
+        memcpy(stream->data_file_path, SHARED_MEMORY_RING_DIRECTORY, directory_length);
+        shared_memory_ring_get_name(stream_name, stream->data_file_path + directory_length, sizeof(stream->data_file_path) - directory_length);
+
+        stream->frame_capacity = options->frame_capacity;
+        stream->queue_depth = options->queue_depth ? options->queue_depth : SHARED_MEMORY_DEFAULT_SLOT_COUNT;
+        stream->send_line = _send_line_to_frame;
+    }
+    else
+    {
+        stream->queue_depth = options->queue_depth ? options->queue_depth : 1;
+        _select_slot(stream);
+    }
+
+    // first tick is due right away, following ones on multiples of the period from there
+    if (options->rate_hz > 0)
+    {
+        stream->period_ns = (long long)(1e9 / options->rate_hz);
+        stream->period_ns = stream->period_ns > 0 ? stream->period_ns : 1;
+        stream->deadline_ns = options->deadline_ms > 0 ? (long long)(options->deadline_ms * 1e6) : stream->period_ns;
+        stream->next_due_ns = _monotonic_ns();
+    }
+
+    stream->wait_strategy = options->wait_strategy;
+    stream->wait_interval_ms = options->wait_interval_ms > 0 ? options->wait_interval_ms : DEFAULT_WAIT_INTERVAL_MS;
+
+    stream->on_ready = on_ready;
+    stream->stream_type = stream_type;
+    stream->transport = options->transport;
+    stream->publication = options->publication;
+    stream->is_active = true;
+}
+
+/**
+ * Generates the file names of the slot the next frame goes to or comes from.
+ * Streams with queue depth 1 keep the plain <name>.txt/.flag/.ack names,
+ * deeper queues use <name>.<slot>.txt/.flag/.ack with slot = sequence % queue_depth
+ */
+static void _select_slot(Data_Stream *stream)
+{
+    unsigned int slot = (unsigned int)(stream->sequence % stream->queue_depth);
+
+    _build_slot_path(stream, slot, DATA_FILE_EXTENSION, stream->data_file_path, sizeof(stream->data_file_path));
+    _build_slot_path(stream, slot, FLAG_FILE_EXTENSION, stream->flag_file_path, sizeof(stream->flag_file_path));
+    _build_slot_path(stream, slot, ACK_FILE_EXTENSION, stream->ack_file_path, sizeof(stream->ack_file_path));
+}
+
+/**
+ * Generates name of one file of given slot, <name>.<slot><extension> or <name><extension> for queue depth 1
+ */
+static void _build_slot_path(const Data_Stream *stream, unsigned int slot, const char *extension, char *path, size_t size)
+{
+    char slot_suffix[MAX_SLOT_SUFFIX_LENGTH + 1] = "";
+    if (stream->queue_depth > 1)
+        snprintf(slot_suffix, sizeof(slot_suffix), ".%u", (unsigned int)(unsigned char)slot); // depth <= 256 so slot fits a byte
+
+    snprintf(path, size, "%s%s%s", stream->stream_name, slot_suffix, extension);
+}
+
+/**
+ * Opens (creating if needed) data, flag and ack file of every slot and reads back
+ * the handshake state, so a stream picks up where the previous run left off.
+ * The descriptors stay open for the life of the stream, frames are pwritten in place and the
+ * handshake only toggles file sizes, every call is counted in stats.syscalls
+ * \return 0 if all goes well
+ */
+static int _open_slot_files(Data_Stream *stream)
+{
+    stream->slot_files = calloc(stream->queue_depth, sizeof(Stream_Slot_Files));
+    if (stream->slot_files == NULL)
+    {
+        _log_error("ERROR: Failed to allocate slots of stream %s\n", stream->stream_name);
+        return 1;
+    }
+
+    for (unsigned int slot = 0; slot < stream->queue_depth; slot++)
+        stream->slot_files[slot].data_fd = stream->slot_files[slot].flag_fd = stream->slot_files[slot].ack_fd = -1;
+
+    for (unsigned int slot = 0; slot < stream->queue_depth; slot++)
+    {
+        Stream_Slot_Files *files = &stream->slot_files[slot];
+        char path[MAX_DATA_PATH_LENGTH];
+
+        _build_slot_path(stream, slot, DATA_FILE_EXTENSION, path, sizeof(path));
+        files->data_fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+        COUNT_SYSCALL(stream);
+
+        _build_slot_path(stream, slot, FLAG_FILE_EXTENSION, path, sizeof(path));
+        files->flag_fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+        COUNT_SYSCALL(stream);
+
+        _build_slot_path(stream, slot, ACK_FILE_EXTENSION, path, sizeof(path));
+        files->ack_fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+        COUNT_SYSCALL(stream);
+
+        if (files->data_fd < 0 || files->flag_fd < 0 || files->ack_fd < 0)
+        {
+            _log_error("ERROR: Failed to open files of slot %u of stream %s\n", slot, stream->stream_name);
+            return 1;
+        }
+
+        files->signal = _read_signal(stream, stream->stream_type == WRITE_ONLY_STREAM ? files->flag_fd : files->ack_fd);
+    }
+
+    return 0;
+}
+
+/**
+ * Closes every descriptor opened by _open_slot_files, files stay on disk
+ */
+static void _close_slot_files(Data_Stream *stream)
+{
+    if (stream->slot_files == NULL)
+        return;
+
+    for (unsigned int slot = 0; slot < stream->queue_depth; slot++)
+    {
+        Stream_Slot_Files *files = &stream->slot_files[slot];
+        if (files->data_fd >= 0)
+            close(files->data_fd);
+        if (files->flag_fd >= 0)
+            close(files->flag_fd);
+        if (files->ack_fd >= 0)
+            close(files->ack_fd);
+    }
+
+    free(stream->slot_files);
+    stream->slot_files = NULL;
+}
+
+/**
+ * Handles reading of data by:
+ * - checking for ack of the next slot / unless the slot was not written yet
+ * - rewriting the data file in place,
+ * - toggling the flag,
+ * - moving to the next slot
+ * \param stream contains context necessary to execute the protocol
+ */
+static void _handle_write_protocol(Data_Stream *stream)
+{
+    Stream_Slot_Files *slot = _current_slot(stream);
+
+    unsigned int slot_index = (unsigned int)(stream->sequence % stream->queue_depth);
+
+    bool was_read = _was_data_read(stream, slot);
+    if (!was_read && !stream->is_first_write)
+        return;
+    if (was_read)
+        _record_slot_ack(stream, slot_index);
+
+    _begin_frame_header(stream);
+
+    _log_informative(stream->owner, "DEBUG: Building frame of %s\n", stream->stream_name);
+    // event calling subscribed function
+    _call_on_ready(stream);
+
+    _stamp_frame_header(stream);
+    if (_write_frame_file(stream, slot->data_fd))
+    {
+        _log_error("ERROR: Failed to write data file %s\n", stream->data_file_path);
+        return;
+    }
+
+    // leftovers of a longer previous frame have to go
+    if (stream->frame_length < slot->last_frame_length)
+    {
+        COUNT_SYSCALL(stream);
+        if (ftruncate(slot->data_fd, (off_t)stream->frame_length))
+            _log_error("ERROR: Failed to truncate data file %s\n", stream->data_file_path);
+    }
+    slot->last_frame_length = stream->frame_length;
+
+    // frame left unread by a previous run still has its flag up, it was just replaced in place
+    if (was_read)
+        _write_signal(stream, slot->flag_fd, slot->signal = !slot->signal);
+    stream->slot_publish_ns[slot_index] = stream->frame_publish_ns;
+
+    stream->stats.frames++;
+    stream->sequence++;
+    stream->is_first_write = stream->sequence < stream->queue_depth;
+    _select_slot(stream);
+}
+
+/**
+ * Handles reading of data, for every slot that is ready in order:
+ * - checking the flag,
+ * - reading the data,
+ * - toggling the ack,
+ * - moving to the next slot
+ * \param stream contains context necessary to execute the protocol
+ */
+static void _handle_read_protocol(Data_Stream *stream)
+{
+    // at most one full queue per update so a fast writer can't starve other streams
+    for (unsigned int frame = 0; frame < stream->queue_depth && stream->is_active; frame++)
+    {
+        Stream_Slot_Files *slot = _current_slot(stream);
+
+        // Skip if flag data is not pressent
+        if (!_is_data_ready(stream, slot))
+            return;
+
+        if (_read_frame_file(stream, slot->data_fd))
+        {
+            _log_error("ERROR: Failed to read data file %s\n", stream->data_file_path);
+            return;
+        }
+
+        unsigned long long sequence;
+        if (!_read_frame_header(stream, &sequence))
+            _log_informative(stream->owner, "DEBUG: Data file %s has no frame header, publish time unknown\n", stream->data_file_path);
+
+        _log_informative(stream->owner, "DEBUG: Data file %s opened for reading\n", stream->data_file_path);
+        // event calling subscribed function
+        _call_on_ready(stream);
+        stream->frame_data = NULL;
+
+        _write_signal(stream, slot->ack_fd, slot->signal = !slot->signal);
+
+        stream->stats.frames++;
+        stream->sequence++;
+        _select_slot(stream);
+    }
+}
+
+/**
+ * Rename publication write protocol:
+ * - checking that the reader removed the data file of the slot, the removal is the ack,
+ * - writing the frame into <name>.tmp,
+ * - renaming it to <name>.txt which makes it visible to the reader in one step,
+ * - moving to the next slot
+ * \param stream contains context necessary to execute the protocol
+ */
+static void _handle_rename_write_protocol(Data_Stream *stream)
+{
+    // previous frame of the slot was not taken yet
+    COUNT_SYSCALL(stream);
+    if (!access(stream->data_file_path, F_OK))
+        return;
+
+    unsigned int slot_index = (unsigned int)(stream->sequence % stream->queue_depth);
+    _record_slot_ack(stream, slot_index);
+
+    char temp_file_path[MAX_NAME_LENGTH + MAX_SLOT_SUFFIX_LENGTH + STRLEN_LITERAL(TEMP_FILE_EXTENSION)];
+    _build_slot_path(stream, slot_index, TEMP_FILE_EXTENSION, temp_file_path, sizeof(temp_file_path));
+
+    _begin_frame_header(stream);
+
+    _log_informative(stream->owner, "DEBUG: Building frame of %s\n", stream->stream_name);
+    // event calling subscribed function
+    _call_on_ready(stream);
+
+    _stamp_frame_header(stream);
+    if (_publish_frame_file(stream, temp_file_path))
+        return;
+    stream->slot_publish_ns[slot_index] = stream->frame_publish_ns;
+
+    stream->stats.frames++;
+    stream->sequence++;
+    _select_slot(stream);
+}
+
+/**
+ * Writes the frame built in frame_buffer into a fresh temporary file and renames it to data_file_path
+ * \return 0 if all goes well
+ */
+static int _publish_frame_file(Data_Stream *stream, const char *temp_file_path)
+{
+    COUNT_SYSCALL(stream);
+    int fd = open(temp_file_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if (fd < 0)
+    {
+        _log_error("ERROR: Failed to open temporary file %s for writing\n", temp_file_path);
+        return 1;
+    }
+
+    int result = _write_frame_file(stream, fd);
+    COUNT_SYSCALL(stream);
+    close(fd);
+    if (result)
+    {
+        _log_error("ERROR: Failed to write temporary file %s\n", temp_file_path);
+        return 1;
+    }
+
+    COUNT_SYSCALL(stream);
+    if (rename(temp_file_path, stream->data_file_path))
+    {
+        _log_error("ERROR: Failed to publish %s as %s\n", temp_file_path, stream->data_file_path);
+        return 1;
+    }
+
+    return 0;
+}
+
+/**
+ * Rename publication read protocol, for every slot that is ready in order:
+ * - opening the data file, it only exists once the whole frame was renamed into place,
+ * - reading the data,
+ * - removing the data file which tells the writer the slot is free,
+ * - moving to the next slot
+ * \param stream contains context necessary to execute the protocol
+ */
+static void _handle_rename_read_protocol(Data_Stream *stream)
+{
+    // at most one full queue per update so a fast writer can't starve other streams
+    for (unsigned int frame = 0; frame < stream->queue_depth && stream->is_active; frame++)
+    {
+        COUNT_SYSCALL(stream);
+        int fd = open(stream->data_file_path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            return; // nothing published
+
+        int result = _read_frame_file(stream, fd);
+        COUNT_SYSCALL(stream);
+        close(fd);
+        if (result)
+        {
+            _log_error("ERROR: Failed to read data file %s\n", stream->data_file_path);
+            return;
+        }
+
+        unsigned long long sequence;
+        if (!_read_frame_header(stream, &sequence))
+            _log_informative(stream->owner, "DEBUG: Data file %s has no frame header, publish time unknown\n", stream->data_file_path);
+
+        _log_informative(stream->owner, "DEBUG: Data file %s opened for reading\n", stream->data_file_path);
+        // event calling subscribed function
+        _call_on_ready(stream);
+        stream->frame_data = NULL;
+
+        COUNT_SYSCALL(stream);
+        if (unlink(stream->data_file_path))
+            _log_error("ERROR: Failed to remove data file %s\n", stream->data_file_path);
+
+        stream->stats.frames++;
+        stream->sequence++;
+        _select_slot(stream);
+    }
+}
+
+/**
+ * Latest value write protocol on the file system, never waits for the reader:
+ * - writing the frame header and data into <name>.tmp,
+ * - renaming it over <name>.txt, so the reader sees either the old or the new frame but never half of one
+ * \param stream contains context necessary to execute the protocol
+ */
+static void _handle_latest_write_protocol(Data_Stream *stream)
+{
+    char temp_file_path[MAX_NAME_LENGTH + STRLEN_LITERAL(TEMP_FILE_EXTENSION)];
+    snprintf(temp_file_path, sizeof(temp_file_path), "%s%s", stream->stream_name, TEMP_FILE_EXTENSION);
+
+    _begin_frame_header(stream);
+
+    _log_informative(stream->owner, "DEBUG: Building frame of %s\n", stream->stream_name);
+    // event calling subscribed function
+    _call_on_ready(stream);
+
+    _stamp_frame_header(stream);
+    if (_publish_frame_file(stream, temp_file_path))
+        return;
+
+    stream->stats.frames++;
+    stream->sequence++;
+}
+
+/**
+ * Latest value read protocol on the file system:
+ * - checking with stat whether a new file was renamed into place since the last read,
+ * - reading the whole file and its frame header, same sequence as last time means there is nothing new,
+ * - letting the user read the data after the header
+ * \param stream contains context necessary to execute the protocol
+ */
+static void _handle_latest_read_protocol(Data_Stream *stream)
+{
+    struct stat info;
+    COUNT_SYSCALL(stream);
+    if (stat(stream->data_file_path, &info))
+        return; // nothing was published yet
+
+    Stream_File_Identity identity = { (unsigned long long)info.st_ino, (unsigned long long)info.st_size,
+                                      (long long)info.st_mtim.tv_sec * 1000000000LL + info.st_mtim.tv_nsec };
+    if (!memcmp(&identity, &stream->published_file, sizeof(identity)))
+        return;
+
+    COUNT_SYSCALL(stream);
+    int fd = open(stream->data_file_path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return;
+
+    int result = _read_frame_file(stream, fd);
+    COUNT_SYSCALL(stream);
+    close(fd);
+    if (result)
+    {
+        _log_error("ERROR: Failed to read data file %s\n", stream->data_file_path);
+        return;
+    }
+    stream->published_file = identity;
+
+    // the sequence in the header tells if the frame is new
+    unsigned long long sequence;
+    if (!_read_frame_header(stream, &sequence))
+    {
+        _log_error("ERROR: Data file %s has no frame header, is the writer a latest value stream?\n", stream->data_file_path);
+        stream->frame_data = NULL;
+        return;
+    }
+
+    if (_accept_latest_sequence(stream, sequence))
+    {
+        _log_informative(stream->owner, "DEBUG: Data file %s opened for reading\n", stream->data_file_path);
+        // event calling subscribed function
+        _call_on_ready(stream);
+        stream->stats.frames++;
+    }
+
+    stream->frame_data = NULL;
+}
+
+/**
+ * Latest value write protocol in shared memory, overwrites the oldest slot without waiting
+ * \param stream contains context necessary to execute the protocol
+ */
+static void _handle_shared_memory_latest_write_protocol(Data_Stream *stream)
+{
+    if (!_attach_shared_memory(stream))
+        return;
+
+    stream->frame_data = (char *)shared_memory_ring_claim_overwrite(&stream->ring);
+    stream->frame_length = 0;
+
+    _log_informative(stream->owner, "DEBUG: Shared memory slot of %s claimed for overwriting\n", stream->stream_name);
+    // event calling subscribed function
+    _call_on_ready(stream);
+
+    _publish_ring_frame(stream);
+    stream->frame_data = NULL;
+    stream->stats.frames++;
+}
+
+/**
+ * Latest value read protocol in shared memory, copies the newest frame into
+ * the stream's own buffer so the writer can keep overwriting while the user reads it
+ * \param stream contains context necessary to execute the protocol
+ */
+static void _handle_shared_memory_latest_read_protocol(Data_Stream *stream)
+{
+    if (!_attach_shared_memory(stream))
+        return;
+
+    // cheap check before copying, nothing new was published since last frame
+    if (shared_memory_ring_published_count(&stream->ring) == stream->sequence)
+    {
+        _check_shared_memory_segment(stream);
+        return;
+    }
+
+    uint32_t length;
+    uint64_t sequence;
+    Shared_Memory_Frame_Stamp stamp;
+    if (!shared_memory_ring_copy_latest(&stream->ring, (unsigned char *)stream->frame_buffer, &length, &sequence, &stamp))
+        return;
+
+    if (!_accept_latest_sequence(stream, sequence))
+        return;
+
+    stream->frame_data = stream->frame_buffer;
+    stream->frame_length = length;
+    stream->frame_offset = 0;
+    _take_ring_stamp(stream, &stamp);
+
+    _log_informative(stream->owner, "DEBUG: Shared memory frame of %s copied for reading\n", stream->stream_name);
+    // event calling subscribed function
+    _call_on_ready(stream);
+    stream->stats.frames++;
+
+    stream->frame_data = NULL;
+}
+
+/**
+ * Decides if a latest value frame is new and counts frames that were overwritten before we saw them.
+ * stream->sequence holds last delivered sequence + 1, 0 before the first frame.
+ * \return true if the frame should be delivered
+ */
+static bool _accept_latest_sequence(Data_Stream *stream, unsigned long long sequence)
+{
+    // the ring can hand us the frame we already delivered, a file frame only gets here with a new file identity
+    // so the same sequence again is a restarted writer
+    if (stream->transport == SHARED_MEMORY_TRANSPORT && stream->sequence != 0 && sequence + 1 == stream->sequence)
+        return false;
+
+    // first frame, or a file writer restarted and counts from 0 again, nothing was skipped by us
+    if (stream->sequence == 0 || sequence < stream->sequence)
+        stream->skipped_frames = 0;
+    else
+        stream->skipped_frames = sequence - stream->sequence;
+
+    stream->stats.skipped_frames += stream->skipped_frames;
+    stream->sequence = sequence + 1;
+    return true;
+}
+
+/**
+ * \return true if the stream provides data
+ */
+static bool _is_write_stream(const Data_Stream *stream)
+{
+    return stream->stream_type == WRITE_ONLY_STREAM || stream->stream_type == LATEST_VALUE_WRITE_STREAM;
+}
+
+/**
+ * Shared memory version of the write protocol:
+ * - mapping the ring if it is not mapped yet,
+ * - claiming a free slot, ring being full means reader did not catch up (same as missing ack),
+ * - letting the user format the frame straight into the slot,
+ * - publishing the slot to the reader
+ * \param stream contains context necessary to execute the protocol
+ */
+static void _handle_shared_memory_write_protocol(Data_Stream *stream)
+{
+    if (!_attach_shared_memory(stream))
+        return;
+
+    _record_ring_acks(stream);
+
+    // reader did not catch up, the wait watches for a released slot meanwhile
+    unsigned char *slot = shared_memory_ring_claim(&stream->ring);
+    __atomic_store_n(&stream->is_waiting_for_space, slot == NULL, __ATOMIC_RELEASE);
+    if (slot == NULL)
+        return;
+
+    stream->frame_data = (char *)slot;
+    stream->frame_length = 0;
+
+    _log_informative(stream->owner, "DEBUG: Shared memory slot of %s claimed for writing\n", stream->stream_name);
+    // event calling subscribed function
+    _call_on_ready(stream);
+
+    // only this thread reads slot_publish_ns back, so filling it in after the publish is fine
+    unsigned int slot_index = (unsigned int)(shared_memory_ring_published_count(&stream->ring) % stream->queue_depth);
+    _publish_ring_frame(stream);
+    stream->slot_publish_ns[slot_index] = stream->frame_publish_ns;
+    stream->frame_data = NULL;
+    stream->stats.frames++;
+}
+
+/**
+ * Shared memory version of the read protocol, consumes up to queue_depth frames waiting in the ring
+ * so a fast writer can't hold back the other streams:
+ * - mapping the ring if it is not mapped yet,
+ * - letting the user read the frame straight from the slot,
+ * - releasing the slot back to the writer
+ * \param stream contains context necessary to execute the protocol
+ */
+static void _handle_shared_memory_read_protocol(Data_Stream *stream)
+{
+    if (!_attach_shared_memory(stream))
+        return;
+
+    uint32_t length;
+    Shared_Memory_Frame_Stamp stamp;
+    const unsigned char *slot = shared_memory_ring_peek(&stream->ring, &length, &stamp);
+    // the old segment is only let go once everything in it was read
+    if (slot == NULL)
+        _check_shared_memory_segment(stream);
+
+    // stream can be removed by its own on_ready, the frames left are not delivered then
+    for (unsigned int frame = 0; slot != NULL && frame < stream->queue_depth && stream->is_active;
+         frame++, slot = shared_memory_ring_peek(&stream->ring, &length, &stamp))
+    {
+        stream->frame_data = (char *)slot;
+        stream->frame_length = length;
+        stream->frame_offset = 0;
+        _take_ring_stamp(stream, &stamp);
+
+        _log_informative(stream->owner, "DEBUG: Shared memory frame of %s opened for reading\n", stream->stream_name);
+        // event calling subscribed function
+        _call_on_ready(stream);
+        stream->stats.frames++;
+
+        shared_memory_ring_release(&stream->ring);
+    }
+    stream->frame_data = NULL;
+}
+
+/**
+ * Maps the shared memory ring of the stream if it is not mapped yet.
+ * The other process might still be creating it, in which case we try again next update.
+ * A segment with other geometry is left from an older run or made by a differently configured peer,
+ * the writer owns the name and replaces it, a reader reports it once and keeps retrying slowly.
+ * \return true if the ring is ready to be used
+ */
+static bool _attach_shared_memory(Data_Stream *stream)
+{
+    if (stream->is_ring_attached)
+        return true;
+
+    if (stream->has_ring_error && _monotonic_ns() < stream->ring_check_ns)
+        return false;
+
+    COUNT_SYSCALL(stream); // shm_open, ftruncate and mmap, only until attached
+    int result = shared_memory_ring_attach(&stream->ring, stream->stream_name, stream->queue_depth, (uint32_t)stream->frame_capacity);
+    if (result == SHARED_MEMORY_RING_ERROR)
+    {
+        if (!stream->has_ring_error)
+            _log_error("ERROR: Failed to map shared memory %s, both ends need the same frame capacity and queue depth. Retrying\n", stream->data_file_path);
+        stream->has_ring_error = true;
+        stream->ring_check_ns = _monotonic_ns() + SHARED_MEMORY_SEGMENT_CHECK_MS * 1000000LL;
+        if (_is_write_stream(stream))
+            shared_memory_ring_detach(&stream->ring, true);
+        return false;
+    }
+    if (result == SHARED_MEMORY_RING_NOT_READY)
+        return false;
+
+    stream->is_ring_attached = true;
+    stream->has_ring_error = false;
+    stream->ring_check_ns = _monotonic_ns() + SHARED_MEMORY_SEGMENT_CHECK_MS * 1000000LL;
+    stream->acked_sequence = shared_memory_ring_consumed_count(&stream->ring);
+    _log_informative(stream->owner, "DEBUG: Shared memory %s mapped\n", stream->data_file_path);
+    _start_wake_bridge(stream);
+    return true;
+}
+
+/**
+ * Idle readers look every SHARED_MEMORY_SEGMENT_CHECK_MS whether the segment they map is still the stream's.
+ * The writer unlinks it when it closes and a restarted writer creates a new one (or waits for us to create it),
+ * so the old mapping is dropped and the next update attaches to whatever is under the name now.
+ * \param stream attached shared memory reader with nothing left to read
+ */
+static void _check_shared_memory_segment(Data_Stream *stream)
+{
+    long long now_ns = _monotonic_ns();
+    if (now_ns < stream->ring_check_ns)
+        return;
+    stream->ring_check_ns = now_ns + SHARED_MEMORY_SEGMENT_CHECK_MS * 1000000LL;
+
+    COUNT_SYSCALL(stream); // shm_open and fstat
+    if (!shared_memory_ring_is_replaced(&stream->ring))
+        return;
+
+    _log_informative(stream->owner, "DEBUG: Shared memory %s was replaced by its writer, mapping it again\n", stream->data_file_path);
+    _detach_shared_memory(stream);
+}
+
+/**
+ * Unmaps the ring of a reader so the next update attaches again, the new segment counts frames from 0
+ */
+static void _detach_shared_memory(Data_Stream *stream)
+{
+    _stop_wake_bridge(stream);
+    shared_memory_ring_detach(&stream->ring, false);
+    stream->is_ring_attached = false;
+    stream->sequence = 0;
+}
+
+/**
+ * Waits until one of the streams might have work to do, the way the wait strategies of the streams ask for.
+ * Blocking waits sleep in poll on the inotify watch, the schedule timerfd and the eventfd of the wake bridges.
+ * Spinning waits poll the same descriptors without timeout and check shared memory in between.
+ * Falls back to plain timed sleep if none of the descriptors are available.
+ * \param timeout_ms longest time to wait, negative for no limit
+ * \return true if woken up by an event or a signal, false on timeout
+ */
+static bool _wait_for_stream_event(Fsc_Context *fsc, int timeout_ms)
+{
+    bool was_watching = fsc->event_watch_fd >= 0;
+    bool has_watch = _init_event_watch(fsc);
+    // files may have changed between the last update and the watch being set up, look at them once more
+    if (has_watch && !was_watching)
+        return true;
+
+    long long now_ns = _monotonic_ns();
+    long long deadline_ns = timeout_ms >= 0 ? now_ns + timeout_ms * 1000000LL : -1;
+
+    enum Wait_strategy strategy = WAIT_BLOCKING;
+    long long wake_up_ns = -1;  // end of a timed sleep or a due time, counts as a wake up without any event
+    int slice_ms = -1;
+    bool has_file_streams = false;
+    bool has_wake_bridges = false;
+
+    Data_Stream *current = fsc->head_data_stream;
+    while (current != NULL)
+    {
+        if (current->is_active)
+        {
+            if (current->wait_strategy == WAIT_TIMED_SLEEP)
+            {
+                long long check_ns = now_ns + current->wait_interval_ms * 1000000LL;
+                if (wake_up_ns < 0 || check_ns < wake_up_ns)
+                    wake_up_ns = check_ns;
+            }
+            else if (current->wait_strategy > strategy)
+                strategy = current->wait_strategy;
+
+            if (current->transport == FILE_SYSTEM_TRANSPORT && current->wait_strategy != WAIT_TIMED_SLEEP)
+                has_file_streams = true;
+
+            // a ring can only be mapped by update_streams, it tries again every slice until the other side created it,
+            // mapped readers wake up now and then to see whether their writer replaced the segment
+            if (current->transport == SHARED_MEMORY_TRANSPORT && (!current->is_ring_attached || !_is_write_stream(current)))
+            {
+                long long retry_ns = now_ns + SHARED_MEMORY_POLL_INTERVAL_MS * 1000000LL;
+                if (current->is_ring_attached || current->has_ring_error)
+                    retry_ns = current->ring_check_ns > retry_ns ? current->ring_check_ns : retry_ns;
+                if (wake_up_ns < 0 || retry_ns < wake_up_ns)
+                    wake_up_ns = retry_ns;
+            }
+
+            // latest value writers never wait for anything
+            if (__atomic_load_n(&current->has_wake_bridge, __ATOMIC_ACQUIRE))
+                has_wake_bridges = true;
+            else if (current->transport == SHARED_MEMORY_TRANSPORT && current->wait_strategy == WAIT_BLOCKING
+                && current->stream_type != LATEST_VALUE_WRITE_STREAM)
+                slice_ms = SHARED_MEMORY_POLL_INTERVAL_MS;
+        }
+        current = current->next;
+    }
+    bool is_spinning = strategy == WAIT_SPIN_THEN_YIELD || strategy == WAIT_BUSY_SPIN;
+
+    // wake up exactly when the next scheduled stream is due, spinning waits just look at the clock
+    long long due_ns = _next_future_due_ns(fsc, now_ns);
+    bool has_timer = !is_spinning && due_ns >= 0 && _arm_schedule_timer(fsc, due_ns);
+    if (due_ns >= 0 && !has_timer && (wake_up_ns < 0 || due_ns < wake_up_ns))
+        wake_up_ns = due_ns;
+
+    struct pollfd watch[3] = {
+        { has_watch && has_file_streams ? fsc->event_watch_fd : -1, POLLIN, 0 },
+        { has_timer ? fsc->schedule_timer_fd : -1, POLLIN, 0 },
+        { has_wake_bridges || fsc->update_worker_count > 0 ? fsc->wake_event_fd : -1, POLLIN, 0 }
+    };
+    bool has_descriptors = watch[0].fd >= 0 || watch[1].fd >= 0 || watch[2].fd >= 0;
+
+    for (unsigned int checks = 0;; checks++)
+    {
+        now_ns = _monotonic_ns();
+        if (_is_shared_memory_stream_ready(fsc, now_ns))
+            return true;
+        if (wake_up_ns >= 0 && now_ns >= wake_up_ns)
+            return true;
+        if (deadline_ns >= 0 && now_ns >= deadline_ns)
+            return false;
+
+        int wait_ms = 0;
+        if (!is_spinning)
+        {
+            long long until_ns = wake_up_ns;
+            if (deadline_ns >= 0 && (until_ns < 0 || deadline_ns < until_ns))
+                until_ns = deadline_ns;
+
+            // rounded up, waking early would only cost another round
+            wait_ms = until_ns >= 0 ? (int)((until_ns - now_ns + 999999) / 1000000) : -1;
+            if (slice_ms >= 0 && (wait_ms < 0 || wait_ms > slice_ms))
+                wait_ms = slice_ms;
+        }
+
+        int ready = 0;
+        if (has_descriptors || !is_spinning)
+            ready = poll(watch, 3, wait_ms);
+        if (ready < 0)
+        {
+            // give the caller a chance to look at whatever its signal handler set
+            if (errno == EINTR)
+                return true;
+            _log_error("ERROR: Waiting for stream events failed\n");
+            return false;
+        }
+
+        if (ready > 0)
+        {
+            uint64_t count;
+            if (watch[1].revents & POLLIN)
+            {
+                if (read(fsc->schedule_timer_fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+                    _log_error("ERROR: Failed to read schedule timer\n");
+                return true;
+            }
+            if (watch[2].revents & POLLIN)
+            {
+                if (read(fsc->wake_event_fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+                    _log_error("ERROR: Failed to read wake eventfd\n");
+                return true;
+            }
+            if ((watch[0].revents & POLLIN) && _drain_stream_events(fsc))
+                return true;
+        }
+        else if (is_spinning)
+        {
+            if (strategy == WAIT_BUSY_SPIN || checks < SPIN_CHECKS_BEFORE_YIELD)
+                _cpu_relax();
+            else
+                sched_yield();
+        }
+    }
+}
+
+/**
+ * Creates the inotify descriptor and watches directories of every file stream, only once
+ * \return true if events can be waited on
+ */
+static bool _init_event_watch(Fsc_Context *fsc)
+{
+#ifdef __linux__
+    if (fsc->event_watch_fd >= 0)
+        return true;
+
+    fsc->event_watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fsc->event_watch_fd < 0)
+    {
+        _log_error("ERROR: Failed to initialize inotify, falling back to timed waits\n");
+        return false;
+    }
+
+    Data_Stream *current = fsc->head_data_stream;
+    while (current != NULL)
+    {
+        _watch_stream_directory(current);
+        current = current->next;
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+/**
+ * Adds the directory holding the stream files to the inotify watch,
+ * watching the same directory twice is harmless
+ */
+static void _watch_stream_directory(Data_Stream *stream)
+{
+#ifdef __linux__
+    // timed sleepers are checked on their interval, events would only wake us for nothing
+    if (stream->transport != FILE_SYSTEM_TRANSPORT || stream->wait_strategy == WAIT_TIMED_SLEEP)
+        return;
+
+    Fsc_Context *fsc = stream->owner;
+    char directory[MAX_DATA_PATH_LENGTH];
+    snprintf(directory, sizeof(directory), "%s", stream->data_file_path);
+
+    char *last_slash = strrchr(directory, '/');
+    if (last_slash == NULL)
+        snprintf(directory, sizeof(directory), ".");
+    else if (last_slash == directory)
+        last_slash[1] = '\0'; // stream in root directory
+    else
+        *last_slash = '\0';
+
+    // flag and ack are toggled with ftruncate which shows up as IN_MODIFY
+    // and renamed frames are taken by their reader with IN_DELETE
+    if (inotify_add_watch(fsc->event_watch_fd, directory, IN_CREATE | IN_MODIFY | IN_MOVED_TO | IN_DELETE) < 0)
+        _log_error("ERROR: Failed to watch directory %s of stream %s\n", directory, stream->stream_name);
+#else
+    (void)stream;
+#endif
+}
+
+/**
+ * Reads all pending inotify events
+ * \return true if any of them was about a flag or ack file
+ */
+static bool _drain_stream_events(Fsc_Context *fsc)
+{
+    bool is_relevant = false;
+#ifdef __linux__
+    union
+    {
+        struct inotify_event event;
+        char bytes[4096];
+    } buffer;
+
+    ssize_t length;
+    while ((length = read(fsc->event_watch_fd, buffer.bytes, sizeof(buffer.bytes))) > 0)
+    {
+        char *position = buffer.bytes;
+        while (position < buffer.bytes + length)
+        {
+            struct inotify_event *event = (struct inotify_event *)position;
+            size_t name_length = event->len > 0 ? strlen(event->name) : 0;
+
+            // lost events, can't tell what happened so better check the streams
+            if (event->mask & IN_Q_OVERFLOW)
+                is_relevant = true;
+            // frame renamed into place or taken by the reader
+            else if (event->mask & (IN_MOVED_TO | IN_DELETE))
+                is_relevant = true;
+            else if (name_length >= STRLEN_LITERAL(FLAG_FILE_EXTENSION) && !strcmp(event->name + name_length - STRLEN_LITERAL(FLAG_FILE_EXTENSION), FLAG_FILE_EXTENSION))
+                is_relevant = true;
+            else if (name_length >= STRLEN_LITERAL(ACK_FILE_EXTENSION) && !strcmp(event->name + name_length - STRLEN_LITERAL(ACK_FILE_EXTENSION), ACK_FILE_EXTENSION))
+                is_relevant = true;
+
+            position += sizeof(struct inotify_event) + event->len;
+        }
+    }
+#endif
+    return is_relevant;
+}
+
+/**
+ * Checks whether any due shared memory stream has work. Streams on a worker are skipped, update_streams
+ * would skip them too, the worker wakes the wait once it hands them back
+ * \return true if update_streams would do something
+ */
+static bool _is_shared_memory_stream_ready(Fsc_Context *fsc, long long now_ns)
+{
+    Data_Stream *current = fsc->head_data_stream;
+    while (current != NULL)
+    {
+        // only this thread dispatches, a stream that is not on a worker stays off them while we look at it
+        if (!__atomic_load_n(&current->is_dispatched, __ATOMIC_SEQ_CST) && __atomic_load_n(&current->is_active, __ATOMIC_ACQUIRE)
+            && current->is_ring_attached && _has_shared_memory_work(current, current->sequence, now_ns))
+            return true;
+        current = current->next;
+    }
+    return false;
+}
+
+/**
+ * Checks one attached shared memory stream: a due reader has an unread frame, a blocked due writer a free slot
+ * \param sequence the stream's sequence, taken by whoever owns the stream right now
+ * \return true if updating the stream would do something
+ */
+static bool _has_shared_memory_work(Data_Stream *stream, unsigned long long sequence, long long now_ns)
+{
+    if (!_is_stream_due(stream, now_ns))
+        return false;
+
+    uint32_t length;
+    if (stream->stream_type == READ_ONLY_STREAM && shared_memory_ring_peek(&stream->ring, &length, NULL) != NULL)
+        return true;
+
+    if (stream->stream_type == LATEST_VALUE_READ_STREAM)
+    {
+        uint64_t published = shared_memory_ring_published_count(&stream->ring);
+        if (published != 0 && published != sequence)
+            return true;
+    }
 
-static void _send_line(Data_Stream *context, const char *fmt, ...);
-static char *_read_line(Data_Stream *context, char *line_buffer, int max_count);
-static Data_Stream * _allocate_new_data_stream(void);
-static void _populate_data_stream_with_defaults(Data_Stream *stream);
-static bool _is_stream_name_valid(const char *stream_name, enum Stream_type stream_type);
-static void _populate_stream_data(Data_Stream *stream, const char *stream_name, enum Stream_type stream_type, void (*on_ready)(Data_Stream *));
-static void _handle_write_protocol(Data_Stream *stream);
-static void _handle_read_protocol(Data_Stream *stream);
-static bool _is_data_ready(Data_Stream *stream);
-static bool _was_data_read(Data_Stream *stream);
-static int _open_data_read(Data_Stream *stream);
-static int _open_data_write(Data_Stream *stream);
-static void _close_data(Data_Stream *stream);
-static int _create_flag(Data_Stream *stream);
-static void _remove_flag(Data_Stream *stream);
-static int _create_ack(Data_Stream *stream);
-static void _remove_ack(Data_Stream *stream);
-static int _create_file(const char *file_path);
-static bool _file_exists(const char *file_path);
-void _log_informative(const char *fmt, ...);
-void _log_error(const char *fmt, ...);
+    return stream->stream_type == WRITE_ONLY_STREAM && __atomic_load_n(&stream->is_waiting_for_space, __ATOMIC_ACQUIRE)
+        && shared_memory_ring_has_space(&stream->ring);
+}
 
 /**
- * Enables or disables logging within the File System Communication framework
- * \param enabled true to enable logging, false to disable
+ * Ends the poll of wait_and_update_streams through the context's eventfd
  */
-void set_file_system_com_framework_logging(bool enabled)
+static void _wake_stream_wait(Fsc_Context *fsc)
 {
-    logging_enabled = enabled;
+    uint64_t one = 1;
+    if (fsc->wake_event_fd >= 0 && write(fsc->wake_event_fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+        _log_error("ERROR: Failed to signal wake eventfd\n");
 }
 
 /**
- * Will safely close all data streams and return memory
- * \return 0 on success
+ * Calls on_ready and records how long it ran and, for readers, how long the frame took from its writer
+ * and from the origin of its trace. Writers get their frame trace before, readers hand theirs to the context.
+ * For the first callback after a wake up it also records how long the wake up took to reach it
  */
-int close_data_streams()
+static void _call_on_ready(Data_Stream *stream)
 {
-    // free all linked list nodes
-    Data_Stream *current = head_data_stream;
-    while (current != NULL) {
-        Data_Stream *next = current->next;
-        free(current);
-        current = next;
+    long long start_ns = _monotonic_ns();
+    unsigned long long started_trace_id = 0;
+
+    long long wake_ns = __atomic_load_n(&stream->owner->last_wake_ns, __ATOMIC_ACQUIRE);
+    if (wake_ns > stream->handled_wake_ns)
+    {
+        unsigned long long latency = (unsigned long long)(start_ns - wake_ns);
+        stream->handled_wake_ns = wake_ns;
+        stream->stats.wakes++;
+        stream->stats.wake_latency_ns += latency;
+        if (latency > stream->stats.max_wake_latency_ns)
+            stream->stats.max_wake_latency_ns = latency;
     }
 
-    head_data_stream = NULL;
-    return 0;
+    // protocols of readers fill in the publish time and trace from the frame
+    if (_is_write_stream(stream))
+        started_trace_id = _inherit_frame_trace(stream, start_ns);
+    else
+    {
+        if (stream->frame_publish_ns > 0)
+            _record_latency(stream, PUBLISH_TO_CONSUME_LATENCY, start_ns - stream->frame_publish_ns);
+        if (stream->frame_trace.trace_id != 0)
+        {
+            _record_latency(stream, ORIGIN_TO_CONSUME_LATENCY, start_ns - stream->frame_trace.origin_ns);
+            _take_frame_trace(stream);
+        }
+    }
+
+    stream->on_ready(stream);
+
+    long long end_ns = _monotonic_ns();
+    _record_latency(stream, CALLBACK_DURATION, end_ns - start_ns);
+
+    if (stream->owner->trace_fd >= 0)
+        _write_trace_events(stream, start_ns, end_ns, started_trace_id != 0 && stream->frame_trace.trace_id == started_trace_id);
 }
 
 /**
- * Creates new data stream with specified name
- * and will invoke on_ready every time new frame can be sent
- * \param stream_name max size 80, determines names of the files used in the protocol
- * \param stream_type READ_ONLY_STREAM or WRITE_ONLY_STREAM wether you want to provide or receive data
- * \param on_ready fuction that will be called everytime data is ready to be written to or read from
- * \return non zero if it fails
+ * Adds one sample to a latency histogram of the stream, allocating them with the first sample
  */
-int create_new_data_stream(const char *stream_name, enum Stream_type stream_type, void (*on_ready)(Data_Stream *))
+static void _record_latency(Data_Stream *stream, enum Stream_latency latency, long long value_ns)
 {
-    if (!_is_stream_name_valid(stream_name, stream_type))
+    if (stream->latency_histograms == NULL)
     {
-        return 1;
+        stream->latency_histograms = calloc(STREAM_LATENCY_COUNT, sizeof(Latency_Histogram));
+        if (stream->latency_histograms == NULL)
+            return;
     }
 
-    Data_Stream *new_data_stream = _allocate_new_data_stream();
-    if (!new_data_stream)
-    {
-        _log_error("ERROR: Failed to create new data stream\n");
-        return 1; // TODO: log that stream failed to initialized
-    }
+    latency_histogram_record(&stream->latency_histograms[latency], value_ns > 0 ? (uint64_t)value_ns : 0);
+}
 
-    _populate_stream_data(new_data_stream, stream_name, stream_type, on_ready);
-    
-    _log_informative("INFO: Created new data stream with name %s\n", stream_name);
-    return 0;
+/**
+ * File writers, the frame in the slot was taken by the reader, closes its ack round trip
+ */
+static void _record_slot_ack(Data_Stream *stream, unsigned int slot)
+{
+    if (stream->slot_publish_ns[slot] == 0)
+        return; // slot was never written by us, e.g. left over from a previous run
+
+    _record_latency(stream, ACK_ROUND_TRIP_LATENCY, _monotonic_ns() - stream->slot_publish_ns[slot]);
+    stream->slot_publish_ns[slot] = 0;
 }
 
 /**
- * Calls the appropriate protocol for each data stream if they are active once
- * Place in a loop to call continuously
+ * Shared memory writers, closes the ack round trip of every frame the reader released since last time
  */
-void update_streams()
+static void _record_ring_acks(Data_Stream *stream)
 {
-    if (!head_data_stream)
-    {
-        _log_error("ERROR: Data streams not initialized or null\n");
+    uint64_t consumed = shared_memory_ring_consumed_count(&stream->ring);
+    if (consumed == stream->acked_sequence)
         return;
+
+    long long now_ns = _monotonic_ns();
+    for (; stream->acked_sequence < consumed; stream->acked_sequence++)
+    {
+        long long *publish_ns = &stream->slot_publish_ns[stream->acked_sequence % stream->queue_depth];
+        if (*publish_ns != 0)
+            _record_latency(stream, ACK_ROUND_TRIP_LATENCY, now_ns - *publish_ns);
+        *publish_ns = 0;
     }
+}
 
-    _log_informative("INFO: Calling each data stream\n");
+/**
+ * Writers, gives the frame about to be built the trace of the latest traced frame the context took,
+ * or starts a new trace at start_ns when the context took none
+ * \return id of the started trace, 0 if an existing one is continued
+ */
+static unsigned long long _inherit_frame_trace(Data_Stream *stream, long long start_ns)
+{
+    Fsc_Context *fsc = stream->owner;
 
-    // linked list version
-    Data_Stream *current = head_data_stream;
-    while (current != NULL) {
-        // Skip inactive or un configured streams
-        if (current->is_active && current->on_ready != NULL) {
-            if (current->stream_type == WRITE_ONLY_STREAM) {
-                _handle_write_protocol(current);
-            } else if (current->stream_type == READ_ONLY_STREAM) {
-                _handle_read_protocol(current);
-            }
-        }
-        current = current->next;
-    }
+    pthread_mutex_lock(&fsc->trace_lock);
+    stream->frame_trace = fsc->input_trace;
+    pthread_mutex_unlock(&fsc->trace_lock);
+
+    if (stream->frame_trace.trace_id != 0)
+        return 0;
+
+    // pid in the upper half keeps the ids of the processes sharing a trace file apart
+    unsigned long long count = __atomic_add_fetch(&started_trace_count, 1, __ATOMIC_RELAXED);
+    stream->frame_trace.trace_id = ((unsigned long long)getpid() << 32) | (count & 0xFFFFFFFFULL);
+    stream->frame_trace.origin_ns = start_ns;
+    return stream->frame_trace.trace_id;
 }
 
 /**
- * Function called by framework users to write data to file system. Behaves same as fprintf.
- * \param context contains all the function calls and provides necessary context for the function to be executed on the right files
- * \param fmt format string
- * \param ... parameters specified in format string
+ * Readers, makes the trace of the frame being read the one writers of the context continue
  */
-static void _send_line(Data_Stream *context, const char *fmt, ...)
+static void _take_frame_trace(Data_Stream *stream)
 {
-    va_list args;
-    va_start(args, fmt);
+    Fsc_Context *fsc = stream->owner;
 
-    vfprintf(context->data_file_ptr, fmt, args);
+    pthread_mutex_lock(&fsc->trace_lock);
+    fsc->input_trace = stream->frame_trace;
+    pthread_mutex_unlock(&fsc->trace_lock);
+}
 
-    va_end(args);
+/**
+ * Takes the publish time of a finished shared memory frame and publishes it with the frame's trace
+ */
+static void _publish_ring_frame(Data_Stream *stream)
+{
+    stream->frame_publish_ns = _monotonic_ns();
+
+    Shared_Memory_Frame_Stamp stamp = { (uint64_t)stream->frame_publish_ns, stream->frame_trace.trace_id, (uint64_t)stream->frame_trace.origin_ns };
+    shared_memory_ring_publish(&stream->ring, (uint32_t)stream->frame_length, &stamp);
 }
 
 /**
- * Function called by framework users to read data from file system. Behaves same as fgets. writes data to buffer
- * until buffer size is reached or until EOF is reached
- * \param context contains all the function calls and provides necessary context for the function to be executed on the right files
- * \param line_buffer string to which data will be written
- * \param max_count size of the buffer
- * \return returns null of EOF was reached
+ * Fills in publish time and trace of a shared memory frame being read
  */
-static char *_read_line(Data_Stream *context, char *line_buffer, int max_count)
+static void _take_ring_stamp(Data_Stream *stream, const Shared_Memory_Frame_Stamp *stamp)
 {
-    return fgets(line_buffer, max_count, context->data_file_ptr);
+    stream->frame_publish_ns = (long long)stamp->publish_ns;
+    stream->frame_trace.trace_id = stamp->trace_id;
+    stream->frame_trace.origin_ns = (long long)stamp->origin_ns;
 }
 
 /**
- * Creates a new data stream and adds it to the linked list
- * \return pointer to newly created data stream or NULL on failure
+ * Opens the trace file for appending. A missing file is created with the opening bracket of the array,
+ * under a temporary name linked into place so a process racing us can never append before the bracket
+ * \return descriptor, -1 on failure
  */
-static Data_Stream * _allocate_new_data_stream(void)
+static int _open_trace_file(const char *trace_path)
 {
-    Data_Stream *tmp = malloc(sizeof(Data_Stream));
-    if (!tmp)
-    {
-        _log_error("ERROR: Failed to allocate memory for new data stream\n");
-        return NULL;
-    }
+    int fd = open(trace_path, O_WRONLY | O_APPEND | O_CLOEXEC);
+    if (fd >= 0 || errno != ENOENT)
+        return fd;
+
+    char temp_path[MAX_TRACE_PATH_LENGTH];
+    int length = snprintf(temp_path, sizeof(temp_path), "%s.%d%s", trace_path, (int)getpid(), TEMP_FILE_EXTENSION);
+    if (length < 0 || (size_t)length >= sizeof(temp_path))
+        return -1;
+
+    int temp_fd = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if (temp_fd < 0)
+        return -1;
+    bool is_written = write(temp_fd, "[\n", 2) == 2;
+    close(temp_fd);
+
+    // link fails if another process was first, we append to its file then
+    if (is_written && link(temp_path, trace_path) && errno != EEXIST)
+        _log_error("ERROR: Failed to create trace file %s\n", trace_path);
+    unlink(temp_path);
+
+    return open(trace_path, O_WRONLY | O_APPEND | O_CLOEXEC);
+}
+
+/**
+ * Appends the callback that just ran as a complete event and, for traced frames, a flow event binding
+ * it to the other callbacks of the trace. Both go out in one O_APPEND write so processes sharing the file
+ * never interleave their lines
+ * \param is_trace_start true if the frame being written started its trace, the flow arrow starts here
+ */
+static void _write_trace_events(Data_Stream *stream, long long start_ns, long long end_ns, bool is_trace_start)
+{
+    const Frame_Trace *trace = &stream->frame_trace;
+    char name[2 * MAX_NAME_LENGTH];
+    char event[MAX_TRACE_EVENT_LENGTH];
+    int pid = (int)getpid();
+    long tid = _thread_id();
+
+    _escape_json(stream->stream_name, name, sizeof(name));
+
+    long long duration_ns = end_ns - start_ns;
+    int length = snprintf(event, sizeof(event),
+                          "{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%lld.%03lld,\"dur\":%lld.%03lld,\"pid\":%d,\"tid\":%ld,"
+                          "\"args\":{\"frame\":%llu",
+                          name, _is_write_stream(stream) ? "write" : "read", start_ns / 1000, start_ns % 1000,
+                          duration_ns / 1000, duration_ns % 1000, pid, tid, stream->stats.frames);
 
-    if (head_data_stream == NULL)
+    if (trace->trace_id != 0)
     {
-        head_data_stream = tmp;
+        long long since_origin_ns = start_ns > trace->origin_ns ? start_ns - trace->origin_ns : 0;
+        // flow event has to lie inside the slice it binds to
+        long long flow_ns = start_ns + duration_ns / 2;
+        length += snprintf(event + length, sizeof(event) - (size_t)length,
+                           ",\"trace_id\":\"0x%llx\",\"since_origin_us\":%lld.%03lld}},\n"
+                           "{\"name\":\"frame\",\"cat\":\"trace\",\"ph\":\"%c\",\"bp\":\"e\",\"id\":\"0x%llx\",\"ts\":%lld.%03lld,\"pid\":%d,\"tid\":%ld},\n",
+                           trace->trace_id, since_origin_ns / 1000, since_origin_ns % 1000,
+                           is_trace_start ? 's' : 't', trace->trace_id, flow_ns / 1000, flow_ns % 1000, pid, tid);
     }
     else
+        length += snprintf(event + length, sizeof(event) - (size_t)length, "}},\n");
+
+    if (length < 0 || (size_t)length >= sizeof(event))
+        return;
+    // a lost event only leaves a gap in the trace
+    if (write(stream->owner->trace_fd, event, (size_t)length) != length)
+        _log_informative(stream->owner, "DEBUG: Trace event of %s was not written\n", stream->stream_name);
+}
+
+/**
+ * Copies text into a JSON string body, quotes and backslashes escaped, control characters dropped
+ * \param size size of escaped, twice the text length is always enough
+ */
+static void _escape_json(const char *text, char *escaped, size_t size)
+{
+    size_t length = 0;
+    for (; *text != '\0' && length + 2 < size; text++)
     {
-        Data_Stream *current = head_data_stream;
-        while (current->next != NULL)
-        {
-            current = current->next;
-        }
-        current->next = tmp;
+        if ((unsigned char)*text < 0x20)
+            continue;
+        if (*text == '"' || *text == '\\')
+            escaped[length++] = '\\';
+        escaped[length++] = *text;
     }
-    _populate_data_stream_with_defaults(tmp);
+    escaped[length] = '\0';
+}
 
-    return tmp;
+/**
+ * Id of the calling thread as trace viewers show it, the kernel's thread id on linux
+ */
+static long _thread_id(void)
+{
+#ifdef __linux__
+    return (long)syscall(SYS_gettid);
+#else
+    return (long)getpid();
+#endif
 }
 
 /**
- * Sets provided data stream with safe known default values
+ * Starts a file frame with its header, the stamp in it is filled in by _stamp_frame_header
  */
-static void _populate_data_stream_with_defaults(Data_Stream *stream)
+static void _begin_frame_header(Data_Stream *stream)
 {
-    stream->next = NULL;
-    stream->is_active = false;
-    stream->is_first_write = true;
-    stream->stream_type = READ_ONLY_STREAM;
-    stream->on_ready = NULL;
-    stream->data_file_ptr = NULL;
-    stream->stream_name[0] = '\0';
-    stream->flag_file_path[0] = '\0';
-    stream->data_file_path[0] = '\0';
-    stream->ack_file_path[0] = '\0';
-    stream->send_line = _send_line;
-    stream->read_line = _read_line;
+    stream->frame_length = 0;
+    stream->send_line(stream, FRAME_HEADER_FORMAT, stream->sequence, 0ULL, 0ULL, 0ULL);
 }
 
+/**
+ * Takes the publish time of a finished file frame and writes it with the frame's trace into the frame header in place
+ */
+static void _stamp_frame_header(Data_Stream *stream)
+{
+    stream->frame_publish_ns = _monotonic_ns();
+
+    char *end = stream->frame_buffer != NULL ? memchr(stream->frame_buffer, '\n', stream->frame_length) : NULL;
+    if (end == NULL || end - stream->frame_buffer < FRAME_HEADER_STAMP_LENGTH)
+        return; // header could not be written, frame goes out without time
 
+    char stamp[FRAME_HEADER_STAMP_LENGTH + 1];
+    snprintf(stamp, sizeof(stamp), FRAME_HEADER_STAMP_FORMAT, stream->frame_trace.trace_id,
+             (unsigned long long)stream->frame_trace.origin_ns, (unsigned long long)stream->frame_publish_ns);
+    memcpy(end - FRAME_HEADER_STAMP_LENGTH, stamp, FRAME_HEADER_STAMP_LENGTH);
+}
 
 /**
- * Makes sure the name is not over MAX_NAME_LENGTH
- * and that there is no other data stream of the same stream type with same name
- * \return true if name is valid otherwise false
+ * Reads the header line of a file frame, the user's read position starts right after it
+ * \param sequence receives the writer's sequence of the frame
+ * \return false if the frame has no header, the read position stays at the start of the frame then
  */
-static bool _is_stream_name_valid(const char *stream_name, enum Stream_type stream_type)
+static bool _read_frame_header(Data_Stream *stream, unsigned long long *sequence)
 {
-    // makes sure we don't overflow on the name
-    if (strlen(stream_name) >= MAX_NAME_LENGTH)
-    {
-        _log_error("ERROR: Stream name exceeds maximum length\n");
-        return false;
-    }
+    char header[MAX_FRAME_HEADER_LENGTH];
+    unsigned long long trace_id, origin_ns, publish_ns;
 
-    Data_Stream *current = head_data_stream;
-    while (current != NULL)
+    stream->frame_publish_ns = 0;
+    memset(&stream->frame_trace, 0, sizeof(stream->frame_trace));
+    if (stream->read_line(stream, header, sizeof(header)) == NULL
+        || sscanf(header, FRAME_HEADER_SCAN_FORMAT, sequence, &trace_id, &origin_ns, &publish_ns) != 4)
     {
-        // will return null if stream with same name is found in the list
-        if (current->is_active && current->stream_type == stream_type && !strcmp(current->stream_name, stream_name))
-        {
-            _log_error("ERROR: Stream with the same name and type already exists\n");
-            return false; // TODO: log that stream already exists
-        }
-        current = current->next;
+        stream->frame_offset = 0;
+        return false;
     }
 
+    stream->frame_publish_ns = (long long)publish_ns;
+    stream->frame_trace.trace_id = trace_id;
+    stream->frame_trace.origin_ns = (long long)origin_ns;
     return true;
 }
 
 /**
- * populate given data stream with provided data and activates it
+ * Adds CPU time of one wait to every stream that was waiting in it
  */
-static void _populate_stream_data(Data_Stream *stream, const char *stream_name, enum Stream_type stream_type, void (*on_ready)(Data_Stream *))
+static void _charge_wait_cpu(Fsc_Context *fsc, long long cpu_ns)
 {
-    // Assign the stream name, in a safe way to prevent buffer overflow
-    snprintf(stream->stream_name, sizeof(stream->stream_name), "%s", stream_name);
-
-    // generating the dat file name
-    snprintf(stream->data_file_path, sizeof(stream->data_file_path), "%s%s", stream_name, DATA_FILE_EXTENSION);
-
-    // generating the flag file name
-    snprintf(stream->flag_file_path, sizeof(stream->flag_file_path), "%s%s", stream_name, FLAG_FILE_EXTENSION);
-
-    // generating the ack file name
-    snprintf(stream->ack_file_path, sizeof(stream->ack_file_path), "%s%s", stream_name, ACK_FILE_EXTENSION);
+    if (cpu_ns <= 0)
+        return;
 
-    stream->on_ready = on_ready;
-    stream->stream_type = stream_type;
-    stream->is_active = true;
+    Data_Stream *current = fsc->head_data_stream;
+    while (current != NULL)
+    {
+        if (current->is_active)
+            current->stats.wait_cpu_ns += (unsigned long long)cpu_ns;
+        current = current->next;
+    }
 }
 
 /**
- * Handles reading of data by:
- * - checking for ack / unless its first write
- * - writing the data,
- * - deleting the ack,
- * - sending flag,
- * \param stream contains context necessary to execute the protocol
+ * Starts the thread that sleeps on the ring futex of a blocking shared memory stream and pokes the
+ * context's eventfd, so one poll covers files, timers and any number of rings
  */
-static void _handle_write_protocol(Data_Stream *stream)
+static void _start_wake_bridge(Data_Stream *stream)
 {
-
-    if (!_was_data_read(stream) && !stream->is_first_write)
+    if (stream->wait_strategy != WAIT_BLOCKING || stream->stream_type == LATEST_VALUE_WRITE_STREAM || stream->owner->wake_event_fd < 0)
         return;
 
-    if (_open_data_write(stream))
+    // taken here and not in the thread, an event between attaching and the thread running must still wake us
+    enum Shared_Memory_Ring_Event event = _is_write_stream(stream) ? SHARED_MEMORY_RING_SPACE : SHARED_MEMORY_RING_DATA;
+    stream->wake_bridge_events = shared_memory_ring_events(&stream->ring, event);
+
+    if (_start_thread(&stream->wake_bridge, _wake_bridge, stream))
     {
-        _log_error("ERROR: Failed to open data file %s for writing\n", stream->data_file_path);
+        _log_error("ERROR: Failed to start wake thread of %s, it will be polled instead\n", stream->stream_name);
         return;
     }
+    __atomic_store_n(&stream->has_wake_bridge, true, __ATOMIC_RELEASE);
+}
 
-    stream->is_first_write = false;
-
-    _log_informative("INFO: Data file %s opened for writing\n", stream->data_file_path);
-    // event calling subscribed function
-    stream->on_ready(stream);
+/**
+ * Stops and joins the wake bridge of the stream, if it has one
+ */
+static void _stop_wake_bridge(Data_Stream *stream)
+{
+    if (!stream->has_wake_bridge)
+        return;
 
-    _close_data(stream);
-    _remove_ack(stream);
-    _create_flag(stream);
+    __atomic_store_n(&stream->is_bridge_stopping, true, __ATOMIC_RELEASE);
+    // bumping the counter the thread waits on (a reader waits on the writer's data counter, a writer on the
+    // reader's space counter) gets it out of its futex wait, no frame or slot comes with it so any other waiter just waits again
+    shared_memory_ring_notify(&stream->ring, _is_write_stream(stream) ? SHARED_MEMORY_RING_SPACE : SHARED_MEMORY_RING_DATA);
+    pthread_join(stream->wake_bridge, NULL);
+    stream->has_wake_bridge = false;
+    stream->is_bridge_stopping = false;
 }
 
 /**
- * Handles reading of data by:
- * - checking for flag
- * - reading the data,
- * - deleting the flag,
- * - sending ack,
- * \param stream contains context necessary to execute the protocol
+ * Wake bridge thread, readers wait for published frames, writers for released slots
  */
-static void _handle_read_protocol(Data_Stream *stream)
+static void *_wake_bridge(void *argument)
 {
-    // Skip if flag data is not pressent
-    if (!_is_data_ready(stream))
-        return;
+    Data_Stream *stream = argument;
+    enum Shared_Memory_Ring_Event event = _is_write_stream(stream) ? SHARED_MEMORY_RING_SPACE : SHARED_MEMORY_RING_DATA;
+    uint32_t seen = stream->wake_bridge_events;
 
-    if (_open_data_read(stream))
+    while (!__atomic_load_n(&stream->is_bridge_stopping, __ATOMIC_ACQUIRE))
     {
-        _log_error("ERROR: Failed to open data file %s for reading\n", stream->data_file_path);
-        return;
+        shared_memory_ring_wait(&stream->ring, event, seen);
+
+        uint32_t events = shared_memory_ring_events(&stream->ring, event);
+        if (events == seen)
+            continue;
+        seen = events;
+
+        // the wait skips the stream while it is on a worker, the worker wakes it when it hands the stream back
+        if (__atomic_load_n(&stream->is_dispatched, __ATOMIC_SEQ_CST))
+            continue;
+        _wake_stream_wait(stream->owner);
     }
+    return NULL;
+}
 
-    _log_informative("INFO: Data file %s opened for reading\n", stream->data_file_path);
-    // event calling subscribed function
-    stream->on_ready(stream);
+/**
+ * Starts a framework thread with every signal blocked, so signals reach the thread
+ * of wait_and_update_streams and interrupt its wait
+ * \return 0 if the thread is running
+ */
+static int _start_thread(pthread_t *thread, void *(*routine)(void *), void *argument)
+{
+    sigset_t all_signals, previous;
+    sigfillset(&all_signals);
+    pthread_sigmask(SIG_SETMASK, &all_signals, &previous);
+
+    int result = pthread_create(thread, NULL, routine, argument);
 
-    // Properly close handle closing and rasing flags
-    _close_data(stream);
-    _remove_flag(stream);
-    _create_ack(stream);
+    pthread_sigmask(SIG_SETMASK, &previous, NULL);
+    return result;
 }
 
-/*
- * Checks for existence of filename.flag file
- * \param stream contains name of the flag file
- * \return true if the filename.flag exists, false otherwise.
+/**
+ * Nanoseconds of CPU time used by the calling thread
  */
-static bool _is_data_ready(Data_Stream *stream)
+static long long _thread_cpu_ns(void)
 {
-    return _file_exists(stream->flag_file_path);
+    struct timespec now;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return (long long)now.tv_sec * 1000000000LL + now.tv_nsec;
 }
 
-/*
- * Checks for existence of filename.ack file
- * \param stream contains name of the ack file
- * \return true if the filename.ack exists, false otherwise.
+/**
+ * Tells the core we are spinning, lets the sibling hyper thread run and saves power
  */
-static bool _was_data_read(Data_Stream *stream)
+static void _cpu_relax(void)
 {
-    return _file_exists(stream->ack_file_path);
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
 }
 
 /**
- * Opens the main data file in a write mode and stores the file pointer in stream's data_file_ptr
- * \return 0 if all goes well
+ * Nanoseconds of CLOCK_MONOTONIC, the clock stream schedules run on
  */
-static int _open_data_write(Data_Stream *stream)
+static long long _monotonic_ns(void)
 {
-    stream->data_file_ptr = fopen(stream->data_file_path, "w");
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000000000LL + now.tv_nsec;
+}
 
-    if (stream->data_file_ptr == NULL)
-        return 1;
-    return 0;
+/**
+ * \return true if the stream runs on every update or its next tick is due
+ */
+static bool _is_stream_due(Data_Stream *stream, long long now_ns)
+{
+    return stream->period_ns == 0 || now_ns >= __atomic_load_n(&stream->next_due_ns, __ATOMIC_ACQUIRE);
 }
 
 /**
- * Opens the main data file in a read mode and stores the file pointer in stream's data_file_ptr
- * \return 0 if all goes well
+ * Moves the schedule of the stream to its next tick. Ticks stay on multiples of the period from
+ * the first one so there is no drift, whole periods the stream fell behind are skipped and counted
+ * \param tick_ns time the tick started running
  */
-static int _open_data_read(Data_Stream *stream)
+static void _advance_stream_schedule(Data_Stream *stream, long long tick_ns)
 {
-    stream->data_file_ptr = fopen(stream->data_file_path, "r");
+    long long due_ns = stream->next_due_ns;
 
-    if (stream->data_file_ptr == NULL)
-        return 1;
-    return 0;
+    if (tick_ns - due_ns > stream->deadline_ns)
+        stream->stats.deadline_misses++;
+
+    due_ns += stream->period_ns;
+    if (due_ns <= tick_ns)
+    {
+        long long behind = (tick_ns - due_ns) / stream->period_ns + 1;
+        stream->stats.missed_ticks += (unsigned long long)behind;
+        due_ns += behind * stream->period_ns;
+    }
+
+    __atomic_store_n(&stream->next_due_ns, due_ns, __ATOMIC_RELEASE);
 }
 
 /**
- * Closes the main data file at sets it to NULL to prevent use after free
+ * Earliest due time of a rate scheduled stream that is still in the future. Streams that are already
+ * due but could not run (writer waiting for its reader) are woken by their file or shared memory events
+ * \return due time in CLOCK_MONOTONIC nanoseconds, -1 if there is none
  */
-static void _close_data(Data_Stream *stream)
+static long long _next_future_due_ns(Fsc_Context *fsc, long long now_ns)
 {
-    if (stream->data_file_ptr != NULL) {
-        fclose(stream->data_file_ptr);
-        stream->data_file_ptr = NULL;
+    long long earliest = -1;
+
+    Data_Stream *current = fsc->head_data_stream;
+    while (current != NULL)
+    {
+        if (current->is_active && current->period_ns > 0)
+        {
+            long long due_ns = __atomic_load_n(&current->next_due_ns, __ATOMIC_ACQUIRE);
+            // a worker is still running this tick, the schedule will move on by one period
+            if (due_ns <= now_ns && __atomic_load_n(&current->is_dispatched, __ATOMIC_ACQUIRE))
+                due_ns += current->period_ns;
+            if (due_ns > now_ns && (earliest < 0 || due_ns < earliest))
+                earliest = due_ns;
+        }
+        current = current->next;
     }
+    return earliest;
 }
 
 /**
- * Creates flag file
- * \return 0 if all goes well
+ * Arms the context's timerfd to expire at an absolute CLOCK_MONOTONIC time
+ * \return false if there is no timerfd, the caller has to fall back to a poll timeout
  */
-static int _create_flag(Data_Stream *stream)
+static bool _arm_schedule_timer(Fsc_Context *fsc, long long due_ns)
 {
-    return _create_file(stream->flag_file_path);
+#ifdef __linux__
+    if (fsc->schedule_timer_fd < 0)
+    {
+        fsc->schedule_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (fsc->schedule_timer_fd < 0)
+        {
+            _log_error("ERROR: Failed to create schedule timer, falling back to poll timeouts\n");
+            return false;
+        }
+    }
+
+    struct itimerspec expiry = { { 0, 0 }, { (time_t)(due_ns / 1000000000LL), (long)(due_ns % 1000000000LL) } };
+    if (timerfd_settime(fsc->schedule_timer_fd, TFD_TIMER_ABSTIME, &expiry, NULL))
+    {
+        _log_error("ERROR: Failed to arm schedule timer\n");
+        return false;
+    }
+    return true;
+#else
+    (void)fsc;
+    (void)due_ns;
+    return false;
+#endif
 }
 
 /**
- * Removes the flag file
+ * \return descriptors of the slot selected by the stream's sequence
  */
-static void _remove_flag(Data_Stream *stream)
+static Stream_Slot_Files *_current_slot(Data_Stream *stream)
 {
-    remove(stream->flag_file_path);
+    return &stream->slot_files[stream->sequence % stream->queue_depth];
 }
 
-/**
- * Creates ack file
- * \return 0 if all goes well
+/*
+ * Checks whether the writer toggled the flag since we last acked it
+ * \param stream contains descriptor of the flag file
+ * \return true if a new frame is waiting in the slot, false otherwise.
+ */
+static bool _is_data_ready(Data_Stream *stream, Stream_Slot_Files *slot)
+{
+    return _read_signal(stream, slot->flag_fd) != slot->signal;
+}
+
+/*
+ * Checks whether the reader toggled the ack to match our flag
+ * \param stream contains descriptor of the ack file
+ * \return true if the last frame of the slot was read, false otherwise.
  */
-static int _create_ack(Data_Stream *stream)
+static bool _was_data_read(Data_Stream *stream, Stream_Slot_Files *slot)
 {
-    return _create_file(stream->ack_file_path);
+    return _read_signal(stream, slot->ack_fd) == slot->signal;
 }
 
 /**
- * Removes ack file
+ * Reads handshake signal of a flag or ack file, a single fstat
+ * \return true if the file is not empty
  */
-static void _remove_ack(Data_Stream *stream)
+static bool _read_signal(Data_Stream *stream, int fd)
 {
-    remove(stream->ack_file_path);
+    struct stat info;
+    COUNT_SYSCALL(stream);
+    if (fstat(fd, &info))
+    {
+        _log_error("ERROR: Failed to check signal file of stream %s\n", stream->stream_name);
+        return false;
+    }
+    return info.st_size != 0;
 }
 
 /**
- * Creates file and closes it
+ * Sets handshake signal of a flag or ack file by resizing it, a single ftruncate
  * \return 0 if all goes well
  */
-static int _create_file(const char *file_path)
+static int _write_signal(Data_Stream *stream, int fd, bool signal)
 {
-    FILE *temp = fopen(file_path, "w");
-
-    if (temp == NULL)
+    COUNT_SYSCALL(stream);
+    if (ftruncate(fd, signal ? 1 : 0))
     {
-        _log_error("ERROR: Failed to create file %s\n", file_path);
+        _log_error("ERROR: Failed to signal stream %s\n", stream->stream_name);
         return 1;
     }
-
-    fclose(temp);
     return 0;
 }
 
-/*
- * _file_exists function Checks if a file exists.
- * \param filename is the name of the file to check.
- * \return true if the file exists, false otherwise.
+/**
+ * Writes the frame built in frame_buffer to the start of the file, one pwrite unless it gets interrupted
+ * \return 0 if all goes well
  */
-static bool _file_exists(const char *file_path)
+static int _write_frame_file(Data_Stream *stream, int fd)
 {
-    FILE *file = fopen(file_path, "r");
-    if (file)
+    size_t written = 0;
+    while (written < stream->frame_length)
     {
-        fclose(file);
-        return true;
+        COUNT_SYSCALL(stream);
+        ssize_t count = pwrite(fd, stream->frame_buffer + written, stream->frame_length - written, (off_t)written);
+        if (count < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return 1;
+        }
+        written += (size_t)count;
     }
-    return false;
+    return 0;
 }
 
 /**
- * Informative logging function, ignores if logging is disabled
+ * Reads the whole file into frame_buffer and points frame_data at it, usually one pread
+ * \return 0 if all goes well
  */
-void _log_informative(const char *fmt, ...)
+static int _read_frame_file(Data_Stream *stream, int fd)
 {
-    if (logging_enabled)
+    size_t length = 0;
+    while (true)
     {
-        va_list args;
-        va_start(args, fmt);
+        if (length == stream->frame_buffer_size && _grow_frame_buffer(stream, length * 2))
+            return 1;
+
+        COUNT_SYSCALL(stream);
+        ssize_t count = pread(fd, stream->frame_buffer + length, stream->frame_buffer_size - length, (off_t)length);
+        if (count < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return 1;
+        }
 
-        vfprintf(stdout, fmt, args);
+        length += (size_t)count;
+        // short read of a regular file means end of file
+        if (length < stream->frame_buffer_size)
+            break;
+    }
 
-        va_end(args);
+    stream->frame_data = stream->frame_buffer;
+    stream->frame_length = length;
+    stream->frame_offset = 0;
+    return 0;
+}
+
+/**
+ * Makes frame_buffer at least minimum_size bytes (and at least FRAME_BUFFER_INITIAL_SIZE)
+ * \return 0 if all goes well
+ */
+static int _grow_frame_buffer(Data_Stream *stream, size_t minimum_size)
+{
+    if (minimum_size < FRAME_BUFFER_INITIAL_SIZE)
+        minimum_size = FRAME_BUFFER_INITIAL_SIZE;
+    if (stream->frame_buffer_size >= minimum_size)
+        return 0;
+
+    char *buffer = realloc(stream->frame_buffer, minimum_size);
+    if (buffer == NULL)
+    {
+        _log_error("ERROR: Failed to allocate frame buffer of stream %s\n", stream->stream_name);
+        return 1;
     }
+
+    stream->frame_buffer = buffer;
+    stream->frame_buffer_size = minimum_size;
+    return 0;
 }
 
+#if LOG_COMPILE_LEVEL <= LOG_LEVEL_ERROR
 /**
- * Error logging function
+ * Prints one line of framework logging, called through _log_informative and _log_error
  */
-void _log_error(const char *fmt, ...)
+static void _log_line(FILE *output, const char *fmt, ...)
 {
 
     va_list args;
     va_start(args, fmt);
 
-    vfprintf(stderr, fmt, args);
+    vfprintf(output, fmt, args);
 
     va_end(args);
-}
\ No newline at end of file
+}
+#endif
\ No newline at end of file
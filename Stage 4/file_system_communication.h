@@ -10,7 +10,13 @@
 #define FILE_SYS_COM_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdio.h>
+#include <pthread.h>
+#include "shared_memory_ring.h"
+#include "message_schema.h"
+#include "latency_histogram.h"
+#include "log_levels.h"
 
 #define MAX_NAME_LENGTH 80
 
@@ -18,26 +24,207 @@
 #define DATA_FILE_EXTENSION ".txt"
 #define FLAG_FILE_EXTENSION ".flag"
 #define ACK_FILE_EXTENSION ".ack"
+#define TEMP_FILE_EXTENSION ".tmp"
+
+// First line of every frame on the file system, stripped before on_ready is called: sequence, then the stamp of
+// trace id, origin time and CLOCK_MONOTONIC publish time. The stamp has fixed width so it can be filled in once the frame is built
+#define FRAME_HEADER_STAMP_FORMAT "%020llu %020llu %020llu"
+#define FRAME_HEADER_STAMP_LENGTH 62
+#define FRAME_HEADER_FORMAT "#frame %llu " FRAME_HEADER_STAMP_FORMAT "\n"
+#define FRAME_HEADER_SCAN_FORMAT "#frame %llu %llu %llu %llu"
+#define MAX_FRAME_HEADER_LENGTH 128
 
 #define STRLEN_LITERAL(x) (sizeof(x) - 1)
 
+// longest data path, shared memory streams show their /dev/shm path
+#define MAX_DATA_PATH_LENGTH (MAX_NAME_LENGTH + STRLEN_LITERAL(SHARED_MEMORY_RING_DIRECTORY) + STRLEN_LITERAL(SHARED_MEMORY_RING_PREFIX))
+
+// Shared memory transport defaults
+#define SHARED_MEMORY_DEFAULT_FRAME_CAPACITY 4096
+#define SHARED_MEMORY_DEFAULT_SLOT_COUNT 8
+
+// Queue depth limit, file streams deeper than 1 use numbered files <name>.<slot>.txt
+#define MAX_QUEUE_DEPTH 256
+#define MAX_SLOT_SUFFIX_LENGTH STRLEN_LITERAL(".255")
+
+// how often WAIT_TIMED_SLEEP streams are checked when the options leave it at 0
+#define DEFAULT_WAIT_INTERVAL_MS 100
+
+/**
+ * Descriptors of one queue slot of a file stream, open for the whole life of the stream.
+ * Flag and ack files signal by their size (0 or 1) instead of existing or not, every frame toggles
+ * the writer's flag and the reader's ack, a frame is waiting while the two differ.
+ */
+typedef struct Stream_Slot_Files
+{
+    int data_fd;
+    int flag_fd;
+    int ack_fd;
+    bool signal;                // our own side of the handshake, writer: flag size, reader: ack size
+    size_t last_frame_length;   // writer only, data file is truncated only when a frame gets shorter
+} Stream_Slot_Files;
+
+/**
+ * What a latest value file looked like when it was last read, a rename gives new identity
+ */
+typedef struct Stream_File_Identity
+{
+    unsigned long long inode;
+    unsigned long long size;
+    long long modified_ns;
+} Stream_File_Identity;
+
+/**
+ * Counters of a stream, syscalls / frames is the cost of one frame
+ */
+typedef struct Data_Stream_Stats
+{
+    unsigned long long frames;          // frames written or delivered
+    unsigned long long skipped_frames;  // latest value readers, frames overwritten before they were read
+    unsigned long long syscalls;        // file system calls made by the protocol, including idle checks
+    unsigned long long deadline_misses; // rate scheduled streams, ticks that ran later than deadline after they were due
+    unsigned long long missed_ticks;    // rate scheduled streams, whole periods skipped because the stream fell behind
+    unsigned long long wait_cpu_ns;     // CPU time wait_and_update_streams burned while this stream was waiting, shared waits count for every stream
+    unsigned long long wakes;           // callbacks that followed a wake up of wait_and_update_streams
+    unsigned long long wake_latency_ns; // sum over those callbacks of the time from the wake up to on_ready, divide by wakes
+    unsigned long long max_wake_latency_ns;
+} Data_Stream_Stats;
+
 enum Stream_type
 {
     READ_ONLY_STREAM,
-    WRITE_ONLY_STREAM
+    WRITE_ONLY_STREAM,
+    LATEST_VALUE_READ_STREAM,   // only the newest frame is delivered, skipped_frames tells how many were missed
+    LATEST_VALUE_WRITE_STREAM   // writer never waits for the reader and overwrites the previous frame
+};
+
+/**
+ * How frames of a stream are moved between processes, both ends of a stream have to use the same transport
+ */
+enum Stream_transport
+{
+    FILE_SYSTEM_TRANSPORT,      // <name>.txt with .flag/.ack files in the working directory
+    SHARED_MEMORY_TRANSPORT     // single producer/single consumer ring in /dev/shm, no syscalls per frame
+};
+
+/**
+ * How a file system writer hands a finished frame to the reader of a READ_ONLY/WRITE_ONLY stream,
+ * both ends of a stream have to use the same publication
+ */
+enum Frame_publication
+{
+    SIGNAL_FILE_PUBLICATION,    // data file rewritten in place, readiness toggled through .flag/.ack files
+    RENAME_PUBLICATION          // frame built in <name>.tmp and renamed to <name>.txt, reader removes it once read
+};
+
+/**
+ * Latencies every stream keeps a histogram of, see get_stream_latency_percentile
+ */
+enum Stream_latency
+{
+    PUBLISH_TO_CONSUME_LATENCY, // readers, from the writer publishing the frame to on_ready being called
+    CALLBACK_DURATION,          // every stream, time spent in on_ready
+    ACK_ROUND_TRIP_LATENCY,     // WRITE_ONLY streams, from publishing a frame until the writer sees the reader took it
+    ORIGIN_TO_CONSUME_LATENCY,  // readers of traced frames, from the first frame of the trace to on_ready, end to end over every hop
+    STREAM_LATENCY_COUNT
 };
 
+/**
+ * Follows a frame across streams and processes. A writer starts a trace with its frame unless its context
+ * took a traced frame before, then the frame continues the trace of the latest one taken
+ */
+typedef struct Frame_Trace
+{
+    unsigned long long trace_id;    // same for every frame caused by the first one, 0 if the frame is not traced
+    long long origin_ns;            // CLOCK_MONOTONIC time the first frame of the trace was produced
+} Frame_Trace;
+
+/**
+ * How wait_and_update_streams waits for the stream, trading CPU for latency.
+ * The most eager strategy among the streams of a context decides how its thread waits
+ */
+enum Wait_strategy
+{
+    WAIT_BLOCKING,          // sleep in the kernel until inotify, a shared memory futex or the schedule timer wakes us
+    WAIT_TIMED_SLEEP,       // no events, checked every wait_interval_ms, cheapest when latency does not matter
+    WAIT_SPIN_THEN_YIELD,   // checked in a loop that gives the core away with sched_yield after a short spin
+    WAIT_BUSY_SPIN          // checked in a tight loop, keeps one core at 100% for the lowest latency
+};
+
+/**
+ * Per stream settings chosen at creation, get defaults from default_data_stream_options()
+ */
+typedef struct Data_Stream_Options
+{
+    enum Stream_transport transport;
+    size_t frame_capacity;  // maximum bytes per frame, shared memory transport only
+    unsigned int queue_depth; // frames the writer can be ahead of the reader, 0 for transport default
+    enum Frame_publication publication; // file system transport only
+    double rate_hz;         // ticks per second on an absolute CLOCK_MONOTONIC schedule, 0 to run on every update
+    double deadline_ms;     // how late a tick may run before it counts as missed, 0 for one period
+    enum Wait_strategy wait_strategy;
+    unsigned int wait_interval_ms; // WAIT_TIMED_SLEEP only, 0 for DEFAULT_WAIT_INTERVAL_MS
+} Data_Stream_Options;
+
+/**
+ * Owns a set of streams and everything needed to update them, see fsc_context_create
+ */
+typedef struct Fsc_Context Fsc_Context;
+
 typedef struct Data_Stream
 {
     struct Data_Stream * next;
+    Fsc_Context *owner;         // context the stream was created in
+    struct Data_Stream * previous;
+    struct Data_Stream * next_in_bucket; // chain of the stream registry hash bucket
+    unsigned int key_hash;      // hash of stream name and type
+    bool is_removed;            // removed during update_streams, freed once the update finishes
+    bool is_dispatched;         // worker mode, protocol queued or running on a worker, skipped by update_streams meanwhile
+    struct Data_Stream * next_task; // worker mode, queue of streams waiting for a worker
     bool is_active;
-    bool is_first_write;
+    bool is_first_write;        // true until every slot of the queue was written once
     enum Stream_type stream_type;
+    enum Stream_transport transport;
+    enum Frame_publication publication;
+    unsigned int queue_depth;
+    unsigned long long sequence; // next frame to be written or read
+    long long period_ns;        // rate scheduled streams, 0 when the stream runs on every update
+    long long deadline_ns;
+    long long next_due_ns;      // CLOCK_MONOTONIC time the next tick is due
+    enum Wait_strategy wait_strategy;
+    unsigned int wait_interval_ms;
+    long long handled_wake_ns;  // last wake up of the context already counted in stats.wakes
+    bool is_waiting_for_space;  // shared memory writers, ring was full on the last update
+    pthread_t wake_bridge;      // blocking shared memory streams, turns futex wake ups into an eventfd the context polls
+    unsigned int wake_bridge_events; // ring event count the wake bridge started from
+    bool has_wake_bridge;
+    bool is_bridge_stopping;
+    Latency_Histogram *latency_histograms; // STREAM_LATENCY_COUNT histograms, allocated with the first sample
+    long long frame_publish_ns; // publish time of the frame being read or written, 0 if unknown
+    Frame_Trace frame_trace;    // trace of the frame being read or written, writers may change it in on_ready
+    long long *slot_publish_ns; // WRITE_ONLY streams, publish time of the frame in each queue slot until its ack
+    unsigned long long acked_sequence; // shared memory writers, frames before this had their ack round trip recorded
+    unsigned long long skipped_frames;       // latest value readers, frames overwritten before the current one was read
+    Data_Stream_Stats stats;
     char stream_name[MAX_NAME_LENGTH];
-    char data_file_path[MAX_NAME_LENGTH + STRLEN_LITERAL(DATA_FILE_EXTENSION)]; // stream name + .txt
-    char flag_file_path[MAX_NAME_LENGTH + STRLEN_LITERAL(FLAG_FILE_EXTENSION)]; // stream name + .flag
-    char ack_file_path[MAX_NAME_LENGTH + STRLEN_LITERAL(ACK_FILE_EXTENSION)];   // stream name + .ack
-    FILE *data_file_ptr;
+    char data_file_path[MAX_DATA_PATH_LENGTH]; // stream name (+ .slot) + .txt or /dev/shm/fsc_ + stream name
+    char flag_file_path[MAX_NAME_LENGTH + MAX_SLOT_SUFFIX_LENGTH + STRLEN_LITERAL(FLAG_FILE_EXTENSION)]; // stream name (+ .slot) + .flag
+    char ack_file_path[MAX_NAME_LENGTH + MAX_SLOT_SUFFIX_LENGTH + STRLEN_LITERAL(ACK_FILE_EXTENSION)];   // stream name (+ .slot) + .ack
+    Stream_Slot_Files *slot_files; // queue_depth slots of file streams using the flag/ack handshake
+    Stream_File_Identity published_file; // latest value file readers
+    Shared_Memory_Ring ring;    // shared memory transport, mapped lazily by update_streams
+    bool is_ring_attached;
+    bool has_ring_error;        // segment under the stream's name has other geometry, reported once and retried slowly
+    long long ring_check_ns;    // shared memory readers, next time the segment is checked for being replaced
+    /**
+     * Frame currently being written or read, file streams build and read their frames in frame_buffer
+     */
+    char *frame_data;
+    size_t frame_length;
+    size_t frame_capacity;
+    size_t frame_offset;        // read position within the frame
+    char *frame_buffer;         // memory owned by the stream that frame_data can point to, grows but is never shrunk
+    size_t frame_buffer_size;
     /**
      * Event subscription 
      */
@@ -58,12 +245,55 @@ typedef struct Data_Stream
      * \return returns null of EOF was reached
      */
     char *(*read_line)(struct Data_Stream *, char *, int);
+    /**
+     * Function called by framework users to get the rest of the frame at once without copying it.
+     * The frame is not null terminated and the pointer is only valid until on_ready returns.
+     * Consumes the frame, following read_line calls return null
+     * \param context contains all the function calls and provides necessary context for the function to be executed on the right files
+     * \param data receives pointer to the first unread byte of the frame
+     * \param length receives number of bytes available at data
+     * \return returns non zero if there is no frame to read
+     */
+    int (*read_frame)(struct Data_Stream *, const char **, size_t *);
+    /**
+     * Function called by framework users to append a binary message to the frame, see message_schema.h
+     * \param context contains all the function calls and provides necessary context for the function to be executed on the right files
+     * \param descriptor generated descriptor of the message type, e.g. &Lidar_Packet_descriptor
+     * \param message struct of the type described by descriptor
+     * \return returns non zero if the message could not be added
+     */
+    int (*send_struct)(struct Data_Stream *, const Message_Descriptor *, const void *);
+    /**
+     * Function called by framework users to decode the next binary message of the frame
+     * \param context contains all the function calls and provides necessary context for the function to be executed on the right files
+     * \param descriptor generated descriptor of the expected message type
+     * \param message struct that receives the decoded values
+     * \return returns non zero at the end of the frame or if the next message is of another type
+     */
+    int (*read_struct)(struct Data_Stream *, const Message_Descriptor *, void *);
 } Data_Stream;
 
-void set_file_system_com_framework_logging(bool enabled);
-int create_new_data_stream(const char *stream_name, enum Stream_type stream_type, void (*on_ready)(Data_Stream *));
-int close_data_streams();
-void update_streams();
+// most worker threads set_update_worker_threads accepts
+#define MAX_UPDATE_WORKER_THREADS 64
+
+Fsc_Context *fsc_context_create(void);
+void fsc_context_destroy(Fsc_Context *fsc);
+void set_file_system_com_framework_logging(Fsc_Context *fsc, bool enabled);
+void set_framework_log_level(Fsc_Context *fsc, int level);
+int set_update_worker_threads(Fsc_Context *fsc, unsigned int thread_count);
+void set_latency_report_output(Fsc_Context *fsc, FILE *output);
+int set_trace_output(Fsc_Context *fsc, const char *trace_path, const char *process_name);
+Data_Stream_Options default_data_stream_options(void);
+Data_Stream *create_new_data_stream(Fsc_Context *fsc, const char *stream_name, enum Stream_type stream_type, void (*on_ready)(Data_Stream *));
+Data_Stream *create_new_data_stream_with_options(Fsc_Context *fsc, const char *stream_name, enum Stream_type stream_type, void (*on_ready)(Data_Stream *), const Data_Stream_Options *options);
+Data_Stream *find_data_stream(Fsc_Context *fsc, const char *stream_name, enum Stream_type stream_type);
+int remove_data_stream(Data_Stream *stream);
+const Latency_Histogram *get_stream_latency_histogram(const Data_Stream *stream, enum Stream_latency latency);
+unsigned long long get_stream_latency_percentile(const Data_Stream *stream, enum Stream_latency latency, double percentile);
+void print_stream_latencies(const Data_Stream *stream, FILE *output);
+int close_data_streams(Fsc_Context *fsc);
+void update_streams(Fsc_Context *fsc);
+int wait_and_update_streams(Fsc_Context *fsc, int timeout_ms);
 
 
 #endif
\ No newline at end of file
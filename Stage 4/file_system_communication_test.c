@@ -0,0 +1,286 @@
+/*******************************************************************************
+ * Title                 :   File System Communication framework tests
+ * Filename              :   file_system_communication_test.c
+ * Author                :   Dominic
+ * Origin Date           :   17/10/2026
+ * Version               :   0.0.1
+ * Notes                 :   Runs the framework between forked processes and checks what it does,
+ *                           prints one line per check and exits with 0 only if all of them passed.
+ *
+ *                           usage: file_system_communication_test
+ *******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include "file_system_communication.h"
+
+// worker wait test, a 5 Hz shared memory writer feeds a reader whose callback takes 200 ms on a worker
+#define WORKER_WAIT_RATE_HZ 5
+#define WORKER_WAIT_CALLBACK_MS 200
+#define WORKER_WAIT_SECONDS 3
+// CPU the waiting thread may use in that time, a busy loop burns all of it
+#define WORKER_WAIT_CPU_LIMIT_MS 300
+// writer restart test, the first writer runs for a second, the second one starts after it closed
+#define RESTART_WRITER_RATE_HZ 20
+#define RESTART_WRITER_MS 1000
+#define RESTART_GAP_MS 500
+#define RESTART_READER_MS 4000
+
+static int failed_checks = 0;
+static unsigned int frames_read = 0;
+static unsigned int restart_frames[2] = { 0, 0 }; // frames the restart reader got from each writer
+static unsigned long long restart_skipped = 0;     // most frames the restart reader was told it skipped at once
+static int restart_writer_index = 0;              // which writer this process is, set in the forked writers
+
+static void check(bool is_passed, const char *description);
+static int test_worker_wait_cpu(void);
+static void run_worker_wait_writer(const char *stream_name);
+static int test_writer_restart(enum Stream_transport transport, enum Stream_type reader_type, enum Stream_type writer_type);
+static void run_restart_writer(const char *stream_name, enum Stream_transport transport, enum Stream_type writer_type,
+                               int writer_index, int delay_ms);
+static void writing_frame(Data_Stream *context);
+static void reading_slowly(Data_Stream *context);
+static void writing_restart_frame(Data_Stream *context);
+static void reading_restart_frame(Data_Stream *context);
+static void sleep_ms(int milliseconds);
+static long long monotonic_ns(void);
+static long long thread_cpu_ns(void);
+
+int main(void)
+{
+    test_worker_wait_cpu();
+    test_writer_restart(SHARED_MEMORY_TRANSPORT, READ_ONLY_STREAM, WRITE_ONLY_STREAM);
+    test_writer_restart(FILE_SYSTEM_TRANSPORT, LATEST_VALUE_READ_STREAM, LATEST_VALUE_WRITE_STREAM);
+
+    printf("result: %s\n", failed_checks == 0 ? "PASS" : "FAIL");
+    return failed_checks != 0;
+}
+
+static void check(bool is_passed, const char *description)
+{
+    printf("%s: %s\n", is_passed ? "PASS" : "FAIL", description);
+    if (!is_passed)
+        failed_checks++;
+}
+
+/**
+ * wait_and_update_streams must sleep while the only stream with a frame waiting is still on a worker
+ */
+static int test_worker_wait_cpu(void)
+{
+    char stream_name[64];
+    snprintf(stream_name, sizeof(stream_name), "fsc_test_worker_wait_%d", (int)getpid());
+
+    fflush(stdout);
+    pid_t writer = fork();
+    if (writer < 0)
+    {
+        check(false, "fork the writer of the worker wait test");
+        return 1;
+    }
+    if (writer == 0)
+        run_worker_wait_writer(stream_name);
+
+    Fsc_Context *fsc = fsc_context_create();
+    if (fsc == NULL || set_update_worker_threads(fsc, 1))
+    {
+        check(false, "create a context with one update worker");
+        kill(writer, SIGTERM);
+        waitpid(writer, NULL, 0);
+        return 1;
+    }
+    set_latency_report_output(fsc, NULL);
+
+    Data_Stream_Options options = default_data_stream_options();
+    options.transport = SHARED_MEMORY_TRANSPORT;
+    create_new_data_stream_with_options(fsc, stream_name, READ_ONLY_STREAM, reading_slowly, &options);
+
+    long long end_ns = monotonic_ns() + WORKER_WAIT_SECONDS * 1000000000LL;
+    long long cpu_ns = thread_cpu_ns();
+    while (monotonic_ns() < end_ns)
+        wait_and_update_streams(fsc, 100);
+    cpu_ns = thread_cpu_ns() - cpu_ns;
+
+    close_data_streams(fsc);
+    fsc_context_destroy(fsc);
+    waitpid(writer, NULL, 0);
+
+    printf("worker wait: %u frames, waiting thread used %.1f ms CPU in %d s\n", frames_read, cpu_ns / 1e6, WORKER_WAIT_SECONDS);
+    check(frames_read >= WORKER_WAIT_RATE_HZ, "reader on a worker gets the frames");
+    check(cpu_ns < WORKER_WAIT_CPU_LIMIT_MS * 1000000LL, "waiting thread sleeps while the stream is on a worker");
+    return 0;
+}
+
+// writer process of the worker wait test, runs a little longer than the reader
+static void run_worker_wait_writer(const char *stream_name)
+{
+    Fsc_Context *fsc = fsc_context_create();
+    if (fsc == NULL)
+        exit(1);
+    set_latency_report_output(fsc, NULL);
+
+    Data_Stream_Options options = default_data_stream_options();
+    options.transport = SHARED_MEMORY_TRANSPORT;
+    options.rate_hz = WORKER_WAIT_RATE_HZ;
+    create_new_data_stream_with_options(fsc, stream_name, WRITE_ONLY_STREAM, writing_frame, &options);
+
+    long long end_ns = monotonic_ns() + (WORKER_WAIT_SECONDS + 1) * 1000000000LL;
+    while (monotonic_ns() < end_ns)
+        wait_and_update_streams(fsc, 100);
+
+    close_data_streams(fsc);
+    fsc_context_destroy(fsc);
+    exit(0);
+}
+
+/**
+ * A reader that outlives its writer has to get the frames of the writer started after it.
+ * Over shared memory the first writer unlinks its segment on close and the second one works on a new one,
+ * the second writer counts its sequence from 0 again which must not show up as skipped frames
+ * \param transport transport of both sides
+ * \param reader_type READ_ONLY_STREAM or LATEST_VALUE_READ_STREAM
+ * \param writer_type the matching writer type
+ * \return 0 when the test could run
+ */
+static int test_writer_restart(enum Stream_transport transport, enum Stream_type reader_type, enum Stream_type writer_type)
+{
+    char stream_name[64];
+    snprintf(stream_name, sizeof(stream_name), "fsc_test_writer_restart_%d_%d", (int)getpid(), (int)reader_type);
+    restart_frames[0] = restart_frames[1] = 0;
+    restart_skipped = 0;
+
+    fflush(stdout); // forked writers would print what is still buffered again
+    pid_t writers[2];
+    for (int i = 0; i < 2; i++)
+    {
+        writers[i] = fork();
+        if (writers[i] < 0)
+        {
+            check(false, "fork the writers of the writer restart test");
+            return 1;
+        }
+        if (writers[i] == 0)
+            run_restart_writer(stream_name, transport, writer_type, i, i == 0 ? 0 : RESTART_WRITER_MS + RESTART_GAP_MS);
+    }
+
+    Fsc_Context *fsc = fsc_context_create();
+    if (fsc == NULL)
+    {
+        check(false, "create the context of the restart reader");
+        return 1;
+    }
+    set_latency_report_output(fsc, NULL);
+
+    Data_Stream_Options options = default_data_stream_options();
+    options.transport = transport;
+    create_new_data_stream_with_options(fsc, stream_name, reader_type, reading_restart_frame, &options);
+
+    long long end_ns = monotonic_ns() + RESTART_READER_MS * 1000000LL;
+    while (monotonic_ns() < end_ns)
+        wait_and_update_streams(fsc, 100);
+
+    close_data_streams(fsc);
+    fsc_context_destroy(fsc);
+    for (int i = 0; i < 2; i++)
+        waitpid(writers[i], NULL, 0);
+
+    printf("writer restart (%s): %u frames from the first writer, %u from the second, at most %llu skipped at once\n",
+           reader_type == READ_ONLY_STREAM ? "shared memory" : "latest value file", restart_frames[0], restart_frames[1],
+           restart_skipped);
+    check(restart_frames[0] > 0, "reader gets the frames of the first writer");
+    check(restart_frames[1] > 0, "reader gets the frames of the writer started after the first one closed");
+    // both writers send RESTART_WRITER_RATE_HZ for a second, a restart counted as skipped frames wraps around
+    check(restart_skipped <= RESTART_WRITER_RATE_HZ, "restarted writer is not counted as skipped frames");
+
+    char path[96];
+    snprintf(path, sizeof(path), "%s.txt", stream_name);
+    unlink(path);
+    snprintf(path, sizeof(path), "%s.tmp", stream_name);
+    unlink(path);
+    return 0;
+}
+
+// writer process of the restart test, writes its index for RESTART_WRITER_MS and closes the stream
+static void run_restart_writer(const char *stream_name, enum Stream_transport transport, enum Stream_type writer_type,
+                               int writer_index, int delay_ms)
+{
+    sleep_ms(delay_ms);
+
+    Fsc_Context *fsc = fsc_context_create();
+    if (fsc == NULL)
+        exit(1);
+    set_latency_report_output(fsc, NULL);
+
+    restart_writer_index = writer_index;
+    Data_Stream_Options options = default_data_stream_options();
+    options.transport = transport;
+    options.rate_hz = RESTART_WRITER_RATE_HZ;
+    create_new_data_stream_with_options(fsc, stream_name, writer_type, writing_restart_frame, &options);
+
+    long long end_ns = monotonic_ns() + RESTART_WRITER_MS * 1000000LL;
+    while (monotonic_ns() < end_ns)
+        wait_and_update_streams(fsc, 100);
+
+    close_data_streams(fsc);
+    fsc_context_destroy(fsc);
+    exit(0);
+}
+
+static void writing_frame(Data_Stream *context)
+{
+    context->send_line(context, "frame %llu", context->sequence);
+}
+
+static void reading_slowly(Data_Stream *context)
+{
+    char line[64];
+    if (context->read_line(context, line, sizeof(line)) != NULL)
+        __atomic_add_fetch(&frames_read, 1, __ATOMIC_RELAXED);
+
+    struct timespec callback_time = { 0, WORKER_WAIT_CALLBACK_MS * 1000000L };
+    nanosleep(&callback_time, NULL);
+}
+
+static void writing_restart_frame(Data_Stream *context)
+{
+    context->send_line(context, "writer %d", restart_writer_index);
+}
+
+static void reading_restart_frame(Data_Stream *context)
+{
+    char line[64];
+    int writer_index;
+    if (context->read_line(context, line, sizeof(line)) != NULL && sscanf(line, "writer %d", &writer_index) == 1
+        && writer_index >= 0 && writer_index < 2)
+        restart_frames[writer_index]++;
+    if (context->skipped_frames > restart_skipped)
+        restart_skipped = context->skipped_frames;
+}
+
+static void sleep_ms(int milliseconds)
+{
+    struct timespec duration = { milliseconds / 1000, (milliseconds % 1000) * 1000000L };
+    nanosleep(&duration, NULL);
+}
+
+static long long monotonic_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+static long long thread_cpu_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return (long long)now.tv_sec * 1000000000LL + now.tv_nsec;
+}
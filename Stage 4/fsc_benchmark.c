@@ -0,0 +1,634 @@
+/*******************************************************************************
+ * Title                 :   File System Communication benchmark
+ * Filename              :   fsc_benchmark.c
+ * Author                :   Dominic
+ * Origin Date           :   17/10/2026
+ * Version               :   0.0.1
+ * Notes                 :   Measures the framework between two processes, a writer (this process) and
+ *                           a reader forked for every measurement:
+ *                           - pingpong, round trip of one frame out and its ack back (queue depth 1),
+ *                             taken from the writer's ack round trip histogram,
+ *                           - throughput, one way frames and bytes per second from the reader's first
+ *                             to its last frame, plus the publish to consume latency under that load.
+ *                           Every transport (file system with signal files, file system with rename,
+ *                           shared memory) runs over frame sizes, queue depths and stream counts,
+ *                           file system transports once in a tmpfs directory and once on disk.
+ *                           Every frame is checked by the reader (length, type, sequence, pattern).
+ *                           Results are written as CSV, one row per measurement, progress goes to stderr.
+ *
+ *                           usage: fsc_benchmark [-t tmpfs_dir] [-d disk_dir] [-o results.csv]
+ *                                                [-b pingpong|throughput|all] [-n frames] [-q]
+ *******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/vfs.h>
+#include <sys/wait.h>
+#include "file_system_communication.h"
+
+#define BENCH_PAYLOAD_TYPE_ID 0xBE5C
+
+// defaults of the command line options
+#define DEFAULT_TMPFS_DIRECTORY "/dev/shm"
+#define DEFAULT_DISK_DIRECTORY "."
+#define DEFAULT_PINGPONG_FRAMES 2000
+#define DEFAULT_THROUGHPUT_FRAMES 5000
+#define QUICK_DIVISOR 10
+
+// throughput runs with big frames send fewer of them, at most this many bytes per measurement
+#define MAX_BYTES_PER_MEASUREMENT (64ULL * 1024 * 1024)
+#define MIN_FRAMES_PER_MEASUREMENT 100
+// a measurement that takes longer than this is stopped and reported as timed out
+#define MEASUREMENT_TIMEOUT_NS (60LL * 1000000000LL)
+#define WAIT_TIMEOUT_MS 100
+
+#define TMPFS_MAGIC_NUMBER 0x01021994
+#define MAX_BENCH_STREAMS 4
+
+enum Bench_kind
+{
+    PINGPONG_BENCHMARK,
+    THROUGHPUT_BENCHMARK
+};
+
+/**
+ * One way of moving frames that gets measured
+ */
+typedef struct Bench_Transport
+{
+    const char *name;
+    enum Stream_transport transport;
+    enum Frame_publication publication;
+    bool uses_directory;        // file system transports run in every directory, shared memory once
+} Bench_Transport;
+
+/**
+ * Everything one measurement is run with
+ */
+typedef struct Bench_Config
+{
+    enum Bench_kind kind;
+    const Bench_Transport *transport;
+    const char *directory;      // NULL for shared memory
+    const char *file_system;    // tmpfs, disk or shm
+    size_t frame_size;          // payload bytes of every frame
+    unsigned int queue_depth;
+    unsigned int stream_count;
+    unsigned long long frames;  // per stream, pingpong sends one more which closes the round trip of the last
+} Bench_Config;
+
+/**
+ * What the reader process sends back through the pipe once it is done
+ */
+typedef struct Reader_Result
+{
+    unsigned long long frames;
+    unsigned long long errors;  // frames with wrong length, type, sequence or content
+    long long first_frame_ns;
+    long long last_frame_ns;
+    Latency_Histogram latency;  // publish to consume over all streams
+} Reader_Result;
+
+/**
+ * Benchmark side state of one stream, found through the Data_Stream handle
+ */
+typedef struct Bench_Stream
+{
+    Data_Stream *stream;
+    unsigned long long frames;
+} Bench_Stream;
+
+/**
+ * Payload of a benchmark frame, only the sequence is stored, the rest of the frame is a pattern of it
+ */
+typedef struct Bench_Payload
+{
+    unsigned long long sequence;
+    size_t size;
+} Bench_Payload;
+
+static const Bench_Transport transports[] = {
+    { "file_signal", FILE_SYSTEM_TRANSPORT, SIGNAL_FILE_PUBLICATION, true },
+    { "file_rename", FILE_SYSTEM_TRANSPORT, RENAME_PUBLICATION, true },
+    { "shm", SHARED_MEMORY_TRANSPORT, SIGNAL_FILE_PUBLICATION, false },
+};
+static const size_t frame_sizes[] = { 64, 1024, 16384, 65536 };
+static const unsigned int queue_depths[] = { 1, 8 };
+static const unsigned int stream_counts[] = { 1, MAX_BENCH_STREAMS };
+
+// state of the measurement running in this process, callbacks have no user pointer
+static const Bench_Config *current_config;
+static Message_Descriptor payload_descriptor;
+static Bench_Stream bench_streams[MAX_BENCH_STREAMS];
+static unsigned int unfinished_streams;
+static Reader_Result reader_result;
+static Latency_Histogram round_trip;
+static unsigned int measurement_number;
+
+static void print_usage(const char *program);
+static const char *describe_file_system(const char *directory);
+static void run_benchmarks(FILE *output, enum Bench_kind kind, const char *tmpfs_directory, const char *disk_directory, unsigned long long frames);
+static void run_configurations(FILE *output, enum Bench_kind kind, const Bench_Transport *transport, const char *directory, const char *file_system, unsigned long long frames);
+static int run_measurement(FILE *output, const Bench_Config *config);
+static int run_writer(const Bench_Config *config, bool *is_timed_out);
+static void run_reader(const Bench_Config *config, int result_fd);
+static void open_bench_streams(Fsc_Context *fsc, const Bench_Config *config, enum Stream_type stream_type, void (*on_ready)(Data_Stream *));
+static Bench_Stream *find_bench_stream(const Data_Stream *stream);
+static void sending_frame(Data_Stream *context);
+static void receiving_frame(Data_Stream *context);
+static void encode_payload(const void *message, unsigned char *payload);
+static void write_result(FILE *output, const Bench_Config *config, const Reader_Result *reader, long long cpu_ns, bool is_timed_out);
+static void remove_directory_files(const char *directory);
+static int write_full(int fd, const void *data, size_t size);
+static int read_full(int fd, void *data, size_t size);
+static long long monotonic_ns(void);
+static long long timeval_ns(struct timeval time);
+
+int main(int argc, char *argv[])
+{
+    const char *tmpfs_directory = DEFAULT_TMPFS_DIRECTORY;
+    const char *disk_directory = DEFAULT_DISK_DIRECTORY;
+    const char *output_path = NULL;
+    unsigned long long frames = 0;
+    bool is_quick = false;
+    bool runs_pingpong = true;
+    bool runs_throughput = true;
+
+    int option;
+    while ((option = getopt(argc, argv, "t:d:o:b:n:qh")) != -1)
+    {
+        switch (option)
+        {
+        case 't': tmpfs_directory = optarg; break;
+        case 'd': disk_directory = optarg; break;
+        case 'o': output_path = optarg; break;
+        case 'n': frames = strtoull(optarg, NULL, 10); break;
+        case 'q': is_quick = true; break;
+        case 'b':
+            runs_pingpong = !strcmp(optarg, "pingpong") || !strcmp(optarg, "all");
+            runs_throughput = !strcmp(optarg, "throughput") || !strcmp(optarg, "all");
+            if (runs_pingpong || runs_throughput)
+                break;
+            /* fall through */
+        default:
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    FILE *output = stdout;
+    if (output_path != NULL && (output = fopen(output_path, "w")) == NULL)
+    {
+        fprintf(stderr, "Failed to open %s for the results\n", output_path);
+        return 1;
+    }
+
+    // a reader that died must not kill us through a write to its pipe
+    signal(SIGPIPE, SIG_IGN);
+
+    fprintf(output, "benchmark,transport,file_system,frame_size,queue_depth,streams,frames,errors,seconds,"
+                    "frames_per_second,megabytes_per_second,cpu_us_per_frame,p50_us,p99_us,p999_us,max_us,status\n");
+    fflush(output);
+
+    fprintf(stderr, "tmpfs directory %s (%s), disk directory %s (%s)\n", tmpfs_directory, describe_file_system(tmpfs_directory),
+            disk_directory, describe_file_system(disk_directory));
+
+    if (runs_pingpong)
+    {
+        unsigned long long pingpong_frames = frames != 0 ? frames : DEFAULT_PINGPONG_FRAMES / (is_quick ? QUICK_DIVISOR : 1);
+        run_benchmarks(output, PINGPONG_BENCHMARK, tmpfs_directory, disk_directory, pingpong_frames);
+    }
+    if (runs_throughput)
+    {
+        unsigned long long throughput_frames = frames != 0 ? frames : DEFAULT_THROUGHPUT_FRAMES / (is_quick ? QUICK_DIVISOR : 1);
+        run_benchmarks(output, THROUGHPUT_BENCHMARK, tmpfs_directory, disk_directory, throughput_frames);
+    }
+
+    if (output != stdout)
+        fclose(output);
+    return 0;
+}
+
+static void print_usage(const char *program)
+{
+    fprintf(stderr, "usage: %s [-t tmpfs_dir] [-d disk_dir] [-o results.csv] [-b pingpong|throughput|all] [-n frames] [-q]\n"
+                    "  -t  directory on tmpfs for the file system transports, default %s\n"
+                    "  -d  directory on disk for the file system transports, default %s\n"
+                    "  -o  CSV file for the results, default stdout\n"
+                    "  -b  which benchmark to run, default all\n"
+                    "  -n  frames per measurement and stream, default %d pingpong / %d throughput\n"
+                    "  -q  quick run with %d times fewer frames\n",
+            program, DEFAULT_TMPFS_DIRECTORY, DEFAULT_DISK_DIRECTORY, DEFAULT_PINGPONG_FRAMES, DEFAULT_THROUGHPUT_FRAMES, QUICK_DIVISOR);
+}
+
+/**
+ * \return tmpfs or disk, the column results are grouped by
+ */
+static const char *describe_file_system(const char *directory)
+{
+    struct statfs info;
+    if (statfs(directory, &info))
+        return "unknown";
+    return info.f_type == TMPFS_MAGIC_NUMBER ? "tmpfs" : "disk";
+}
+
+/**
+ * Runs one benchmark for every transport, file system transports in both directories
+ */
+static void run_benchmarks(FILE *output, enum Bench_kind kind, const char *tmpfs_directory, const char *disk_directory, unsigned long long frames)
+{
+    for (size_t transport = 0; transport < sizeof(transports) / sizeof(transports[0]); transport++)
+    {
+        if (!transports[transport].uses_directory)
+        {
+            run_configurations(output, kind, &transports[transport], NULL, "shm", frames);
+            continue;
+        }
+        run_configurations(output, kind, &transports[transport], tmpfs_directory, describe_file_system(tmpfs_directory), frames);
+        run_configurations(output, kind, &transports[transport], disk_directory, describe_file_system(disk_directory), frames);
+    }
+}
+
+/**
+ * Runs the frame size, queue depth and stream count matrix of one transport in one directory.
+ * Pingpong only varies the frame size, a round trip needs queue depth 1 and a single stream
+ */
+static void run_configurations(FILE *output, enum Bench_kind kind, const Bench_Transport *transport, const char *directory, const char *file_system, unsigned long long frames)
+{
+    size_t depth_count = kind == PINGPONG_BENCHMARK ? 1 : sizeof(queue_depths) / sizeof(queue_depths[0]);
+    size_t count_count = kind == PINGPONG_BENCHMARK ? 1 : sizeof(stream_counts) / sizeof(stream_counts[0]);
+
+    for (size_t size = 0; size < sizeof(frame_sizes) / sizeof(frame_sizes[0]); size++)
+        for (size_t depth = 0; depth < depth_count; depth++)
+            for (size_t count = 0; count < count_count; count++)
+            {
+                Bench_Config config = { kind, transport, directory, file_system, frame_sizes[size], queue_depths[depth], stream_counts[count], frames };
+
+                // keep big frame runs short
+                unsigned long long byte_limited = MAX_BYTES_PER_MEASUREMENT / (config.frame_size * config.stream_count);
+                if (kind == THROUGHPUT_BENCHMARK && config.frames > byte_limited)
+                    config.frames = byte_limited > MIN_FRAMES_PER_MEASUREMENT ? byte_limited : MIN_FRAMES_PER_MEASUREMENT;
+
+                if (run_measurement(output, &config))
+                    fprintf(stderr, "Measurement failed to run\n");
+            }
+}
+
+/**
+ * Runs one measurement in a fresh directory with a forked reader and writes its CSV row
+ * \return non zero if it could not be started
+ */
+static int run_measurement(FILE *output, const Bench_Config *config)
+{
+    fprintf(stderr, "%-10s %-11s %-5s size %6zu depth %u streams %u frames %llu\n", config->kind == PINGPONG_BENCHMARK ? "pingpong" : "throughput",
+            config->transport->name, config->file_system, config->frame_size, config->queue_depth, config->stream_count, config->frames);
+
+    char original_directory[4096];
+    char run_directory[4096] = "";
+    if (getcwd(original_directory, sizeof(original_directory)) == NULL)
+        return 1;
+
+    // file streams live in the working directory, every measurement gets an empty one
+    if (config->directory != NULL)
+    {
+        snprintf(run_directory, sizeof(run_directory), "%s/fsc_benchmark.XXXXXX", config->directory);
+        if (mkdtemp(run_directory) == NULL || chdir(run_directory))
+        {
+            fprintf(stderr, "Failed to create a directory in %s\n", config->directory);
+            return 1;
+        }
+    }
+
+    int result_pipe[2];
+    if (pipe(result_pipe))
+        return 1;
+
+    measurement_number++;
+    fflush(NULL);
+    pid_t reader = fork();
+    if (reader < 0)
+    {
+        close(result_pipe[0]);
+        close(result_pipe[1]);
+        return 1;
+    }
+    if (reader == 0)
+    {
+        close(result_pipe[0]);
+        run_reader(config, result_pipe[1]);
+        _exit(0);
+    }
+    close(result_pipe[1]);
+
+    struct rusage usage_before, usage_after, reader_usage;
+    getrusage(RUSAGE_SELF, &usage_before);
+    bool is_timed_out = false;
+    int result = run_writer(config, &is_timed_out);
+    getrusage(RUSAGE_SELF, &usage_after);
+
+    if (result || is_timed_out)
+        kill(reader, SIGKILL);
+
+    Reader_Result reader_data;
+    memset(&reader_data, 0, sizeof(reader_data));
+    if (read_full(result_pipe[0], &reader_data, sizeof(reader_data)))
+        is_timed_out = true;
+    close(result_pipe[0]);
+
+    int status;
+    if (wait4(reader, &status, 0, &reader_usage) < 0)
+        memset(&reader_usage, 0, sizeof(reader_usage));
+
+    long long cpu_ns = timeval_ns(usage_after.ru_utime) + timeval_ns(usage_after.ru_stime)
+                     - timeval_ns(usage_before.ru_utime) - timeval_ns(usage_before.ru_stime)
+                     + timeval_ns(reader_usage.ru_utime) + timeval_ns(reader_usage.ru_stime);
+
+    if (!result)
+        write_result(output, config, &reader_data, cpu_ns, is_timed_out);
+
+    if (config->directory != NULL)
+    {
+        remove_directory_files(".");
+        if (chdir(original_directory) || rmdir(run_directory))
+            fprintf(stderr, "Failed to clean up %s\n", run_directory);
+    }
+    return result;
+}
+
+/**
+ * Writer side of a measurement, sends the frames of every stream and waits until the last one went out
+ * \param is_timed_out set if the reader did not keep up within MEASUREMENT_TIMEOUT_NS
+ * \return non zero if the streams could not be created
+ */
+static int run_writer(const Bench_Config *config, bool *is_timed_out)
+{
+    Fsc_Context *fsc = fsc_context_create();
+    if (fsc == NULL)
+        return 1;
+    set_latency_report_output(fsc, NULL);
+
+    latency_histogram_reset(&round_trip);
+    open_bench_streams(fsc, config, WRITE_ONLY_STREAM, sending_frame);
+    if (unfinished_streams != config->stream_count)
+    {
+        fsc_context_destroy(fsc);
+        return 1;
+    }
+
+    long long deadline_ns = monotonic_ns() + MEASUREMENT_TIMEOUT_NS;
+    while (unfinished_streams > 0 && !*is_timed_out)
+    {
+        wait_and_update_streams(fsc, WAIT_TIMEOUT_MS);
+        *is_timed_out = monotonic_ns() > deadline_ns;
+    }
+
+    fsc_context_destroy(fsc);
+    return 0;
+}
+
+/**
+ * Reader side of a measurement, runs in the forked process until every stream delivered its frames
+ * and sends the Reader_Result through result_fd
+ */
+static void run_reader(const Bench_Config *config, int result_fd)
+{
+    memset(&reader_result, 0, sizeof(reader_result));
+
+    Fsc_Context *fsc = fsc_context_create();
+    if (fsc != NULL)
+    {
+        set_latency_report_output(fsc, NULL);
+        open_bench_streams(fsc, config, READ_ONLY_STREAM, receiving_frame);
+
+        long long deadline_ns = monotonic_ns() + MEASUREMENT_TIMEOUT_NS;
+        while (unfinished_streams > 0 && monotonic_ns() < deadline_ns)
+            wait_and_update_streams(fsc, WAIT_TIMEOUT_MS);
+
+        fsc_context_destroy(fsc);
+    }
+
+    write_full(result_fd, &reader_result, sizeof(reader_result));
+    close(result_fd);
+}
+
+/**
+ * Creates the streams of a measurement, names are unique per measurement so shared memory
+ * leftovers of an earlier one can never be picked up
+ */
+static void open_bench_streams(Fsc_Context *fsc, const Bench_Config *config, enum Stream_type stream_type, void (*on_ready)(Data_Stream *))
+{
+    current_config = config;
+    payload_descriptor = (Message_Descriptor){ BENCH_PAYLOAD_TYPE_ID, (uint32_t)config->frame_size, "Bench_Payload", encode_payload, NULL };
+    memset(bench_streams, 0, sizeof(bench_streams));
+    unfinished_streams = 0;
+
+    Data_Stream_Options options = default_data_stream_options();
+    options.transport = config->transport->transport;
+    options.publication = config->transport->publication;
+    options.queue_depth = config->queue_depth;
+    options.frame_capacity = config->frame_size + sizeof(Typed_Frame_Header);
+
+    for (unsigned int index = 0; index < config->stream_count; index++)
+    {
+        char stream_name[MAX_NAME_LENGTH];
+        snprintf(stream_name, sizeof(stream_name), "bench_%d_%u_%u", (int)(stream_type == WRITE_ONLY_STREAM ? getpid() : getppid()),
+                 measurement_number, index);
+
+        bench_streams[index].stream = create_new_data_stream_with_options(fsc, stream_name, stream_type, on_ready, &options);
+        if (bench_streams[index].stream == NULL)
+        {
+            fprintf(stderr, "Failed to create stream %s\n", stream_name);
+            return;
+        }
+        unfinished_streams++;
+    }
+}
+
+/**
+ * \return benchmark state of the stream, NULL if it is not one of ours
+ */
+static Bench_Stream *find_bench_stream(const Data_Stream *stream)
+{
+    for (unsigned int index = 0; index < MAX_BENCH_STREAMS; index++)
+        if (bench_streams[index].stream == stream)
+            return &bench_streams[index];
+    return NULL;
+}
+
+/**
+ * Called by the framework whenever a stream can take the next frame.
+ * Pingpong sends one frame more than measured, the writer sees the ack of the last measured one right before it
+ */
+static void sending_frame(Data_Stream *context)
+{
+    Bench_Stream *bench_stream = find_bench_stream(context);
+    if (bench_stream == NULL)
+        return;
+
+    unsigned long long frames = current_config->frames + (current_config->kind == PINGPONG_BENCHMARK ? 1 : 0);
+
+    // every measured frame has its round trip recorded by now
+    const Latency_Histogram *acks = get_stream_latency_histogram(context, ACK_ROUND_TRIP_LATENCY);
+    if (bench_stream->frames + 1 == frames && acks != NULL)
+        round_trip = *acks;
+
+    Bench_Payload payload = { bench_stream->frames, current_config->frame_size };
+    context->send_struct(context, &payload_descriptor, &payload);
+
+    if (++bench_stream->frames == frames)
+    {
+        remove_data_stream(context);
+        unfinished_streams--;
+    }
+}
+
+/**
+ * Called by the framework for every frame that arrives, checks it against what the writer sent
+ */
+static void receiving_frame(Data_Stream *context)
+{
+    Bench_Stream *bench_stream = find_bench_stream(context);
+    if (bench_stream == NULL)
+        return;
+
+    long long now_ns = monotonic_ns();
+    if (reader_result.frames == 0)
+        reader_result.first_frame_ns = now_ns;
+    reader_result.last_frame_ns = now_ns;
+    reader_result.frames++;
+
+    const char *data;
+    size_t length;
+    Typed_Frame_Header header;
+    unsigned long long sequence;
+    const unsigned char *payload = NULL;
+    if (!context->read_frame(context, &data, &length) && length == sizeof(header) + current_config->frame_size)
+    {
+        memcpy(&header, data, sizeof(header));
+        payload = (const unsigned char *)data + sizeof(header);
+        memcpy(&sequence, payload, sizeof(sequence));
+    }
+
+    if (payload == NULL || header.type_id != BENCH_PAYLOAD_TYPE_ID || header.length != current_config->frame_size
+        || sequence != bench_stream->frames || payload[current_config->frame_size - 1] != (unsigned char)sequence)
+        reader_result.errors++;
+
+    unsigned long long frames = current_config->frames + (current_config->kind == PINGPONG_BENCHMARK ? 1 : 0);
+    if (++bench_stream->frames == frames)
+    {
+        const Latency_Histogram *latency = get_stream_latency_histogram(context, PUBLISH_TO_CONSUME_LATENCY);
+        if (latency != NULL)
+            latency_histogram_merge(&reader_result.latency, latency);
+        remove_data_stream(context);
+        unfinished_streams--;
+    }
+}
+
+/**
+ * Encoder of the benchmark payload, sequence first and its low byte repeated over the rest of the frame
+ */
+static void encode_payload(const void *message, unsigned char *payload)
+{
+    const Bench_Payload *typed = message;
+    memset(payload, (unsigned char)typed->sequence, typed->size);
+    memcpy(payload, &typed->sequence, sizeof(typed->sequence));
+}
+
+/**
+ * Writes the CSV row of a measurement, latencies are round trips for pingpong and publish to consume for throughput
+ */
+static void write_result(FILE *output, const Bench_Config *config, const Reader_Result *reader, long long cpu_ns, bool is_timed_out)
+{
+    const Latency_Histogram *latency = config->kind == PINGPONG_BENCHMARK ? &round_trip : &reader->latency;
+
+    double seconds = (double)(reader->last_frame_ns - reader->first_frame_ns) / 1e9;
+    // rate is taken between first and last frame, so one frame less than were received
+    double frames_per_second = seconds > 0 ? (double)(reader->frames - 1) / seconds : 0;
+
+    fprintf(output, "%s,%s,%s,%zu,%u,%u,%llu,%llu,%.6f,%.1f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%s\n",
+            config->kind == PINGPONG_BENCHMARK ? "pingpong" : "throughput", config->transport->name, config->file_system,
+            config->frame_size, config->queue_depth, config->stream_count, reader->frames, reader->errors, seconds,
+            frames_per_second, frames_per_second * (double)config->frame_size / 1e6,
+            reader->frames > 0 ? (double)cpu_ns / 1000 / (double)reader->frames : 0,
+            (double)latency_histogram_percentile(latency, 50) / 1000, (double)latency_histogram_percentile(latency, 99) / 1000,
+            (double)latency_histogram_percentile(latency, 99.9) / 1000, (double)latency->max / 1000,
+            is_timed_out ? "timeout" : reader->errors > 0 ? "corrupt" : "ok");
+    fflush(output);
+}
+
+/**
+ * Removes every file of a measurement directory, data, flag, ack and temporary files of the streams
+ */
+static void remove_directory_files(const char *directory)
+{
+    DIR *listing = opendir(directory);
+    if (listing == NULL)
+        return;
+
+    struct dirent *entry;
+    while ((entry = readdir(listing)) != NULL)
+        if (strcmp(entry->d_name, ".") && strcmp(entry->d_name, ".."))
+            unlink(entry->d_name);
+    closedir(listing);
+}
+
+/**
+ * \return non zero if not all bytes could be written
+ */
+static int write_full(int fd, const void *data, size_t size)
+{
+    const char *bytes = data;
+    while (size > 0)
+    {
+        ssize_t written = write(fd, bytes, size);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written <= 0)
+            return 1;
+        bytes += written;
+        size -= (size_t)written;
+    }
+    return 0;
+}
+
+/**
+ * \return non zero if the other end closed before size bytes arrived
+ */
+static int read_full(int fd, void *data, size_t size)
+{
+    char *bytes = data;
+    while (size > 0)
+    {
+        ssize_t count = read(fd, bytes, size);
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count <= 0)
+            return 1;
+        bytes += count;
+        size -= (size_t)count;
+    }
+    return 0;
+}
+
+static long long monotonic_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+static long long timeval_ns(struct timeval time)
+{
+    return (long long)time.tv_sec * 1000000000LL + (long long)time.tv_usec * 1000LL;
+}
@@ -0,0 +1,705 @@
+/*******************************************************************************
+ * Title                 :   File System Communication stress harness
+ * Filename              :   fsc_stress.c
+ * Author                :   Dominic
+ * Origin Date           :   17/10/2026
+ * Version               :   0.0.1
+ * Notes                 :   Forks producer and consumer processes that share many named streams,
+ *                           stream s is written by producer s % producers and read by consumer s % consumers.
+ *                           Producers publish at the given rate for the given time, then send a last
+ *                           frame holding the number of frames of the stream.
+ *                           Consumers check every frame: right stream, sequence in order without gaps
+ *                           (latest value streams may skip but never go back) and the payload byte for
+ *                           byte, it is generated from stream and sequence so it can be rebuilt.
+ *                           The harness adds up what every process reports and prints throughput,
+ *                           CPU time per frame and the publish to consume latency percentiles.
+ *                           Exit status is 0 only if every frame of every stream arrived intact and in order.
+ *
+ *                           usage: fsc_stress [-p producers] [-c consumers] [-s streams] [-r rate_hz]
+ *                                             [-d seconds] [-z frame_size] [-q queue_depth]
+ *                                             [-t file_signal|file_rename|shm] [-w worker_threads]
+ *                                             [-l] [-D directory]
+ *******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include "file_system_communication.h"
+
+#define STRESS_FRAME_TYPE_ID 0x57E5
+
+// defaults of the command line options
+#define DEFAULT_PRODUCERS 4
+#define DEFAULT_CONSUMERS 4
+#define DEFAULT_STREAMS 32
+#define DEFAULT_RATE_HZ 1000.0
+#define DEFAULT_SECONDS 5.0
+#define DEFAULT_FRAME_SIZE 256
+#define DEFAULT_QUEUE_DEPTH 8
+#define DEFAULT_DIRECTORY "."
+
+#define MAX_PROCESSES 256
+#define MAX_STREAMS 4096
+// fixed part of a frame, the rest of frame_size is generated payload
+#define STRESS_FRAME_HEADER_SIZE (4 + 4 + 8 + 8)
+// consumers give up on streams that did not finish this long after the producers should have stopped
+#define DRAIN_TIMEOUT_NS (30LL * 1000000000LL)
+#define WAIT_TIMEOUT_MS 100
+
+// frame flag, last frame of the stream, total holds how many frames the stream had including this one
+#define STRESS_LAST_FRAME 1u
+
+/**
+ * Settings shared by every process of a run
+ */
+typedef struct Stress_Config
+{
+    unsigned int producers;
+    unsigned int consumers;
+    unsigned int streams;
+    double rate_hz;             // per stream, 0 for as fast as the reader takes them
+    double seconds;
+    size_t frame_size;          // bytes of the message in every frame, at least STRESS_FRAME_HEADER_SIZE
+    unsigned int queue_depth;
+    enum Stream_transport transport;
+    enum Frame_publication publication;
+    const char *transport_name;
+    unsigned int worker_threads;
+    bool is_latest_value;
+    const char *directory;
+} Stress_Config;
+
+/**
+ * Message of a stress frame, payload is rebuilt by the consumer from stream and sequence
+ */
+typedef struct Stress_Frame
+{
+    uint32_t stream_index;
+    uint32_t flags;
+    uint64_t sequence;
+    uint64_t total;             // STRESS_LAST_FRAME only
+} Stress_Frame;
+
+/**
+ * State of one stream inside a producer or consumer process
+ */
+typedef struct Stress_Stream
+{
+    Data_Stream *stream;
+    unsigned int index;
+    unsigned long long sequence;    // producer: next frame to send, consumer: next frame expected
+    unsigned long long frames;      // consumer, frames received
+    unsigned long long lost;        // consumer, frames missing between two received ones
+    unsigned long long skipped;     // consumer of latest value streams, frames overwritten before they were read (not an error)
+    unsigned long long out_of_order;
+    unsigned long long corrupt;
+    unsigned long long total;       // consumer, total the producer announced with its last frame
+    bool is_finished;
+    long long first_frame_ns;
+    long long last_frame_ns;
+} Stress_Stream;
+
+/**
+ * What every process sends back to the harness through its pipe
+ */
+typedef struct Process_Report
+{
+    bool is_producer;
+    unsigned long long frames;      // sent or received
+    unsigned long long lost;
+    unsigned long long skipped;
+    unsigned long long out_of_order;
+    unsigned long long corrupt;
+    unsigned long long unfinished_streams;
+    long long first_frame_ns;
+    long long last_frame_ns;
+    Latency_Histogram latency;      // consumers, publish to consume over all their streams
+} Process_Report;
+
+// state of the producer or consumer running in this process, callbacks have no user pointer
+static Stress_Config config;
+static Stress_Stream *stress_streams;   // indexed by stream index, only the ones of this process are used
+static Message_Descriptor frame_descriptor;
+static unsigned int unfinished_streams;
+static volatile sig_atomic_t is_stopping = 0;
+static pid_t harness_pid;
+
+static void print_usage(const char *program);
+static bool parse_transport(const char *name);
+static int run_process(bool is_producer, unsigned int process_index, int report_fd);
+static int open_stress_streams(Fsc_Context *fsc, bool is_producer, unsigned int process_index);
+static Stress_Stream *find_stress_stream(const Data_Stream *stream);
+static void producing_frame(Data_Stream *context);
+static void consuming_frame(Data_Stream *context);
+static void check_frame(Stress_Stream *stress_stream, const Stress_Frame *frame, const unsigned char *payload, size_t payload_size);
+static void encode_frame(const void *message, unsigned char *payload);
+static void generate_payload(unsigned int stream_index, unsigned long long sequence, unsigned char *payload, size_t size);
+static void stop_producing(int signal_number);
+static void print_report(const Process_Report *producers, const Process_Report *consumers, long long cpu_ns, double elapsed);
+static void remove_directory_files(const char *directory);
+static int write_full(int fd, const void *data, size_t size);
+static int read_full(int fd, void *data, size_t size);
+static long long monotonic_ns(void);
+static long long timeval_ns(struct timeval time);
+
+int main(int argc, char *argv[])
+{
+    config = (Stress_Config){ DEFAULT_PRODUCERS, DEFAULT_CONSUMERS, DEFAULT_STREAMS, DEFAULT_RATE_HZ, DEFAULT_SECONDS, DEFAULT_FRAME_SIZE,
+                              DEFAULT_QUEUE_DEPTH, SHARED_MEMORY_TRANSPORT, SIGNAL_FILE_PUBLICATION, "shm", 0, false, DEFAULT_DIRECTORY };
+
+    int option;
+    while ((option = getopt(argc, argv, "p:c:s:r:d:z:q:t:w:lD:h")) != -1)
+    {
+        switch (option)
+        {
+        case 'p': config.producers = (unsigned int)atoi(optarg); break;
+        case 'c': config.consumers = (unsigned int)atoi(optarg); break;
+        case 's': config.streams = (unsigned int)atoi(optarg); break;
+        case 'r': config.rate_hz = atof(optarg); break;
+        case 'd': config.seconds = atof(optarg); break;
+        case 'z': config.frame_size = (size_t)atol(optarg); break;
+        case 'q': config.queue_depth = (unsigned int)atoi(optarg); break;
+        case 'w': config.worker_threads = (unsigned int)atoi(optarg); break;
+        case 'l': config.is_latest_value = true; break;
+        case 'D': config.directory = optarg; break;
+        case 't':
+            if (parse_transport(optarg))
+                break;
+            /* fall through */
+        default:
+            print_usage(argv[0]);
+            return 2;
+        }
+    }
+
+    if (config.producers == 0 || config.consumers == 0 || config.producers + config.consumers > MAX_PROCESSES
+        || config.streams < config.producers || config.streams < config.consumers || config.streams > MAX_STREAMS
+        || config.frame_size < STRESS_FRAME_HEADER_SIZE || config.queue_depth == 0 || config.queue_depth > MAX_QUEUE_DEPTH
+        || config.rate_hz < 0 || config.seconds <= 0)
+    {
+        fprintf(stderr, "Invalid settings, every process needs a stream, frames hold at least %d bytes\n", STRESS_FRAME_HEADER_SIZE);
+        print_usage(argv[0]);
+        return 2;
+    }
+
+    char original_directory[4096];
+    char run_directory[4096];
+    if (getcwd(original_directory, sizeof(original_directory)) == NULL)
+        return 2;
+    // file streams live in the working directory, the run gets an empty one
+    snprintf(run_directory, sizeof(run_directory), "%s/fsc_stress.XXXXXX", config.directory);
+    if (mkdtemp(run_directory) == NULL || chdir(run_directory))
+    {
+        fprintf(stderr, "Failed to create a directory in %s\n", config.directory);
+        return 2;
+    }
+
+    printf("%u producers, %u consumers, %u %s%s streams, %.0f Hz each, %.1f s, %zu byte frames, queue depth %u, %u worker threads\n",
+           config.producers, config.consumers, config.streams, config.transport_name, config.is_latest_value ? " latest value" : "",
+           config.rate_hz, config.seconds, config.frame_size, config.queue_depth, config.worker_threads);
+    fflush(stdout);
+
+    signal(SIGPIPE, SIG_IGN);
+    harness_pid = getpid();
+
+    unsigned int process_count = config.producers + config.consumers;
+    pid_t pids[MAX_PROCESSES];
+    int report_fds[MAX_PROCESSES];
+    long long start_ns = monotonic_ns();
+
+    // consumers first, they are ready to map rings and watch files when the first frame goes out
+    for (unsigned int process = 0; process < process_count; process++)
+    {
+        bool is_producer = process >= config.consumers;
+        unsigned int index = is_producer ? process - config.consumers : process;
+
+        int report_pipe[2];
+        if (pipe(report_pipe))
+        {
+            fprintf(stderr, "Failed to create a report pipe\n");
+            return 2;
+        }
+
+        pids[process] = fork();
+        if (pids[process] < 0)
+        {
+            fprintf(stderr, "Failed to fork process %u\n", process);
+            return 2;
+        }
+        if (pids[process] == 0)
+        {
+            close(report_pipe[0]);
+            for (unsigned int earlier = 0; earlier < process; earlier++)
+                close(report_fds[earlier]);
+            _exit(run_process(is_producer, index, report_pipe[1]));
+        }
+        close(report_pipe[1]);
+        report_fds[process] = report_pipe[0];
+    }
+
+    // every process reports once it is done, producers after the run time, consumers once drained
+    Process_Report producers, consumers;
+    memset(&producers, 0, sizeof(producers));
+    memset(&consumers, 0, sizeof(consumers));
+    bool has_failed_process = false;
+    long long cpu_ns = 0;
+
+    for (unsigned int process = 0; process < process_count; process++)
+    {
+        Process_Report report;
+        if (read_full(report_fds[process], &report, sizeof(report)))
+        {
+            fprintf(stderr, "Process %d did not report\n", (int)pids[process]);
+            has_failed_process = true;
+            continue;
+        }
+        close(report_fds[process]);
+
+        Process_Report *total = report.is_producer ? &producers : &consumers;
+        total->frames += report.frames;
+        total->lost += report.lost;
+        total->skipped += report.skipped;
+        total->out_of_order += report.out_of_order;
+        total->corrupt += report.corrupt;
+        total->unfinished_streams += report.unfinished_streams;
+        if (report.frames > 0 && (total->first_frame_ns == 0 || report.first_frame_ns < total->first_frame_ns))
+            total->first_frame_ns = report.first_frame_ns;
+        if (report.last_frame_ns > total->last_frame_ns)
+            total->last_frame_ns = report.last_frame_ns;
+        latency_histogram_merge(&total->latency, &report.latency);
+    }
+
+    for (unsigned int process = 0; process < process_count; process++)
+    {
+        int status;
+        struct rusage usage;
+        if (wait4(pids[process], &status, 0, &usage) < 0)
+            continue;
+        cpu_ns += timeval_ns(usage.ru_utime) + timeval_ns(usage.ru_stime);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            has_failed_process = true;
+    }
+
+    print_report(&producers, &consumers, cpu_ns, (double)(monotonic_ns() - start_ns) / 1e9);
+
+    remove_directory_files(".");
+    if (chdir(original_directory) || rmdir(run_directory))
+        fprintf(stderr, "Failed to clean up %s\n", run_directory);
+
+    bool is_intact = !has_failed_process && consumers.lost == 0 && consumers.out_of_order == 0 && consumers.corrupt == 0
+                     && consumers.unfinished_streams == 0 && producers.frames == consumers.frames + consumers.skipped;
+    printf("result: %s\n", is_intact ? "PASS" : "FAIL");
+    return is_intact ? 0 : 1;
+}
+
+static void print_usage(const char *program)
+{
+    fprintf(stderr, "usage: %s [-p producers] [-c consumers] [-s streams] [-r rate_hz] [-d seconds] [-z frame_size] [-q queue_depth]\n"
+                    "          [-t file_signal|file_rename|shm] [-w worker_threads] [-l] [-D directory]\n"
+                    "  -p/-c  producer and consumer processes, default %d/%d\n"
+                    "  -s     streams spread over them, default %d\n"
+                    "  -r     frames per second of every stream, 0 for as fast as possible, default %.0f\n"
+                    "  -d     how long the producers run, default %.0f s\n"
+                    "  -z     bytes per frame, default %d\n"
+                    "  -q     queue depth, default %d\n"
+                    "  -t     transport, default shm\n"
+                    "  -w     update worker threads of every process, default 0\n"
+                    "  -l     latest value streams, skipped frames are fine then\n"
+                    "  -D     directory the file streams are created in, default %s\n",
+            program, DEFAULT_PRODUCERS, DEFAULT_CONSUMERS, DEFAULT_STREAMS, DEFAULT_RATE_HZ, DEFAULT_SECONDS, DEFAULT_FRAME_SIZE,
+            DEFAULT_QUEUE_DEPTH, DEFAULT_DIRECTORY);
+}
+
+/**
+ * \return false if the name is not a known transport
+ */
+static bool parse_transport(const char *name)
+{
+    if (!strcmp(name, "file_signal"))
+        config.transport = FILE_SYSTEM_TRANSPORT, config.publication = SIGNAL_FILE_PUBLICATION;
+    else if (!strcmp(name, "file_rename"))
+        config.transport = FILE_SYSTEM_TRANSPORT, config.publication = RENAME_PUBLICATION;
+    else if (!strcmp(name, "shm"))
+        config.transport = SHARED_MEMORY_TRANSPORT, config.publication = SIGNAL_FILE_PUBLICATION;
+    else
+        return false;
+
+    config.transport_name = name;
+    return true;
+}
+
+/**
+ * Body of a forked producer or consumer, runs its streams until they are finished and reports
+ * \return exit status of the process
+ */
+static int run_process(bool is_producer, unsigned int process_index, int report_fd)
+{
+    Process_Report report;
+    memset(&report, 0, sizeof(report));
+    report.is_producer = is_producer;
+
+    stress_streams = calloc(config.streams, sizeof(Stress_Stream));
+    Fsc_Context *fsc = fsc_context_create();
+    if (stress_streams == NULL || fsc == NULL)
+    {
+        write_full(report_fd, &report, sizeof(report));
+        return 1;
+    }
+    set_latency_report_output(fsc, NULL);
+
+    int result = open_stress_streams(fsc, is_producer, process_index);
+    if (!result && config.worker_threads > 0 && set_update_worker_threads(fsc, config.worker_threads))
+        fprintf(stderr, "Failed to start update workers, running single threaded\n");
+
+    long long stop_ns = monotonic_ns() + (long long)(config.seconds * 1e9);
+    long long deadline_ns = stop_ns + DRAIN_TIMEOUT_NS;
+    if (is_producer)
+        signal(SIGTERM, stop_producing);
+
+    // latest value writers without a rate never wait for anything, they are updated as often as possible
+    int timeout_ms = is_producer && config.is_latest_value && config.rate_hz == 0 ? 0 : WAIT_TIMEOUT_MS;
+    while (!result && __atomic_load_n(&unfinished_streams, __ATOMIC_ACQUIRE) > 0 && monotonic_ns() < deadline_ns)
+    {
+        if (monotonic_ns() >= stop_ns)
+            is_stopping = 1;
+        wait_and_update_streams(fsc, timeout_ms);
+    }
+    // workers may still be in a callback, they are done once the pool is stopped
+    set_update_worker_threads(fsc, 0);
+
+    for (unsigned int index = 0; index < config.streams; index++)
+    {
+        Stress_Stream *stress_stream = &stress_streams[index];
+        if (stress_stream->first_frame_ns == 0)
+            continue; // not one of ours or never delivered anything
+
+        report.frames += is_producer ? stress_stream->sequence : stress_stream->frames;
+        report.lost += stress_stream->lost;
+        report.skipped += stress_stream->skipped;
+        report.out_of_order += stress_stream->out_of_order;
+        report.corrupt += stress_stream->corrupt;
+        if (report.first_frame_ns == 0 || stress_stream->first_frame_ns < report.first_frame_ns)
+            report.first_frame_ns = stress_stream->first_frame_ns;
+        if (stress_stream->last_frame_ns > report.last_frame_ns)
+            report.last_frame_ns = stress_stream->last_frame_ns;
+
+        // frames the consumer never saw because the stream did not finish count as lost
+        if (!is_producer && stress_stream->is_finished && stress_stream->total > stress_stream->frames + stress_stream->skipped + stress_stream->lost)
+            report.lost += stress_stream->total - stress_stream->frames - stress_stream->skipped - stress_stream->lost;
+
+        if (!is_producer && stress_stream->stream != NULL)
+        {
+            const Latency_Histogram *latency = get_stream_latency_histogram(stress_stream->stream, PUBLISH_TO_CONSUME_LATENCY);
+            if (latency != NULL)
+                latency_histogram_merge(&report.latency, latency);
+        }
+    }
+    report.unfinished_streams = __atomic_load_n(&unfinished_streams, __ATOMIC_ACQUIRE);
+
+    fsc_context_destroy(fsc);
+    free(stress_streams);
+
+    if (write_full(report_fd, &report, sizeof(report)))
+        return 1;
+    close(report_fd);
+    return result;
+}
+
+/**
+ * Creates the streams this process owns, stream s belongs to producer s % producers and consumer s % consumers
+ * \return non zero if a stream could not be created
+ */
+static int open_stress_streams(Fsc_Context *fsc, bool is_producer, unsigned int process_index)
+{
+    frame_descriptor = (Message_Descriptor){ STRESS_FRAME_TYPE_ID, (uint32_t)config.frame_size, "Stress_Frame", encode_frame, NULL };
+
+    Data_Stream_Options options = default_data_stream_options();
+    options.transport = config.transport;
+    options.publication = config.publication;
+    options.queue_depth = config.queue_depth;
+    options.frame_capacity = config.frame_size + sizeof(Typed_Frame_Header);
+    if (is_producer)
+        options.rate_hz = config.rate_hz;
+
+    enum Stream_type stream_type = config.is_latest_value ? (is_producer ? LATEST_VALUE_WRITE_STREAM : LATEST_VALUE_READ_STREAM)
+                                                          : (is_producer ? WRITE_ONLY_STREAM : READ_ONLY_STREAM);
+    unsigned int process_count = is_producer ? config.producers : config.consumers;
+
+    for (unsigned int index = process_index; index < config.streams; index += process_count)
+    {
+        char stream_name[MAX_NAME_LENGTH];
+        snprintf(stream_name, sizeof(stream_name), "stress_%d_%u", (int)harness_pid, index);
+
+        Stress_Stream *stress_stream = &stress_streams[index];
+        stress_stream->index = index;
+        stress_stream->stream = create_new_data_stream_with_options(fsc, stream_name, stream_type, is_producer ? producing_frame : consuming_frame, &options);
+        if (stress_stream->stream == NULL)
+        {
+            fprintf(stderr, "Failed to create stream %s\n", stream_name);
+            return 1;
+        }
+        unfinished_streams++;
+    }
+    return 0;
+}
+
+/**
+ * \return state of the stream, its index is the number at the end of its name
+ */
+static Stress_Stream *find_stress_stream(const Data_Stream *stream)
+{
+    const char *index = strrchr(stream->stream_name, '_');
+    if (index == NULL)
+        return NULL;
+
+    unsigned long number = strtoul(index + 1, NULL, 10);
+    return number < config.streams && stress_streams[number].stream == stream ? &stress_streams[number] : NULL;
+}
+
+/**
+ * Called by the framework whenever a producer stream is due, sends the next frame or, once the run time
+ * is over, the last frame and removes the stream
+ */
+static void producing_frame(Data_Stream *context)
+{
+    Stress_Stream *stress_stream = find_stress_stream(context);
+    if (stress_stream == NULL || stress_stream->is_finished)
+        return;
+
+    long long now_ns = monotonic_ns();
+    if (stress_stream->first_frame_ns == 0)
+        stress_stream->first_frame_ns = now_ns;
+    stress_stream->last_frame_ns = now_ns;
+
+    Stress_Frame frame = { stress_stream->index, 0, stress_stream->sequence, 0 };
+    if (is_stopping)
+    {
+        frame.flags = STRESS_LAST_FRAME;
+        frame.total = stress_stream->sequence + 1;
+    }
+    context->send_struct(context, &frame_descriptor, &frame);
+    stress_stream->sequence++;
+
+    if (is_stopping)
+    {
+        stress_stream->is_finished = true;
+        stress_stream->stream = NULL;
+        remove_data_stream(context);
+        __atomic_sub_fetch(&unfinished_streams, 1, __ATOMIC_RELEASE);
+    }
+}
+
+/**
+ * Called by the framework for every frame a consumer stream delivers
+ */
+static void consuming_frame(Data_Stream *context)
+{
+    Stress_Stream *stress_stream = find_stress_stream(context);
+    if (stress_stream == NULL || stress_stream->is_finished)
+        return;
+
+    long long now_ns = monotonic_ns();
+    if (stress_stream->first_frame_ns == 0)
+        stress_stream->first_frame_ns = now_ns;
+    stress_stream->last_frame_ns = now_ns;
+    stress_stream->frames++;
+
+    const char *data;
+    size_t length;
+    Typed_Frame_Header header;
+    if (context->read_frame(context, &data, &length) || length != sizeof(header) + config.frame_size)
+    {
+        stress_stream->corrupt++;
+        return;
+    }
+    memcpy(&header, data, sizeof(header));
+    if (header.type_id != STRESS_FRAME_TYPE_ID || header.length != config.frame_size)
+    {
+        stress_stream->corrupt++;
+        return;
+    }
+
+    const unsigned char *message = (const unsigned char *)data + sizeof(header);
+    Stress_Frame frame;
+    memcpy(&frame.stream_index, message, 4);
+    memcpy(&frame.flags, message + 4, 4);
+    memcpy(&frame.sequence, message + 8, 8);
+    memcpy(&frame.total, message + 16, 8);
+    check_frame(stress_stream, &frame, message + STRESS_FRAME_HEADER_SIZE, config.frame_size - STRESS_FRAME_HEADER_SIZE);
+
+    if (frame.flags & STRESS_LAST_FRAME)
+    {
+        stress_stream->total = frame.total;
+        stress_stream->is_finished = true;
+        __atomic_sub_fetch(&unfinished_streams, 1, __ATOMIC_RELEASE);
+    }
+}
+
+/**
+ * Compares a received frame with what its producer must have sent
+ */
+static void check_frame(Stress_Stream *stress_stream, const Stress_Frame *frame, const unsigned char *payload, size_t payload_size)
+{
+    if (frame->stream_index != stress_stream->index)
+    {
+        stress_stream->corrupt++;
+        return;
+    }
+
+    if (frame->sequence < stress_stream->sequence)
+    {
+        stress_stream->out_of_order++;
+        return;
+    }
+    if (frame->sequence > stress_stream->sequence)
+    {
+        // latest value readers are allowed to miss frames, the framework tells how many it skipped
+        if (config.is_latest_value)
+            stress_stream->skipped += frame->sequence - stress_stream->sequence;
+        else
+            stress_stream->lost += frame->sequence - stress_stream->sequence;
+    }
+    stress_stream->sequence = frame->sequence + 1;
+
+    unsigned char expected[payload_size > 0 ? payload_size : 1];
+    generate_payload(frame->stream_index, frame->sequence, expected, payload_size);
+    if (memcmp(expected, payload, payload_size))
+        stress_stream->corrupt++;
+}
+
+/**
+ * Encoder of the stress frame, fixed fields then the generated payload
+ */
+static void encode_frame(const void *message, unsigned char *payload)
+{
+    const Stress_Frame *frame = message;
+    memcpy(payload, &frame->stream_index, 4);
+    memcpy(payload + 4, &frame->flags, 4);
+    memcpy(payload + 8, &frame->sequence, 8);
+    memcpy(payload + 16, &frame->total, 8);
+    generate_payload(frame->stream_index, frame->sequence, payload + STRESS_FRAME_HEADER_SIZE, config.frame_size - STRESS_FRAME_HEADER_SIZE);
+}
+
+/**
+ * Fills the payload with xorshift noise seeded by stream and sequence, any bit flip or torn frame shows
+ */
+static void generate_payload(unsigned int stream_index, unsigned long long sequence, unsigned char *payload, size_t size)
+{
+    uint64_t state = ((uint64_t)stream_index << 40) ^ sequence ^ 0x9E3779B97F4A7C15ULL;
+    for (size_t offset = 0; offset < size; offset++)
+    {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        payload[offset] = (unsigned char)state;
+    }
+}
+
+/**
+ * Signal handler of producers, they send their last frames and finish early
+ */
+static void stop_producing(int signal_number)
+{
+    (void)signal_number;
+    is_stopping = 1;
+}
+
+/**
+ * Prints what the run achieved, one value per line so scripts can pick them up
+ */
+static void print_report(const Process_Report *producers, const Process_Report *consumers, long long cpu_ns, double elapsed)
+{
+    double seconds = (double)(consumers->last_frame_ns - consumers->first_frame_ns) / 1e9;
+
+    printf("frames sent:         %llu\n", producers->frames);
+    printf("frames received:     %llu\n", consumers->frames);
+    printf("frames skipped:      %llu\n", consumers->skipped);
+    printf("frames lost:         %llu\n", consumers->lost);
+    printf("frames out of order: %llu\n", consumers->out_of_order);
+    printf("frames corrupt:      %llu\n", consumers->corrupt);
+    printf("unfinished streams:  %llu\n", consumers->unfinished_streams);
+    printf("throughput:          %.0f frames/s, %.3f MB/s\n", seconds > 0 ? (double)consumers->frames / seconds : 0,
+           seconds > 0 ? (double)consumers->frames * (double)config.frame_size / seconds / 1e6 : 0);
+    printf("cpu per frame:       %.2f us (all processes, %.2f s cpu in %.2f s)\n",
+           consumers->frames > 0 ? (double)cpu_ns / 1000 / (double)consumers->frames : 0, (double)cpu_ns / 1e9, elapsed);
+    printf("latency p50:         %.1f us\n", (double)latency_histogram_percentile(&consumers->latency, 50) / 1000);
+    printf("latency p99:         %.1f us\n", (double)latency_histogram_percentile(&consumers->latency, 99) / 1000);
+    printf("latency p99.9:       %.1f us\n", (double)latency_histogram_percentile(&consumers->latency, 99.9) / 1000);
+    printf("latency max:         %.1f us\n", (double)consumers->latency.max / 1000);
+}
+
+/**
+ * Removes every file of the run directory, data, flag, ack and temporary files of the streams
+ */
+static void remove_directory_files(const char *directory)
+{
+    DIR *listing = opendir(directory);
+    if (listing == NULL)
+        return;
+
+    struct dirent *entry;
+    while ((entry = readdir(listing)) != NULL)
+        if (strcmp(entry->d_name, ".") && strcmp(entry->d_name, ".."))
+            unlink(entry->d_name);
+    closedir(listing);
+}
+
+/**
+ * \return non zero if not all bytes could be written
+ */
+static int write_full(int fd, const void *data, size_t size)
+{
+    const char *bytes = data;
+    while (size > 0)
+    {
+        ssize_t written = write(fd, bytes, size);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written <= 0)
+            return 1;
+        bytes += written;
+        size -= (size_t)written;
+    }
+    return 0;
+}
+
+/**
+ * \return non zero if the other end closed before size bytes arrived
+ */
+static int read_full(int fd, void *data, size_t size)
+{
+    char *bytes = data;
+    while (size > 0)
+    {
+        ssize_t count = read(fd, bytes, size);
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count <= 0)
+            return 1;
+        bytes += count;
+        size -= (size_t)count;
+    }
+    return 0;
+}
+
+static long long monotonic_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+static long long timeval_ns(struct timeval time)
+{
+    return (long long)time.tv_sec * 1000000000LL + (long long)time.tv_usec * 1000LL;
+}
@@ -0,0 +1,145 @@
+/*******************************************************************************
+ * Title                 :   Latency Histogram
+ * Filename              :   latency_histogram.c
+ * Author                :   Dominic
+ * Origin Date           :   17/10/2026
+ * Version               :   0.0.1
+ * Notes                 :   Values below LATENCY_HISTOGRAM_SUB_BUCKETS get a bucket each, above that
+ *                           the bucket is picked by the position of the highest set bit and the
+ *                           LATENCY_HISTOGRAM_SUB_BUCKET_BITS bits following it.
+ *                           Percentiles report the highest value of their bucket, like HdrHistogram.
+ *******************************************************************************/
+
+#include <string.h>
+#include "latency_histogram.h"
+
+static unsigned int _bucket_index(uint64_t value);
+static uint64_t _bucket_highest_value(unsigned int index);
+
+/**
+ * Empties the histogram
+ */
+void latency_histogram_reset(Latency_Histogram *histogram)
+{
+    memset(histogram, 0, sizeof(*histogram));
+}
+
+/**
+ * Adds one sample
+ * \param value latency in nanoseconds
+ */
+void latency_histogram_record(Latency_Histogram *histogram, uint64_t value)
+{
+    if (histogram->count == 0 || value < histogram->min)
+        histogram->min = value;
+    if (value > histogram->max)
+        histogram->max = value;
+
+    histogram->count++;
+    histogram->sum += value;
+    histogram->buckets[_bucket_index(value)]++;
+}
+
+/**
+ * Adds every sample of other, e.g. to get one histogram over several streams
+ */
+void latency_histogram_merge(Latency_Histogram *histogram, const Latency_Histogram *other)
+{
+    if (other->count == 0)
+        return;
+
+    if (histogram->count == 0 || other->min < histogram->min)
+        histogram->min = other->min;
+    if (other->max > histogram->max)
+        histogram->max = other->max;
+
+    histogram->count += other->count;
+    histogram->sum += other->sum;
+    for (unsigned int index = 0; index < LATENCY_HISTOGRAM_BUCKETS; index++)
+        histogram->buckets[index] += other->buckets[index];
+}
+
+/**
+ * \param percentile 0 to 100, e.g. 99.9
+ * \return value at or below which the given share of samples lies, 0 if the histogram is empty
+ */
+uint64_t latency_histogram_percentile(const Latency_Histogram *histogram, double percentile)
+{
+    if (histogram->count == 0)
+        return 0;
+    if (percentile >= 100)
+        return histogram->max;
+    if (percentile <= 0)
+        return histogram->min;
+
+    // rank of the sample we are looking for, rounded up
+    double target = percentile / 100 * (double)histogram->count;
+    uint64_t rank = (uint64_t)target;
+    if ((double)rank < target || rank == 0)
+        rank++;
+
+    uint64_t seen = 0;
+    for (unsigned int index = 0; index < LATENCY_HISTOGRAM_BUCKETS; index++)
+    {
+        seen += histogram->buckets[index];
+        if (seen >= rank)
+        {
+            uint64_t value = _bucket_highest_value(index);
+            return value < histogram->max ? value : histogram->max;
+        }
+    }
+    return histogram->max;
+}
+
+/**
+ * Prints count, mean and the usual percentiles in microseconds on one line
+ * \param name what was measured, printed in front
+ */
+void latency_histogram_print(const Latency_Histogram *histogram, const char *name, FILE *output)
+{
+    if (histogram->count == 0)
+    {
+        fprintf(output, "  %-20s no samples\n", name);
+        return;
+    }
+
+    fprintf(output, "  %-20s %8llu samples, mean %.1f, p50 %.1f, p90 %.1f, p99 %.1f, p99.9 %.1f, max %.1f us\n", name,
+            (unsigned long long)histogram->count,
+            (double)histogram->sum / (double)histogram->count / 1000,
+            (double)latency_histogram_percentile(histogram, 50) / 1000,
+            (double)latency_histogram_percentile(histogram, 90) / 1000,
+            (double)latency_histogram_percentile(histogram, 99) / 1000,
+            (double)latency_histogram_percentile(histogram, 99.9) / 1000,
+            (double)histogram->max / 1000);
+}
+
+/**
+ * Bucket of given value, see the notes at the top
+ */
+static unsigned int _bucket_index(uint64_t value)
+{
+    if (value < LATENCY_HISTOGRAM_SUB_BUCKETS)
+        return (unsigned int)value;
+
+    unsigned int exponent = 63 - (unsigned int)__builtin_clzll(value);
+    if (exponent > LATENCY_HISTOGRAM_MAX_EXPONENT - 1)
+        return LATENCY_HISTOGRAM_BUCKETS - 1;
+
+    unsigned int shift = exponent - LATENCY_HISTOGRAM_SUB_BUCKET_BITS;
+    unsigned int sub_bucket = (unsigned int)(value >> shift) & (LATENCY_HISTOGRAM_SUB_BUCKETS - 1);
+    return LATENCY_HISTOGRAM_SUB_BUCKETS + shift * LATENCY_HISTOGRAM_SUB_BUCKETS + sub_bucket;
+}
+
+/**
+ * Highest value that still lands in given bucket
+ */
+static uint64_t _bucket_highest_value(unsigned int index)
+{
+    if (index < LATENCY_HISTOGRAM_SUB_BUCKETS)
+        return index;
+
+    unsigned int shift = (index - LATENCY_HISTOGRAM_SUB_BUCKETS) / LATENCY_HISTOGRAM_SUB_BUCKETS;
+    uint64_t sub_bucket = (index - LATENCY_HISTOGRAM_SUB_BUCKETS) % LATENCY_HISTOGRAM_SUB_BUCKETS;
+    uint64_t lowest = (LATENCY_HISTOGRAM_SUB_BUCKETS + sub_bucket) << shift;
+    return lowest + ((uint64_t)1 << shift) - 1;
+}
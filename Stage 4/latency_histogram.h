@@ -0,0 +1,39 @@
+/****************************************************************************
+* Title                 :   Latency Histogram
+* Filename              :   latency_histogram.h
+* Author                :   Dominic
+* Origin Date           :   17/10/2026
+* Version               :   0.0.1
+* Notes                 :   HDR style log-linear histogram of nanosecond latencies.
+*                           Every power of two is split into LATENCY_HISTOGRAM_SUB_BUCKETS linear
+*                           buckets, so any recorded value is known within about 3% no matter
+*                           if it is 200 ns or 20 s, at a fixed 8 KB and an O(1) record.
+*****************************************************************************/
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define LATENCY_HISTOGRAM_SUB_BUCKET_BITS 5
+#define LATENCY_HISTOGRAM_SUB_BUCKETS (1u << LATENCY_HISTOGRAM_SUB_BUCKET_BITS)
+// values from 2^36 ns (about 68 s) up all land in the last bucket, max still holds the exact value
+#define LATENCY_HISTOGRAM_MAX_EXPONENT 36
+#define LATENCY_HISTOGRAM_BUCKETS (LATENCY_HISTOGRAM_SUB_BUCKETS * (LATENCY_HISTOGRAM_MAX_EXPONENT - LATENCY_HISTOGRAM_SUB_BUCKET_BITS + 1))
+
+typedef struct Latency_Histogram
+{
+    uint64_t count;
+    uint64_t min;
+    uint64_t max;
+    uint64_t sum;           // for the mean
+    uint64_t buckets[LATENCY_HISTOGRAM_BUCKETS];
+} Latency_Histogram;
+
+void latency_histogram_reset(Latency_Histogram *histogram);
+void latency_histogram_record(Latency_Histogram *histogram, uint64_t value);
+void latency_histogram_merge(Latency_Histogram *histogram, const Latency_Histogram *other);
+uint64_t latency_histogram_percentile(const Latency_Histogram *histogram, double percentile);
+void latency_histogram_print(const Latency_Histogram *histogram, const char *name, FILE *output);
+
+#endif
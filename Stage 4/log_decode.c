@@ -0,0 +1,46 @@
+/*******************************************************************************
+ * Title                 :   Binary log decoder
+ * Filename              :   log_decode.c
+ * Author                :   Dominic
+ * Origin Date           :   17/10/2026
+ * Version               :   0.0.1
+ * Notes                 :   Renders logs written by record_binary_log as text, one line per entry
+ *                           prefixed with its wall clock time. The format strings come from the
+ *                           definition records inside the log itself, so no table has to be shipped.
+ *
+ *                           usage: log_decode [binary_log ...]   (default system_log.bin, - for stdin)
+ *******************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include "mutex_logging.h"
+
+int main(int argc, char *argv[])
+{
+    int result = 0;
+
+    const char *default_path = BINARY_LOG_FILE_NAME;
+    const char *const *paths = argc > 1 ? (const char *const *)argv + 1 : &default_path;
+    int path_count = argc > 1 ? argc - 1 : 1;
+
+    for (int index = 0; index < path_count; index++)
+    {
+        if (!strcmp(paths[index], "-"))
+        {
+            result |= decode_binary_log(stdin, stdout);
+            continue;
+        }
+
+        FILE *input = fopen(paths[index], "rb");
+        if (input == NULL)
+        {
+            fprintf(stderr, "Failed to open %s\n", paths[index]);
+            result = 1;
+            continue;
+        }
+        result |= decode_binary_log(input, stdout);
+        fclose(input);
+    }
+
+    return result;
+}
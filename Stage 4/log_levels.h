@@ -0,0 +1,31 @@
+/****************************************************************************
+* Title                 :   Log Levels
+* Filename              :   log_levels.h
+* Author                :   Dominic
+* Origin Date           :   17/10/2026
+* Version               :   0.0.1
+* Notes                 :   Severities shared by mutex_logging and the File System Communication
+*                           framework. LOG_COMPILE_LEVEL is the lowest severity compiled in, calls below
+*                           it are removed by the preprocessor together with their arguments.
+*                           Defaults to LOG_LEVEL_DEBUG, LOG_LEVEL_INFO when NDEBUG is defined,
+*                           set it with -DLOG_COMPILE_LEVEL=LOG_LEVEL_WARNING (make LOG_LEVEL=WARNING).
+*****************************************************************************/
+#ifndef LOG_LEVELS_H
+#define LOG_LEVELS_H
+
+// plain numbers so #if can compare them
+#define LOG_LEVEL_DEBUG 0
+#define LOG_LEVEL_INFO 1
+#define LOG_LEVEL_WARNING 2
+#define LOG_LEVEL_ERROR 3
+#define LOG_LEVEL_NONE 4
+
+#ifndef LOG_COMPILE_LEVEL
+#ifdef NDEBUG
+#define LOG_COMPILE_LEVEL LOG_LEVEL_INFO
+#else
+#define LOG_COMPILE_LEVEL LOG_LEVEL_DEBUG
+#endif
+#endif
+
+#endif
@@ -0,0 +1,446 @@
+/*******************************************************************************
+ * Title                 :   Log shard merger
+ * Filename              :   log_merge.c
+ * Author                :   Dominic
+ * Origin Date           :   17/10/2026
+ * Version               :   0.0.1
+ * Notes                 :   Merges the shards written in sharded mode (start_sharded_logging) into one
+ *                           time ordered view. Every shard is read as a stream, one entry at a time,
+ *                           and a min heap picks the entry with the lowest CLOCK_MONOTONIC stamp,
+ *                           so memory stays the same however long the shards are.
+ *                           Text shards and binary shards (rendered like log_decode) are merged together,
+ *                           rotated segments (.000001, .gz) are read in order before the file they came from.
+ *                           Every line is tagged with the pid of its shard.
+ *
+ *                           usage: log_merge [shard ...]   (default every shard in the working directory)
+ *******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ctype.h>
+#include <limits.h>
+#include <dirent.h>
+#include <zlib.h>
+#include "mutex_logging.h"
+
+// longest line of a text shard, longer ones are read as continuation lines
+#define MERGE_LINE_SIZE (2 * LOG_MESSAGE_SIZE)
+// longest entry, a stamped line with its continuation lines, longer ones are cut
+#define MERGE_ENTRY_SIZE (4 * LOG_MESSAGE_SIZE)
+#define MERGE_TAG_SIZE 64
+
+// one file on the command line or in the directory
+typedef struct Merge_Path {
+    char *path;
+    size_t key_length;          // length of the log file it belongs to, its segments share it
+    unsigned int segment;       // number of the segment, UINT_MAX for the file that is still written
+} Merge_Path;
+
+// a shard, read one entry ahead
+typedef struct Merge_Shard {
+    Merge_Path *paths;          // segments in order, then the file itself
+    size_t path_count;
+    size_t next_path;
+    FILE *input;
+    bool is_binary;
+    Log_Decoder *decoder;       // binary shards, keeps the definitions across segments
+    bool is_clock_warned;
+    char tag[MERGE_TAG_SIZE];
+    char line[MERGE_LINE_SIZE]; // text shards, line read ahead
+    bool has_line;
+    unsigned long long timestamp_ns;
+    char entry[MERGE_ENTRY_SIZE];
+} Merge_Shard;
+
+static size_t find_shard_files(Merge_Path **paths);
+static bool is_shard_file(const char *name);
+static bool add_merge_path(Merge_Path **paths, size_t *count, const char *path);
+static int compare_merge_paths(const void *first, const void *second);
+static void name_shard(Merge_Shard *shard);
+static bool read_shard_entry(Merge_Shard *shard);
+static bool read_text_entry(Merge_Shard *shard);
+static bool read_shard_line(Merge_Shard *shard);
+static const char *parse_line_stamp(const char *line, unsigned long long *timestamp_ns);
+static bool open_next_shard_file(Merge_Shard *shard);
+static FILE *open_compressed(const char *path);
+static ssize_t read_compressed(void *cookie, char *buffer, size_t size);
+static int close_compressed(void *cookie);
+static bool is_earlier(const Merge_Shard *shards, size_t first, size_t second);
+static void sift_down(const Merge_Shard *shards, size_t *heap, size_t count, size_t position);
+
+int main(int argc, char *argv[])
+{
+    Merge_Path *paths = NULL;
+    size_t path_count = 0;
+    if (argc > 1)
+    {
+        for (int index = 1; index < argc; index++)
+            if (!add_merge_path(&paths, &path_count, argv[index]))
+                return 1;
+    }
+    else
+        path_count = find_shard_files(&paths);
+
+    if (path_count == 0)
+    {
+        fprintf(stderr, "No log shards found, start_sharded_logging writes %s<pid>%s\n", LOG_SHARD_PREFIX, LOG_SHARD_SUFFIX);
+        return 1;
+    }
+
+    // segments of a file come right before it
+    qsort(paths, path_count, sizeof(Merge_Path), compare_merge_paths);
+
+    Merge_Shard *shards = calloc(path_count, sizeof(Merge_Shard));
+    size_t *heap = malloc(path_count * sizeof(size_t));
+    if (shards == NULL || heap == NULL)
+    {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+
+    size_t shard_count = 0;
+    for (size_t index = 0; index < path_count; index++)
+    {
+        Merge_Shard *shard = &shards[shard_count];
+        if (shard->path_count > 0 && (paths[index].key_length != shard->paths->key_length
+            || strncmp(paths[index].path, shard->paths->path, paths[index].key_length)))
+            shard = &shards[++shard_count];
+        if (shard->path_count == 0)
+            shard->paths = &paths[index];
+        shard->path_count++;
+    }
+    shard_count++;
+
+    // every shard with an entry goes on the heap
+    int result = 0;
+    size_t heap_count = 0;
+    for (size_t index = 0; index < shard_count; index++)
+    {
+        Merge_Shard *shard = &shards[index];
+        name_shard(shard);
+        if (shard->is_binary && (shard->decoder = create_log_decoder()) == NULL)
+        {
+            fprintf(stderr, "Out of memory\n");
+            result = 1;
+            continue;
+        }
+        if (read_shard_entry(shard))
+            heap[heap_count++] = index;
+    }
+    for (size_t position = heap_count / 2; position-- > 0;)
+        sift_down(shards, heap, heap_count, position);
+
+    while (heap_count > 0)
+    {
+        Merge_Shard *shard = &shards[heap[0]];
+        printf("[%llu.%09llu] [%s] %s\n", shard->timestamp_ns / 1000000000ULL, shard->timestamp_ns % 1000000000ULL, shard->tag, shard->entry);
+
+        if (!read_shard_entry(shard))
+            heap[0] = heap[--heap_count];
+        sift_down(shards, heap, heap_count, 0);
+    }
+
+    for (size_t index = 0; index < shard_count; index++)
+        free_log_decoder(shards[index].decoder);
+    for (size_t index = 0; index < path_count; index++)
+        free(paths[index].path);
+    free(heap);
+    free(shards);
+    free(paths);
+    return result;
+}
+
+/**
+ * Finds the shards and their segments in the working directory
+ * \return number of paths found
+ */
+static size_t find_shard_files(Merge_Path **paths)
+{
+    size_t count = 0;
+    DIR *directory = opendir(".");
+    if (directory == NULL)
+        return 0;
+
+    struct dirent *entry;
+    while ((entry = readdir(directory)) != NULL)
+    {
+        if (is_shard_file(entry->d_name) && !add_merge_path(paths, &count, entry->d_name))
+            break;
+    }
+    closedir(directory);
+    return count;
+}
+
+/**
+ * \return true for system_log.<pid>.txt and .bin, their segments and compressed segments
+ */
+static bool is_shard_file(const char *name)
+{
+    size_t prefix_length = strlen(LOG_SHARD_PREFIX);
+    if (strncmp(name, LOG_SHARD_PREFIX, prefix_length))
+        return false;
+
+    size_t pid_length = strspn(name + prefix_length, "0123456789");
+    const char *suffix = name + prefix_length + pid_length;
+    if (pid_length == 0)
+        return false;
+
+    const char *suffixes[] = { LOG_SHARD_SUFFIX, BINARY_LOG_SHARD_SUFFIX };
+    for (size_t index = 0; index < sizeof(suffixes) / sizeof(suffixes[0]); index++)
+    {
+        size_t suffix_length = strlen(suffixes[index]);
+        if (strncmp(suffix, suffixes[index], suffix_length))
+            continue;
+
+        // the file itself, or a segment of it
+        const char *segment = suffix + suffix_length;
+        if (*segment == '\0')
+            return true;
+        size_t number_length = *segment == '.' ? strspn(segment + 1, "0123456789") : 0;
+        return number_length > 0 && (segment[1 + number_length] == '\0' || !strcmp(segment + 1 + number_length, ".gz"));
+    }
+    return false;
+}
+
+/**
+ * Adds a path, a trailing .gz and segment number are split off so segments sort with their file
+ * \return false if out of memory
+ */
+static bool add_merge_path(Merge_Path **paths, size_t *count, const char *path)
+{
+    Merge_Path *grown = realloc(*paths, (*count + 1) * sizeof(Merge_Path));
+    if (grown == NULL || (grown[*count].path = strdup(path)) == NULL)
+    {
+        fprintf(stderr, "Out of memory\n");
+        if (grown != NULL)
+            *paths = grown;
+        return false;
+    }
+    *paths = grown;
+
+    Merge_Path *entry = &grown[(*count)++];
+    size_t length = strlen(path);
+    if (length > 3 && !strcmp(path + length - 3, ".gz"))
+        length -= 3;
+
+    size_t number_start = length;
+    while (number_start > 0 && isdigit((unsigned char)path[number_start - 1]))
+        number_start--;
+
+    entry->key_length = strlen(path);
+    entry->segment = UINT_MAX;
+    if (number_start < length && number_start > 0 && path[number_start - 1] == '.')
+    {
+        entry->key_length = number_start - 1;
+        entry->segment = (unsigned int)strtoul(path + number_start, NULL, 10);
+    }
+    return true;
+}
+
+// by log file, then by segment
+static int compare_merge_paths(const void *first, const void *second)
+{
+    const Merge_Path *first_path = first;
+    const Merge_Path *second_path = second;
+
+    size_t shorter = first_path->key_length < second_path->key_length ? first_path->key_length : second_path->key_length;
+    int order = strncmp(first_path->path, second_path->path, shorter);
+    if (order != 0)
+        return order;
+    if (first_path->key_length != second_path->key_length)
+        return first_path->key_length < second_path->key_length ? -1 : 1;
+    return (first_path->segment > second_path->segment) - (first_path->segment < second_path->segment);
+}
+
+/**
+ * Tags the shard with the pid in its name, other files with their name
+ */
+static void name_shard(Merge_Shard *shard)
+{
+    const char *path = shard->paths->path;
+    size_t key_length = shard->paths->key_length;
+    const char *name = strrchr(path, '/') != NULL ? strrchr(path, '/') + 1 : path;
+    size_t name_length = key_length - (size_t)(name - path);
+
+    size_t suffix_length = strlen(BINARY_LOG_SHARD_SUFFIX);
+    shard->is_binary = name_length >= suffix_length && !strncmp(name + name_length - suffix_length, BINARY_LOG_SHARD_SUFFIX, suffix_length);
+
+    size_t prefix_length = strlen(LOG_SHARD_PREFIX);
+    if (!strncmp(name, LOG_SHARD_PREFIX, prefix_length) && isdigit((unsigned char)name[prefix_length]))
+        snprintf(shard->tag, sizeof(shard->tag), "%.*s", (int)strspn(name + prefix_length, "0123456789"), name + prefix_length);
+    else
+        snprintf(shard->tag, sizeof(shard->tag), "%.*s", (int)name_length, name);
+}
+
+/**
+ * Reads the next entry of the shard, going on with its next file at the end of one
+ * \return false once every file of the shard is read
+ */
+static bool read_shard_entry(Merge_Shard *shard)
+{
+    for (;;)
+    {
+        if (shard->input == NULL && !open_next_shard_file(shard))
+            return false;
+
+        if (!shard->is_binary)
+        {
+            if (read_text_entry(shard))
+                return true;
+        }
+        else
+        {
+            Log_Entry entry;
+            if (read_binary_log_entry(shard->decoder, shard->input, &entry) > 0)
+            {
+                if (!entry.is_monotonic && !shard->is_clock_warned)
+                {
+                    fprintf(stderr, "%s is not a shard, its wall clock times do not line up with the shards\n", shard->paths->path);
+                    shard->is_clock_warned = true;
+                }
+                shard->timestamp_ns = entry.timestamp_ns;
+                snprintf(shard->entry, sizeof(shard->entry), "%s", entry.line);
+                return true;
+            }
+        }
+
+        fclose(shard->input);
+        shard->input = NULL;
+    }
+}
+
+/**
+ * Reads a stamped line and the lines without stamp after it, which continue its message
+ * \return false at the end of the file
+ */
+static bool read_text_entry(Merge_Shard *shard)
+{
+    // a file starts with an empty line, a message is written after its newline
+    while (!shard->has_line || parse_line_stamp(shard->line, NULL) == NULL)
+    {
+        if (!read_shard_line(shard))
+            return false;
+    }
+
+    const char *message = parse_line_stamp(shard->line, &shard->timestamp_ns);
+    snprintf(shard->entry, sizeof(shard->entry), "%s", message);
+    shard->has_line = false;
+
+    size_t length = strlen(shard->entry);
+    while (read_shard_line(shard) && parse_line_stamp(shard->line, NULL) == NULL)
+    {
+        length += (size_t)snprintf(shard->entry + length, sizeof(shard->entry) - length, "\n%s", shard->line);
+        if (length >= sizeof(shard->entry))
+            length = sizeof(shard->entry) - 1;
+        shard->has_line = false;
+    }
+    return true;
+}
+
+/**
+ * Reads the next line of the current file into shard->line without its newline
+ * \return false at the end of the file
+ */
+static bool read_shard_line(Merge_Shard *shard)
+{
+    shard->has_line = fgets(shard->line, sizeof(shard->line), shard->input) != NULL;
+    if (shard->has_line)
+        shard->line[strcspn(shard->line, "\n")] = '\0';
+    return shard->has_line;
+}
+
+/**
+ * \param timestamp_ns filled with the stamp, can be NULL
+ * \return message after the "[seconds.nanoseconds] " stamp of a shard line, NULL if the line has none
+ */
+static const char *parse_line_stamp(const char *line, unsigned long long *timestamp_ns)
+{
+    unsigned long long seconds;
+    unsigned long long nanoseconds;
+    int length = 0;
+    if (line[0] != '[' || sscanf(line, "[%llu.%9llu] %n", &seconds, &nanoseconds, &length) != 2 || length == 0)
+        return NULL;
+
+    if (timestamp_ns != NULL)
+        *timestamp_ns = seconds * 1000000000ULL + nanoseconds;
+    return line + length;
+}
+
+/**
+ * Opens the next file of the shard
+ * \return false if there is none left
+ */
+static bool open_next_shard_file(Merge_Shard *shard)
+{
+    while (shard->next_path < shard->path_count)
+    {
+        const char *path = shard->paths[shard->next_path++].path;
+        shard->input = open_compressed(path);
+        shard->has_line = false;
+        if (shard->input != NULL)
+            return true;
+        fprintf(stderr, "Failed to open %s\n", path);
+    }
+    return false;
+}
+
+/**
+ * Opens a file for reading through zlib, which reads uncompressed files as they are
+ * \return stream of the file, NULL if it could not be opened
+ */
+static FILE *open_compressed(const char *path)
+{
+    gzFile compressed = gzopen(path, "rb");
+    if (compressed == NULL)
+        return NULL;
+
+    cookie_io_functions_t functions = { read_compressed, NULL, NULL, close_compressed };
+    FILE *input = fopencookie(compressed, "r", functions);
+    if (input == NULL)
+        gzclose(compressed);
+    return input;
+}
+
+static ssize_t read_compressed(void *cookie, char *buffer, size_t size)
+{
+    int length = gzread(cookie, buffer, size > INT_MAX ? INT_MAX : (unsigned int)size);
+    return length < 0 ? -1 : length;
+}
+
+static int close_compressed(void *cookie)
+{
+    return gzclose(cookie) == Z_OK ? 0 : EOF;
+}
+
+// lower stamp first, the shard given first on equal stamps
+static bool is_earlier(const Merge_Shard *shards, size_t first, size_t second)
+{
+    if (shards[first].timestamp_ns != shards[second].timestamp_ns)
+        return shards[first].timestamp_ns < shards[second].timestamp_ns;
+    return first < second;
+}
+
+static void sift_down(const Merge_Shard *shards, size_t *heap, size_t count, size_t position)
+{
+    for (;;)
+    {
+        size_t earliest = position;
+        size_t left = 2 * position + 1;
+        size_t right = left + 1;
+        if (left < count && is_earlier(shards, heap[left], heap[earliest]))
+            earliest = left;
+        if (right < count && is_earlier(shards, heap[right], heap[earliest]))
+            earliest = right;
+        if (earliest == position)
+            return;
+
+        size_t swapped = heap[position];
+        heap[position] = heap[earliest];
+        heap[earliest] = swapped;
+        position = earliest;
+    }
+}
@@ -0,0 +1,69 @@
+/****************************************************************************
+* Title                 :   Message Schema
+* Filename              :   message_schema.h
+* Author                :   Dominic
+* Origin Date           :   17/10/2026
+* Version               :   0.0.1
+* Notes                 :   X-macro helpers for binary typed frames. A message is declared once
+*                           as a list of FIELD(type, name) entries, DECLARE_MESSAGE turns it into a
+*                           struct, DEFINE_MESSAGE into its encoder, decoder and Message_Descriptor
+*                           used by send_struct/read_struct of the File System Communication framework.
+*                           Fields are copied with memcpy in declaration order without padding,
+*                           in host byte order, so values arrive bit exact between processes of one machine.
+*****************************************************************************/
+#ifndef MESSAGE_SCHEMA_H
+#define MESSAGE_SCHEMA_H
+
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * Everything the framework needs to know about one message type
+ */
+typedef struct Message_Descriptor
+{
+    uint32_t type_id;       // unique within the program, checked by read_struct
+    uint32_t wire_size;     // bytes of the encoded payload
+    const char *name;
+    void (*encode)(const void *message, unsigned char *payload);
+    void (*decode)(const unsigned char *payload, void *message);
+} Message_Descriptor;
+
+/**
+ * Written in front of every message inside a frame, a frame can hold several messages
+ */
+typedef struct Typed_Frame_Header
+{
+    uint32_t type_id;
+    uint32_t length;        // payload bytes following the header
+} Typed_Frame_Header;
+
+#define MESSAGE_SCHEMA_STRUCT_FIELD(type, name) type name;
+#define MESSAGE_SCHEMA_FIELD_SIZE(type, name) + sizeof(type)
+#define MESSAGE_SCHEMA_ENCODE_FIELD(type, name) memcpy(payload, &typed->name, sizeof(type)); payload += sizeof(type);
+#define MESSAGE_SCHEMA_DECODE_FIELD(type, name) memcpy(&typed->name, payload, sizeof(type)); payload += sizeof(type);
+
+/**
+ * Declares struct <name> and its <name>_descriptor, use in headers
+ */
+#define DECLARE_MESSAGE(name, type_id, FIELDS) \
+    typedef struct name { FIELDS(MESSAGE_SCHEMA_STRUCT_FIELD) } name; \
+    extern const Message_Descriptor name##_descriptor;
+
+/**
+ * Defines encoder, decoder and descriptor of the message, use in exactly one .c file
+ */
+#define DEFINE_MESSAGE(name, type_id, FIELDS) \
+    static void name##_encode(const void *message, unsigned char *payload) \
+    { \
+        const name *typed = message; \
+        FIELDS(MESSAGE_SCHEMA_ENCODE_FIELD) \
+    } \
+    static void name##_decode(const unsigned char *payload, void *message) \
+    { \
+        name *typed = message; \
+        FIELDS(MESSAGE_SCHEMA_DECODE_FIELD) \
+    } \
+    const Message_Descriptor name##_descriptor = { type_id, (uint32_t)(0 FIELDS(MESSAGE_SCHEMA_FIELD_SIZE)), #name, name##_encode, name##_decode };
+
+#endif
@@ -3,22 +3,25 @@
  * Stage 2: Two-way two process IPC
  * Created by: Dominic, Karl
  *
- * This acts as the data consumer (Navigation Planner).
- * 1. Waits for the sender (Process A) to signal data is ready (by checking for data_ready.flag).
- * 2. Deletes the data_ready.flag (consumes the signal).
- * 3. Reads the data from lidar_data.txt.
- * 4. Repeats in a loop.
+ * This acts as the data consumer (Motor Controller).
+ * 1. Reads the newest Motor_Command from the motor_commands latest value file stream (read_struct),
+ *    commands we were too slow for are skipped.
+ * 2. Repeats until SIGINT/SIGTERM, then closes the stream and stops the sharded logging.
  *
  * This is over engineered implementation of the stage 2 solution for receiver.
  * All the file manipulation and data management is abstracted away and handled by file_system_communication.c
- * It gives us ability to send data, manage multiple sending and reading streams
- * and prevents race conditions by using flags and acs
+ * through a Fsc_Context, it gives us ability to send and read data over files or shared memory
+ * and manage multiple sending and reading streams
  */
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
+#include <signal.h>
 #include "file_system_communication.h"
+#include "robot_messages.h"
+// tag of our log lines, has to come before mutex_logging.h
+#define LOG_MODULE "Motor ctrl"
 #include "mutex_logging.h"
 
 //cross-platform sleep
@@ -35,44 +38,84 @@
 //polling interval (ms)
 #define POLL_INTERVAL_MS 1000
 
-void main_loop();
+// cleared by SIGINT/SIGTERM, the main loop ends and the streams get closed properly
+static volatile sig_atomic_t is_running = 1;
+
+void main_loop(Fsc_Context *fsc);
+void stop_running(int signal_number);
 void receiving_data(Data_Stream *context);
 
 int main()
 {
     //seeding RNG
     srand(time(NULL));
+
+    // Ctrl+C stops the main loop instead of killing us, so the stream latencies get reported on close
+    signal(SIGINT, stop_running);
+    signal(SIGTERM, stop_running);
+
+    // log lines from the callbacks are only queued, every program writes its own shard (system_log.<pid>.txt) without
+    // waiting on the others, log_merge puts the shards back into one timeline
+    if(start_sharded_logging()){
+        fprintf(stderr, "Failed to start sharded logging, logging synchronously\n");
+    }
+
+    // every stream of this process lives in this context
+    Fsc_Context *fsc = fsc_context_create();
+    if(fsc == NULL){
+        fprintf(stderr, "We failed to create the framework context!\n");
+        log_error("We failed to create the framework context!");
+        return 1;
+    }
+
+    // FSC_TRACE_FILE=trace.json puts every callback into a Chrome trace, all three programs can share the file
+    const char *trace_path = getenv("FSC_TRACE_FILE");
+    if(trace_path != NULL && set_trace_output(fsc, trace_path, "motor_ctrl")){
+        fprintf(stderr, "Failed to open trace file %s, running without tracing\n", trace_path);
+    }
     
     // We create the sending data stream with name sensor_lidar, and pass our handle function to the event handler
-    if(create_new_data_stream(MOTOR_STREAM_NAME, READ_ONLY_STREAM, receiving_data)){
+    // only the newest command matters, commands we were too slow for are skipped
+    if(create_new_data_stream(fsc, MOTOR_STREAM_NAME, LATEST_VALUE_READ_STREAM, receiving_data) == NULL){
         fprintf(stderr, "We failed to create new motor Read stream\n");
-        record_log("[Motor ctrl]: We failed to create new motor Read stream");
+        log_error("We failed to create new motor Read stream");
         return 1;
     }
 
     fprintf(stdout, "Process C (motor_ctrl) started.\n");
-    record_log("[Motor ctrl]: Process C (motor_ctrl) started.");
+    log_info("Process C (motor_ctrl) started.");
     fprintf(stdout, "This process reads from %s using the File System Communication framework\n\n", MOTOR_STREAM_NAME);
     
 
     // Calling the main loop, program will hold here until its terminated 
-    main_loop();
+    main_loop(fsc);
 
+    fsc_context_destroy(fsc);
+    fprintf(stdout, "Process C (motor_ctrl) stopped.\n");
+    log_info("Process C (motor_ctrl) stopped.");
+    stop_logging();
     return 0;
 }
 
+/**
+ * Signal handler, lets the main loop finish its current round and return
+ */
+void stop_running(int signal_number)
+{
+    (void)signal_number;
+    is_running = 0;
+}
+
 /**
  * Main loop that loops through the main logic of the code
- * with selected interval
+ * reacting to new motor commands as soon as they arrive
  */
-void main_loop(){
-    while (1)
+void main_loop(Fsc_Context *fsc){
+    while (is_running)
     {
-        // Function provided by File System Communication framework that automatically invokes events when data is ready
-        update_streams();
-
-        // Set sensor refresh rate (here 1 Hz - 1 sample per second)
-        sleep_ms(POLL_INTERVAL_MS);
+        // Function provided by File System Communication framework that blocks until new commands arrive,
+        // POLL_INTERVAL_MS is only the longest time we wait before checking anyway
+        wait_and_update_streams(fsc, POLL_INTERVAL_MS);
     }
 }
 
@@ -83,21 +126,28 @@ void main_loop(){
  */
 void receiving_data(Data_Stream *context)
 {
-    char line_buffer[256]; //a buffer memory to read lines from the data file
+    Motor_Command command;
 
     //---read the data ---
     fprintf(stdout, "\n\nReading data from %s...\n", context->data_file_path);
+    if (context->skipped_frames > 0)
+        fprintf(stdout, "Skipped %llu older commands\n", context->skipped_frames);
     
-    printf("--- [DATA START] ---\n");
-    while (context->read_line(context, line_buffer, sizeof(line_buffer)) != NULL)
+    if (context->read_struct(context, &Motor_Command_descriptor, &command))
     {
-        printf("  %s", line_buffer); // print the line (includes newline)
+        fprintf(stderr, "Frame from %s holds no motor command\n", context->data_file_path);
+        return;
     }
+
+    printf("--- [DATA START] ---\n");
+    printf("  command_id: %d\n", (int)command.command_id);
+    printf("  speed_left: %.2f\n", command.speed_left);
+    printf("  speed_right: %.2f\n", command.speed_right);
+    printf("  direction: %s\n", command.direction == MOTOR_FORWARD ? "FORWARD" : "BACKWARD");
+    printf("  trace_id: 0x%llx (same as the lidar scan the command was planned from)\n", context->frame_trace.trace_id);
     printf("--- [DATA END] ---\n");
 
     
-    // log data
-    char log_message[255];
-    snprintf(log_message, sizeof(log_message), "[Motor ctrl]: Successfully read data from %s.", context->data_file_path);
-    record_log(log_message);
+    // log data, per frame lines are debug level, make LOG_LEVEL=INFO compiles them out
+    log_debug("Successfully read data from %s.", context->data_file_path);
 }
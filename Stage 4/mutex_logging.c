@@ -1,54 +1,1728 @@
+#define _GNU_SOURCE
+
 #include "mutex_logging.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdbool.h>
-
-//cross-platform sleep
-#ifdef _WIN32
-#include <windows.h>
-#define sleep_ms(ms) Sleep(ms)
-#else
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <pthread.h>
+#include <signal.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <unistd.h>
-#define sleep_ms(ms) usleep(ms * 1000)
-#endif
+#include <sched.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <zlib.h>
+
+// never removed, processes take turns through an flock on it
+#define LOG_LOCK_FILE_NAME "log.lock"
+// longest name of a sealed segment, longer files in the log directory are not taken for segments
+#define LOG_SEGMENT_NAME_SIZE 64
+// read size of the compressor
+#define LOG_COMPRESS_BUFFER_SIZE 65536
+// blocks a log file gets allocated ahead of its end, a write past them allocates the next chunk
+#define LOG_PREALLOCATION_CHUNK (1024 * 1024)
+// sharded mode, added to the generation of a shard so its definitions never count as written to a shared file
+#define LOG_SHARD_GENERATION_BIT 0x80000000u
+
+// records the async ring holds, power of two so the position wraps with a mask
+#define ASYNC_LOG_CAPACITY 1024
+// how often the background thread writes out what was queued
+#define ASYNC_LOG_FLUSH_INTERVAL_MS 10
+
+// shared memory ring of shared mode, one per machine, stays in /dev/shm between runs
+#define SHARED_LOG_RING_NAME "/fsc_system_log"
+#define SHARED_LOG_CAPACITY 4096
+// "FSLG" and layout version, a segment of an older layout is not used
+#define SHARED_LOG_RING_MAGIC 0x46534C47u
+#define SHARED_LOG_RING_VERSION 3u
+// how long a process waits for the creator of the segment to initialise it
+#define SHARED_LOG_ATTACH_TIMEOUT_MS 1000
+// a record claimed this long ago but never finished belongs to a dead process, the aggregator skips it
+#define SHARED_LOG_STALL_TIMEOUT_MS 1000
+// how long stop_logging waits for the aggregator to write out the messages of this process
+#define SHARED_LOG_FLUSH_TIMEOUT_MS 1000
+#define CACHE_LINE_SIZE 64
+
+// binary record: uint64 ns, uint32 format id, uint16 payload length, uint8 kind, uint8 clock of the ns
+#define BINARY_LOG_HEADER_SIZE 16
+#define BINARY_LOG_MAX_PAYLOAD (LOG_MESSAGE_SIZE - BINARY_LOG_HEADER_SIZE)
+// binary record kinds, a definition holds the format string of its id and comes before its first entry
+#define BINARY_LOG_ENTRY 0
+#define BINARY_LOG_DEFINITION 1
+// binary record clocks, sharded mode stamps CLOCK_MONOTONIC like its text lines
+#define BINARY_LOG_REALTIME 0
+#define BINARY_LOG_MONOTONIC 1
+// "[seconds.nanoseconds] " stamp of a text line in a shard
+#define LOG_TIMESTAMP_SIZE 40
+
+// Log_Format.state
+#define LOG_FORMAT_UNPARSED 0
+#define LOG_FORMAT_PARSED 1     // definition not written yet
+#define LOG_FORMAT_DEFINED 2
+#define LOG_FORMAT_TEXT_ONLY 3  // format binary logging can not carry, formatted right away and logged as text
+#define FNV_OFFSET_BASIS 2166136261u
+
+// how an argument of a binary log call is stored, int in 4 bytes, strings as uint16 length and bytes, the rest in 8 bytes
+enum Log_Argument_type {
+    LOG_ARGUMENT_NONE,          // %% takes no argument
+    LOG_ARGUMENT_INT,
+    LOG_ARGUMENT_LONG,
+    LOG_ARGUMENT_LONG_LONG,
+    LOG_ARGUMENT_SIZE,
+    LOG_ARGUMENT_INTMAX,
+    LOG_ARGUMENT_PTRDIFF,
+    LOG_ARGUMENT_DOUBLE,
+    LOG_ARGUMENT_POINTER,
+    LOG_ARGUMENT_STRING,
+    LOG_ARGUMENT_INVALID        // %n, long double, wide strings
+};
+
+// one conversion of a format string
+typedef struct Log_Conversion {
+    const char *start;          // its '%'
+    size_t length;              // up to and including the conversion character
+    int star_count;             // '*' width and precision, each takes an int before the value
+    enum Log_Argument_type type;
+} Log_Conversion;
+
+// runtime level of one module, call sites keep a pointer to its level
+typedef struct Log_Module {
+    char name[LOG_MODULE_NAME_SIZE];
+    int level;
+    bool has_own_level;         // set_log_level(module, ...) was called, the default does not change it
+} Log_Module;
+
+// format table of the decoder, filled from the definitions in the file
+typedef struct Log_Format_Entry {
+    uint32_t id;
+    char *format;
+} Log_Format_Entry;
+
+struct Log_Decoder {
+    Log_Format_Entry *formats;
+    size_t format_count;
+};
+
+// what a ring record holds and which file it goes to
+enum Log_Record_kind {
+    LOG_RECORD_TEXT,        // message of record_log, system_log.txt
+    LOG_RECORD_BINARY,      // record of record_binary_log, system_log.bin
+    LOG_RECORD_KIND_COUNT
+};
+
+// shared by the processes through log.lock, only changed while holding its flock
+typedef struct Log_Lock_State {
+    unsigned int generations[LOG_RECORD_KIND_COUNT];   // rotations of each file, writers reopen theirs when it changed
+    unsigned int last_segment;                          // number of the last sealed segment
+} Log_Lock_State;
+
+// sealed log file found by the compressor
+typedef struct Log_Segment {
+    struct timespec modified;   // retention deletes the oldest first, the numbers of shards are per process
+    bool is_compressed;
+    unsigned long long size;
+    char name[LOG_SEGMENT_NAME_SIZE + sizeof(".gz")];     // the .gz is added once it is compressed
+} Log_Segment;
+
+// one queued message, sequence tells producers and the writer whose turn the record is
+typedef struct Log_Record {
+    unsigned int sequence;
+    unsigned short length;
+    unsigned short kind;
+    unsigned long long timestamp_ns;    // sharded mode, CLOCK_MONOTONIC of the record_log call taken as the record was claimed
+    char message[LOG_MESSAGE_SIZE];
+} Log_Record;
+
+// bounded multi producer ring, in process memory (async mode) or in shared memory (shared mode)
+typedef struct Log_Ring {
+    unsigned int magic;         // shared mode, written last by the creator
+    unsigned int version;
+    unsigned int capacity;      // power of two
+    char header_padding[CACHE_LINE_SIZE - 3 * sizeof(unsigned int)];
+    unsigned int head;          // next record a producer claims
+    char head_padding[CACHE_LINE_SIZE - sizeof(unsigned int)];
+    unsigned int tail;          // next record the writer takes, only touched by it
+    char tail_padding[CACHE_LINE_SIZE - sizeof(unsigned int)];
+    Log_Record records[];
+} Log_Ring;
+
+// async and shared mode state, record_log pushes into log_ring while it is set
+static Log_Ring *log_ring = NULL;
+static Log_Ring *async_ring = NULL;     // kept for the next start, a late producer may still look at it
+static bool is_shared_logging = false;
+static bool is_sharded_logging = false;   // read by producers, only changed with log_files_lock held
+static int shared_ring_fd = -1;         // flock on it elects the aggregator of shared mode
+static bool is_aggregator = false;      // only touched by the writer thread while it runs
+static size_t shared_ring_size = 0;
+static bool is_log_writer_stopping = false;
+static bool is_exit_flush_registered = false;
+static pthread_t log_writer;
+static unsigned long long dropped_log_count = 0;
+// records of one flush joined together per kind, text messages each as "\n<message>"
+static char *log_batches[LOG_RECORD_KIND_COUNT] = { NULL, NULL };
+
+// runtime levels, read from FSC_LOG_LEVEL on first use
+static Log_Module log_modules[LOG_MAX_MODULES];
+static unsigned int log_module_count = 0;
+static int default_log_level = LOG_LEVEL_DEBUG;
+static pthread_mutex_t log_modules_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t log_level_environment_once = PTHREAD_ONCE_INIT;
+static const char *const log_level_names[LOG_LEVEL_NONE + 1] = { "DEBUG", "INFO", "WARNING", "ERROR", "NONE" };
+
+// files stay open for the life of the process, reopened by a forked child
+static const char *const log_file_names[LOG_RECORD_KIND_COUNT] = { LOG_FILE_NAME, BINARY_LOG_FILE_NAME };
+static const char *const log_shard_suffixes[LOG_RECORD_KIND_COUNT] = { LOG_SHARD_SUFFIX, BINARY_LOG_SHARD_SUFFIX };
+static const char *log_file_paths[LOG_RECORD_KIND_COUNT] = { LOG_FILE_NAME, BINARY_LOG_FILE_NAME };   // shared files or the shards
+static char log_shard_names[LOG_RECORD_KIND_COUNT][LOG_SEGMENT_NAME_SIZE];
+static int log_fds[LOG_RECORD_KIND_COUNT] = { -1, -1 };
+static int lock_fd = -1;
+static pthread_mutex_t log_files_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t log_fork_handler_once = PTHREAD_ONCE_INIT;
+
+// rotation, log.lock is mapped so every write can see whether another process started a new segment
+static Log_Lock_State *lock_state = NULL;
+static pthread_once_t lock_state_once = PTHREAD_ONCE_INIT;
+static unsigned int log_generations[LOG_RECORD_KIND_COUNT];    // generation of the files behind log_fds
+static off_t log_allocated_ends[LOG_RECORD_KIND_COUNT];         // end of the blocks allocated ahead in the files behind log_fds
+static bool is_preallocation_supported = true;                  // cleared by the first fallocate that fails
+static unsigned long long log_segment_size = LOG_SEGMENT_SIZE;
+static unsigned long long log_retention_size = LOG_RETENTION_SIZE;
+static pthread_t log_compressor;
+static bool is_compressor_started = false;
+static bool is_compression_pending = false;
+static pthread_mutex_t log_compressor_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t log_compressor_wake = PTHREAD_COND_INITIALIZER;
+// sharded mode, shards have a single writer so their rotation state stays in the process
+static unsigned int shard_generation = 0;   // new shards and segments of this process
+static unsigned int last_shard_segment = 0;
+
+static int open_log_files(enum Log_Record_kind kind);
+static void register_log_fork_handler(void);
+static void forget_log_files(void);
+static void append_to_log(enum Log_Record_kind kind, const struct iovec *parts, int part_count);
+static void free_log_batches(void);
+static void switch_log_files(bool is_sharded);
+static void name_log_shards(void);
+static void map_log_lock_state(void);
+static unsigned int log_segment_generation(enum Log_Record_kind kind);
+static void preallocate_log_segment(enum Log_Record_kind kind, off_t offset);
+static void rotate_log_file(enum Log_Record_kind kind);
+static void wake_log_compressor(void);
+static void *log_compressor_thread(void *argument);
+static void compress_log_segments(void);
+static size_t find_log_segments(Log_Segment **segments);
+static bool parse_log_segment_name(const char *name, Log_Segment *segment);
+static int compare_log_segments(const void *first, const void *second);
+static int compress_log_segment(Log_Segment *segment);
+static int start_log_writer(Log_Ring *ring);
+static Log_Ring *attach_shared_log_ring(void);
+static void init_log_ring(Log_Ring *ring, unsigned int capacity);
+static bool push_log_record(Log_Ring *ring, enum Log_Record_kind kind, const char *data, size_t length);
+static size_t drain_log_ring(Log_Ring *ring);
+static bool is_log_aggregator(void);
+static void *log_writer_thread(void *argument);
+static long long monotonic_ms(void);
+static unsigned long long monotonic_ns(void);
+static int parse_log_format(Log_Format *format, const char *fmt);
+static const char *scan_log_conversion(const char *fmt, Log_Conversion *conversion);
+static bool submit_binary_record(const unsigned char *record, size_t length);
+static void write_binary_header(unsigned char *record, uint32_t id, size_t payload_length, int kind);
+static size_t encode_log_arguments(const Log_Format *format, va_list args, unsigned char *payload);
+static size_t render_log_entry(const char *fmt, const unsigned char *payload, size_t payload_length, char *line, size_t size);
+static uint32_t hash_log_format(uint32_t hash, const char *fmt);
+static void record_binary_log_arguments(Log_Format *format, const char *fmt, va_list args);
+static size_t format_log_prefix(const Log_Format *format, char *prefix, size_t size, bool is_format);
+static Log_Module *find_log_module(const char *module, bool is_created);
+static void read_log_level_environment(void);
+static int parse_log_level(const char *name, size_t length);
+
+// writes logs to file, in async and shared mode the message is only queued and written by a background thread
+void record_log(char message[]){
+
+    Log_Ring *ring = __atomic_load_n(&log_ring, __ATOMIC_ACQUIRE);
+    if (ring != NULL) {
+        // never wait on the caller's path, a full ring drops the message
+        if (!push_log_record(ring, LOG_RECORD_TEXT, message, strnlen(message, LOG_MESSAGE_SIZE - 1)))
+            __atomic_add_fetch(&dropped_log_count, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    // one write, O_APPEND keeps it in one piece even next to writers that ignore the lock
+    struct iovec parts[2] = { { "\n", 1 }, { message, strlen(message) } };
+    append_to_log(LOG_RECORD_TEXT, parts, 2);
+}
+
+/**
+ * Switches record_log to async mode, messages go into a lock free ring and a background thread
+ * writes them to system_log.txt in batches, one lock and one write per batch.
+ * Messages are cut to LOG_MESSAGE_SIZE - 1 characters, if the ring is full they are dropped and counted.
+ * Queued messages are written at exit or by stop_logging.
+ * \return 0 on success, non zero if the thread could not be started
+ */
+int start_async_logging(void){
+    if (log_ring != NULL)
+        return 0;
+
+    if (async_ring == NULL)
+        async_ring = malloc(sizeof(Log_Ring) + ASYNC_LOG_CAPACITY * sizeof(Log_Record));
+    if (async_ring == NULL)
+        return 1;
+    init_log_ring(async_ring, ASYNC_LOG_CAPACITY);
+
+    return start_log_writer(async_ring);
+}
+
+/**
+ * Switches record_log to shared mode, every process that calls it pushes into one ring in shared
+ * memory and only one of them, the aggregator, writes the ring to system_log.txt in large batches.
+ * The aggregator is whichever process holds an flock on the ring, when it exits the next one takes over.
+ * Messages are cut and dropped like in async mode, stop_logging leaves shared mode.
+ * \return 0 on success, non zero if the ring could not be mapped or the thread could not be started
+ */
+int start_shared_logging(void){
+    if (log_ring != NULL)
+        return 0;
+
+    Log_Ring *ring = attach_shared_log_ring();
+    if (ring == NULL)
+        return 1;
+
+    is_shared_logging = true;
+    if (start_log_writer(ring)) {
+        is_shared_logging = false;
+        munmap(ring, shared_ring_size);
+        close(shared_ring_fd);
+        shared_ring_fd = -1;
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * Switches record_log to sharded mode, async mode into files of this process only, system_log.<pid>.txt and
+ * system_log.<pid>.bin, so writers of different processes never take a lock in common. Text lines are stamped
+ * with CLOCK_MONOTONIC when they are logged, binary records too, log_merge merges the shards into one timeline.
+ * Messages are cut and dropped like in async mode, stop_logging goes back to the shared files.
+ * \return 0 on success, non zero if the thread could not be started
+ */
+int start_sharded_logging(void){
+    if (log_ring != NULL)
+        return 0;
+
+    switch_log_files(true);
+    if (start_async_logging()) {
+        switch_log_files(false);
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * Leaves async, shared or sharded mode. Writes out every queued message, stops the background thread and makes
+ * record_log synchronous again into system_log.txt. In shared mode the queued messages of other processes
+ * are only written if no other aggregator is left. Nothing may log from other threads while it runs.
+ */
+void stop_logging(void){
+    Log_Ring *ring = log_ring;
+    if (ring == NULL)
+        return;
+
+    __atomic_store_n(&log_ring, NULL, __ATOMIC_RELEASE);
+    __atomic_store_n(&is_log_writer_stopping, true, __ATOMIC_RELEASE);
+    pthread_join(log_writer, NULL);
+
+    free_log_batches();
+    if (is_shared_logging) {
+        // closing the descriptor drops the flock, another process becomes the aggregator
+        munmap(ring, shared_ring_size);
+        close(shared_ring_fd);
+        shared_ring_fd = -1;
+        is_shared_logging = false;
+        is_aggregator = false;
+    }
+    if (is_sharded_logging)
+        switch_log_files(false);
+}
+
+/**
+ * Older name of stop_logging from when async mode was the only one it stopped
+ */
+void stop_async_logging(void){
+    stop_logging();
+}
+
+/**
+ * \return number of messages async or shared mode dropped because the ring was full
+ */
+unsigned long long get_dropped_log_count(void){
+    return __atomic_load_n(&dropped_log_count, __ATOMIC_RELAXED);
+}
+
+/**
+ * Caps the size of the log files. A file that grew past segment_size is sealed as the next numbered segment
+ * (system_log.txt.000001) and a new one is started. While a file is below segment_size the next
+ * LOG_PREALLOCATION_CHUNK (1 MiB) after its end is allocated with fallocate, never past the segment size,
+ * a file system where fallocate failed is not asked again.
+ * Sealed segments are compressed with gzip on a background thread, the oldest are deleted while together
+ * they are larger than retention_size. Processes logging into the same directory should use the same sizes.
+ * \param segment_size bytes per log file, 0 lets the files grow without limit
+ * \param retention_size bytes all sealed segments may take
+ */
+void set_log_rotation(unsigned long long segment_size, unsigned long long retention_size){
+    __atomic_store_n(&log_segment_size, segment_size, __ATOMIC_RELAXED);
+    __atomic_store_n(&log_retention_size, retention_size, __ATOMIC_RELAXED);
+}
+
+/**
+ * Deferred formatting, called through record_binary_log. Only a timestamp, the id of the format and the raw
+ * arguments are logged to system_log.bin, log_decode renders the line offline. The first call of a call site
+ * parses the format and logs its definition, formats binary logging can not carry are logged as text instead.
+ * Strings are copied, record and strings are cut to fit LOG_MESSAGE_SIZE.
+ * \param format call site state, static per call site
+ * \param fmt printf format string, has to stay the same for the call site
+ */
+void record_binary_log_format(Log_Format *format, const char *fmt, ...){
+    va_list args;
+    va_start(args, fmt);
+    record_binary_log_arguments(format, fmt, args);
+    va_end(args);
+}
+
+/**
+ * Called through log_debug, log_info, log_warning and log_error once the level passed the runtime level of the module.
+ * All levels are formatted into system_log.txt right away, building with LOG_DEFERRED_DEBUG=1 sends debug lines
+ * through the deferred path of record_binary_log to system_log.bin instead.
+ * \param format call site state, holds module and level
+ * \param fmt printf format string, has to stay the same for the call site
+ */
+void record_log_at_level(Log_Format *format, const char *fmt, ...){
+    va_list args;
+    va_start(args, fmt);
+
+    if (LOG_DEFERRED_DEBUG && format->level == LOG_LEVEL_DEBUG) {
+        record_binary_log_arguments(format, fmt, args);
+        va_end(args);
+        return;
+    }
+
+    char message[LOG_MESSAGE_SIZE];
+    size_t prefix_length = format_log_prefix(format, message, sizeof(message), false);
+    vsnprintf(message + prefix_length, sizeof(message) - prefix_length, fmt, args);
+    va_end(args);
+    record_log(message);
+}
+
+/**
+ * First call of a level macro, finds the runtime level of its module
+ * \return level the call site compares against from now on
+ */
+const int *resolve_log_threshold(Log_Format *format){
+    pthread_once(&log_level_environment_once, read_log_level_environment);
+
+    pthread_mutex_lock(&log_modules_lock);
+    Log_Module *module = find_log_module(format->module, true);
+    const int *threshold = module != NULL ? &module->level : &default_log_level;
+    pthread_mutex_unlock(&log_modules_lock);
+
+    __atomic_store_n(&format->threshold, threshold, __ATOMIC_RELEASE);
+    return threshold;
+}
+
+/**
+ * Changes the runtime level of a module, lines below it are not logged. Only levels compiled in
+ * (LOG_COMPILE_LEVEL) can be turned on. Overrides what FSC_LOG_LEVEL set.
+ * \param module tag the module logs with (its LOG_MODULE), NULL for every module without its own level
+ * \param level LOG_LEVEL_DEBUG to LOG_LEVEL_NONE
+ * \return 0 on success, non zero if the level is unknown or there are too many modules
+ */
+int set_log_level(const char *module, int level){
+    if (level < LOG_LEVEL_DEBUG || level > LOG_LEVEL_NONE)
+        return 1;
+    pthread_once(&log_level_environment_once, read_log_level_environment);
+
+    int result = 0;
+    pthread_mutex_lock(&log_modules_lock);
+    if (module == NULL) {
+        __atomic_store_n(&default_log_level, level, __ATOMIC_RELAXED);
+        for (unsigned int index = 0; index < log_module_count; index++)
+            if (!log_modules[index].has_own_level)
+                __atomic_store_n(&log_modules[index].level, level, __ATOMIC_RELAXED);
+    }
+    else {
+        Log_Module *entry = find_log_module(module, true);
+        if (entry != NULL) {
+            entry->has_own_level = true;
+            __atomic_store_n(&entry->level, level, __ATOMIC_RELAXED);
+        }
+        else
+            result = 1;
+    }
+    pthread_mutex_unlock(&log_modules_lock);
+    return result;
+}
+
+/**
+ * Renders a binary log as text, one line per entry with its wall clock time,
+ * or its time since boot for the CLOCK_MONOTONIC records of shards
+ * \param input binary log, read to its end
+ * \param output where the lines go
+ * \return 0 on success, non zero if the log ends in the middle of a record
+ */
+int decode_binary_log(FILE *input, FILE *output){
+    Log_Decoder *decoder = create_log_decoder();
+    if (decoder == NULL)
+        return 1;
+
+    Log_Entry entry;
+    int result;
+    while ((result = read_binary_log_entry(decoder, input, &entry)) > 0) {
+        unsigned int microseconds = (unsigned int)(entry.timestamp_ns % 1000000000ULL / 1000);
+        if (entry.is_monotonic) {
+            fprintf(output, "[%llu.%06u] %s\n", (unsigned long long)(entry.timestamp_ns / 1000000000ULL), microseconds, entry.line);
+            continue;
+        }
+
+        // wall clock time of the call, microseconds are enough to tell lines apart
+        time_t seconds = (time_t)(entry.timestamp_ns / 1000000000ULL);
+        struct tm local;
+        char date[32] = "?";
+        if (localtime_r(&seconds, &local) != NULL)
+            strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", &local);
+        fprintf(output, "[%s.%06u] %s\n", date, microseconds, entry.line);
+    }
 
+    free_log_decoder(decoder);
+    return result < 0;
+}
+
+/**
+ * \return decoder for one binary log, NULL if out of memory
+ */
+Log_Decoder *create_log_decoder(void){
+    return calloc(1, sizeof(Log_Decoder));
+}
+
+void free_log_decoder(Log_Decoder *decoder){
+    if (decoder == NULL)
+        return;
+    for (size_t index = 0; index < decoder->format_count; index++)
+        free(decoder->formats[index].format);
+    free(decoder->formats);
+    free(decoder);
+}
+
+/**
+ * Reads a binary log up to its next entry and renders it, the definitions on the way are remembered
+ * \param decoder state of this log, has to see the log from its start
+ * \param entry filled with time and line of the entry
+ * \return 1 if entry was filled, 0 at the end of the log, -1 if the log ends in the middle of a record or memory ran out
+ */
+int read_binary_log_entry(Log_Decoder *decoder, FILE *input, Log_Entry *entry){
+    unsigned char header[BINARY_LOG_HEADER_SIZE];
+    unsigned char payload[BINARY_LOG_MAX_PAYLOAD + 1];
+    size_t header_length;
+    while ((header_length = fread(header, 1, sizeof(header), input)) > 0) {
+        uint64_t timestamp_ns;
+        uint32_t id;
+        uint16_t length;
+        memcpy(&timestamp_ns, header, 8);
+        memcpy(&id, header + 8, 4);
+        memcpy(&length, header + 12, 2);
+        int kind = header[14];
+
+        if (header_length != sizeof(header) || length > BINARY_LOG_MAX_PAYLOAD || fread(payload, 1, length, input) != length) {
+            fprintf(stderr, "binary log ends in the middle of a record\n");
+            return -1;
+        }
+
+        size_t index = 0;
+        while (index < decoder->format_count && decoder->formats[index].id != id)
+            index++;
+
+        if (kind == BINARY_LOG_DEFINITION) {
+            payload[length] = '\0';
+            if (index == decoder->format_count) {
+                Log_Format_Entry *grown = realloc(decoder->formats, (decoder->format_count + 1) * sizeof(Log_Format_Entry));
+                if (grown == NULL)
+                    return -1;
+                decoder->formats = grown;
+                decoder->formats[index].id = id;
+                decoder->formats[index].format = NULL;
+                decoder->format_count++;
+            }
+            free(decoder->formats[index].format);
+            decoder->formats[index].format = strdup((const char *)payload);
+            continue;
+        }
+
+        if (index < decoder->format_count && decoder->formats[index].format != NULL)
+            render_log_entry(decoder->formats[index].format, payload, length, entry->line, sizeof(entry->line));
+        else
+            snprintf(entry->line, sizeof(entry->line), "<no definition of format %08x>", (unsigned int)id);
+        entry->timestamp_ns = timestamp_ns;
+        entry->is_monotonic = header[15] == BINARY_LOG_MONOTONIC;
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * Opens the log file of the kind for appending and the lock file, once per process
+ * \return non zero if one of them could not be opened
+ */
+static int open_log_files(enum Log_Record_kind kind){
+    pthread_once(&log_fork_handler_once, register_log_fork_handler);
+    if (log_fds[kind] >= 0 && lock_fd >= 0)
+        return 0;
+
+    if (log_fds[kind] < 0) {
+        // generation first, a rotation in between only makes the next write reopen the file once more
+        log_generations[kind] = log_segment_generation(kind);
+        log_fds[kind] = open(log_file_paths[kind], O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+        log_allocated_ends[kind] = 0;
+    }
+    if (lock_fd < 0)
+        lock_fd = open(LOG_LOCK_FILE_NAME, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    return log_fds[kind] < 0 || lock_fd < 0;
+}
+
+static void register_log_fork_handler(void){
+    pthread_atfork(NULL, NULL, forget_log_files);
+}
+
+/**
+ * Child side of fork, the inherited descriptors share the parent's flock so the child opens its own,
+ * the compressor thread is not inherited and in sharded mode the child gets shards of its own
+ */
+static void forget_log_files(void){
+    for (int kind = 0; kind < LOG_RECORD_KIND_COUNT; kind++) {
+        if (log_fds[kind] >= 0)
+            close(log_fds[kind]);
+        log_fds[kind] = -1;
+    }
+    if (lock_fd >= 0)
+        close(lock_fd);
+    lock_fd = -1;
+    pthread_mutex_init(&log_files_lock, NULL);
+    if (is_sharded_logging)
+        name_log_shards();
+
+    is_compressor_started = false;
+    is_compression_pending = false;
+    pthread_mutex_init(&log_compressor_lock, NULL);
+    pthread_cond_init(&log_compressor_wake, NULL);
+}
+
+/**
+ * Appends the parts to the log file of the kind with one writev while holding the lock,
+ * threads of this process take turns on a mutex, processes on an flock of log.lock.
+ * Writers only wait for as long as another one is inside its write, shards of sharded mode have no other.
+ * The write that takes the file past the segment size rotates it.
+ */
+static void append_to_log(enum Log_Record_kind kind, const struct iovec *parts, int part_count){
+    pthread_mutex_lock(&log_files_lock);
+    if (open_log_files(kind)) {
+        pthread_mutex_unlock(&log_files_lock);
+        return;
+    }
+
+    bool is_locked = !is_sharded_logging;
+    while (is_locked && flock(lock_fd, LOCK_EX) && errno == EINTR)
+        ;
+
+    // another process rotated the file, ours is a sealed segment now
+    if (is_locked && lock_state != NULL && __atomic_load_n(&lock_state->generations[kind], __ATOMIC_ACQUIRE) != log_generations[kind]) {
+        close(log_fds[kind]);
+        log_fds[kind] = -1;
+        if (open_log_files(kind)) {
+            flock(lock_fd, LOCK_UN);
+            pthread_mutex_unlock(&log_files_lock);
+            return;
+        }
+    }
+
+    // regular files only write less than asked when the disk is full, the rest goes after it
+    struct iovec remaining[2];
+    memcpy(remaining, parts, sizeof(struct iovec) * (size_t)part_count);
+    struct iovec *part = remaining;
+    while (part_count > 0) {
+        ssize_t written = writev(log_fds[kind], part, part_count);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written <= 0)
+            break;
+
+        while (part_count > 0 && (size_t)written >= part->iov_len) {
+            written -= (ssize_t)part->iov_len;
+            part++;
+            part_count--;
+        }
+        if (part_count > 0) {
+            part->iov_base = (char *)part->iov_base + written;
+            part->iov_len -= (size_t)written;
+        }
+    }
+
+    // O_APPEND leaves the offset at the end of the file
+    unsigned long long segment_size = __atomic_load_n(&log_segment_size, __ATOMIC_RELAXED);
+    off_t offset = segment_size > 0 && (!is_locked || lock_state != NULL) ? lseek(log_fds[kind], 0, SEEK_CUR) : -1;
+    if (offset >= (off_t)segment_size)
+        rotate_log_file(kind);
+    else if (offset >= log_allocated_ends[kind])
+        preallocate_log_segment(kind, offset);
+
+    if (is_locked)
+        flock(lock_fd, LOCK_UN);
+    pthread_mutex_unlock(&log_files_lock);
+}
+
+/**
+ * Maps the rotation state kept in log.lock, once per process. The file starts out empty,
+ * growing it zeroes the state, a file another process already grew is never shrunk.
+ */
+static void map_log_lock_state(void){
+    int fd = open(LOG_LOCK_FILE_NAME, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0)
+        return;
+
+    struct stat status;
+    if (fstat(fd, &status) == 0 && (status.st_size >= (off_t)sizeof(Log_Lock_State) || ftruncate(fd, sizeof(Log_Lock_State)) == 0)) {
+        void *state = mmap(NULL, sizeof(Log_Lock_State), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (state != MAP_FAILED)
+            lock_state = state;
+    }
+    close(fd);
+}
+
+/**
+ * \return number of rotations of the file of the kind, 0 if log.lock could not be mapped,
+ * in sharded mode the number of shards and segments this process started
+ */
+static unsigned int log_segment_generation(enum Log_Record_kind kind){
+    if (__atomic_load_n(&is_sharded_logging, __ATOMIC_RELAXED))
+        return __atomic_load_n(&shard_generation, __ATOMIC_ACQUIRE) | LOG_SHARD_GENERATION_BIT;
+
+    pthread_once(&lock_state_once, map_log_lock_state);
+    return lock_state != NULL ? __atomic_load_n(&lock_state->generations[kind], __ATOMIC_ACQUIRE) : 0;
+}
+
+/**
+ * Allocates the next chunk of blocks after the end of a rotated file without changing its size, appends
+ * then mostly just move the size. Only up to the segment size, a file that is never rotated gets nothing.
+ * File systems without fallocate (EOPNOTSUPP, tmpfs of older kernels) are not asked again.
+ * \param offset end of the file, at or past the blocks allocated so far
+ */
+static void preallocate_log_segment(enum Log_Record_kind kind, off_t offset){
+    unsigned long long segment_size = __atomic_load_n(&log_segment_size, __ATOMIC_RELAXED);
+    if (!is_preallocation_supported || offset < 0 || (unsigned long long)offset >= segment_size)
+        return;
+
+    off_t length = (off_t)(segment_size - (unsigned long long)offset);
+    if (length > LOG_PREALLOCATION_CHUNK)
+        length = LOG_PREALLOCATION_CHUNK;
+    if (fallocate(log_fds[kind], FALLOC_FL_KEEP_SIZE, offset, length) == 0)
+        log_allocated_ends[kind] = offset + length;
+    else if (errno != EINTR)
+        is_preallocation_supported = false;
+}
+
+/**
+ * Seals the file of the kind as the next numbered segment and starts a new one, called holding
+ * the flock of log.lock. The other processes see the new generation and reopen the file before their next write.
+ * Shards are only written by this process, their numbers and generation stay in it.
+ */
+static void rotate_log_file(enum Log_Record_kind kind){
+    char sealed_name[LOG_SEGMENT_NAME_SIZE];
+    char compressed_name[LOG_SEGMENT_NAME_SIZE + sizeof(".gz")];
+    struct stat status;
+
+    // numbers only grow, a deleted log.lock starts over so taken numbers are skipped
+    unsigned int number = is_sharded_logging ? last_shard_segment : lock_state->last_segment;
+    do {
+        number++;
+        snprintf(sealed_name, sizeof(sealed_name), "%s.%06u", log_file_paths[kind], number);
+        snprintf(compressed_name, sizeof(compressed_name), "%s.gz", sealed_name);
+    } while (stat(sealed_name, &status) == 0 || stat(compressed_name, &status) == 0);
+
+    // a file somebody deleted is simply started again
+    bool is_sealed = rename(log_file_paths[kind], sealed_name) == 0;
+    if (!is_sealed && errno != ENOENT)
+        return;
+    if (is_sharded_logging) {
+        if (is_sealed)
+            last_shard_segment = number;
+        __atomic_add_fetch(&shard_generation, 1, __ATOMIC_RELEASE);
+    }
+    else {
+        if (is_sealed)
+            lock_state->last_segment = number;
+        __atomic_add_fetch(&lock_state->generations[kind], 1, __ATOMIC_RELEASE);
+    }
+
+    close(log_fds[kind]);
+    log_fds[kind] = -1;
+    open_log_files(kind);
+
+    if (is_sealed)
+        wake_log_compressor();
+}
+
+/**
+ * Hands the sealed segments to the compressor thread, starts it on the first rotation of this process
+ */
+static void wake_log_compressor(void){
+    pthread_mutex_lock(&log_compressor_lock);
+    is_compression_pending = true;
+    if (!is_compressor_started) {
+        // like the writer thread it must never take a signal meant for the program
+        sigset_t all_signals, previous;
+        sigfillset(&all_signals);
+        pthread_sigmask(SIG_SETMASK, &all_signals, &previous);
+        if (pthread_create(&log_compressor, NULL, log_compressor_thread, NULL) == 0) {
+            pthread_detach(log_compressor);
+            is_compressor_started = true;
+        }
+        pthread_sigmask(SIG_SETMASK, &previous, NULL);
+    }
+    pthread_cond_signal(&log_compressor_wake);
+    pthread_mutex_unlock(&log_compressor_lock);
+}
+
+/**
+ * Background thread of rotation, compresses whenever a segment was sealed. A segment it could not
+ * finish before the process exited is picked up by the next compressor in the directory.
+ */
+static void *log_compressor_thread(void *argument){
+    (void)argument;
+
+    pthread_mutex_lock(&log_compressor_lock);
+    for (;;) {
+        while (!is_compression_pending)
+            pthread_cond_wait(&log_compressor_wake, &log_compressor_lock);
+        is_compression_pending = false;
+
+        pthread_mutex_unlock(&log_compressor_lock);
+        compress_log_segments();
+        pthread_mutex_lock(&log_compressor_lock);
+    }
+    return NULL;
+}
+
+/**
+ * Compresses every sealed segment in the log directory, then deletes the oldest ones
+ * while all of them together are larger than the retention size
+ */
+static void compress_log_segments(void){
+    Log_Segment *segments = NULL;
+    size_t count = find_log_segments(&segments);
+
+    unsigned long long total_size = 0;
+    for (size_t index = 0; index < count; index++) {
+        if (!segments[index].is_compressed)
+            compress_log_segment(&segments[index]);
+        total_size += segments[index].size;
+    }
+
+    qsort(segments, count, sizeof(Log_Segment), compare_log_segments);
+    unsigned long long retention_size = __atomic_load_n(&log_retention_size, __ATOMIC_RELAXED);
+    for (size_t index = 0; index < count && total_size > retention_size; index++) {
+        // another process may have deleted it already
+        if (unlink(segments[index].name) == 0 || errno == ENOENT)
+            total_size -= segments[index].size;
+    }
+    free(segments);
+}
+
+/**
+ * Lists the sealed segments of both log files in the working directory
+ * \return number of segments, the array has to be freed
+ */
+static size_t find_log_segments(Log_Segment **segments){
+    DIR *directory = opendir(".");
+    if (directory == NULL)
+        return 0;
+
+    size_t count = 0;
+    size_t capacity = 0;
+    struct dirent *entry;
+    while ((entry = readdir(directory)) != NULL) {
+        Log_Segment segment;
+        struct stat status;
+        if (!parse_log_segment_name(entry->d_name, &segment) || stat(segment.name, &status))
+            continue;
+        segment.size = (unsigned long long)status.st_size;
+        segment.modified = status.st_mtim;
+
+        if (count == capacity) {
+            size_t grown_capacity = capacity > 0 ? capacity * 2 : 16;
+            Log_Segment *grown = realloc(*segments, grown_capacity * sizeof(Log_Segment));
+            if (grown == NULL)
+                break;
+            *segments = grown;
+            capacity = grown_capacity;
+        }
+        (*segments)[count++] = segment;
+    }
+    closedir(directory);
+    return count;
+}
 
-// Check if log.lock exists
-bool lock_exists(void) {
-    // try to open the file
-    FILE *f = fopen("log.lock", "r");
-    // if file doesnt exist
-    if (f == NULL) 
+/**
+ * Segments are named after their log file, a dot and their number, compressed ones end in .gz.
+ * Log files are the shared ones and the shards of every process, system_log.<pid>.txt
+ * \return true if the name is one of a segment, the segment is filled then
+ */
+static bool parse_log_segment_name(const char *name, Log_Segment *segment){
+    size_t length = strlen(name);
+    if (length >= LOG_SEGMENT_NAME_SIZE)
         return false;
-    fclose(f);
+
+    segment->is_compressed = length > 3 && !strcmp(name + length - 3, ".gz");
+    if (segment->is_compressed)
+        length -= 3;
+
+    // the number
+    size_t number_start = length;
+    while (number_start > 0 && isdigit((unsigned char)name[number_start - 1]))
+        number_start--;
+    if (number_start == length || number_start < 2 || name[number_start - 1] != '.')
+        return false;
+    size_t file_length = number_start - 1;
+
+    bool is_log_file = false;
+    for (int kind = 0; kind < LOG_RECORD_KIND_COUNT && !is_log_file; kind++) {
+        size_t prefix_length = strlen(LOG_SHARD_PREFIX);
+        size_t suffix_length = strlen(log_shard_suffixes[kind]);
+        size_t pid_length = file_length - prefix_length - suffix_length;
+
+        if (file_length == strlen(log_file_names[kind]) && !strncmp(name, log_file_names[kind], file_length))
+            is_log_file = true;
+        else if (file_length > prefix_length + suffix_length && !strncmp(name, LOG_SHARD_PREFIX, prefix_length)
+            && !strncmp(name + file_length - suffix_length, log_shard_suffixes[kind], suffix_length)
+            && strspn(name + prefix_length, "0123456789") == pid_length)
+            is_log_file = true;
+    }
+    if (!is_log_file)
+        return false;
+
+    strcpy(segment->name, name);
     return true;
 }
 
-// writes logs to file
-void record_log(char message[]){
+// oldest segment first
+static int compare_log_segments(const void *first, const void *second){
+    const struct timespec *first_modified = &((const Log_Segment *)first)->modified;
+    const struct timespec *second_modified = &((const Log_Segment *)second)->modified;
+    if (first_modified->tv_sec != second_modified->tv_sec)
+        return first_modified->tv_sec < second_modified->tv_sec ? -1 : 1;
+    return (first_modified->tv_nsec > second_modified->tv_nsec) - (first_modified->tv_nsec < second_modified->tv_nsec);
+}
+
+/**
+ * Compresses a sealed segment into its .gz, the segment is only deleted once the compressed copy is complete.
+ * Compressors of several processes take turns through an flock on the segment.
+ * \return non zero if the segment was left as it is
+ */
+static int compress_log_segment(Log_Segment *segment){
+    int input = open(segment->name, O_RDONLY | O_CLOEXEC);
+    if (input < 0)
+        return 1;
+    if (flock(input, LOCK_EX | LOCK_NB)) {
+        close(input);
+        return 1;
+    }
+
+    char compressed_name[sizeof(segment->name)];
+    char temporary_name[sizeof(segment->name) + sizeof(".tmp")];
+    snprintf(compressed_name, sizeof(compressed_name), "%.*s.gz", LOG_SEGMENT_NAME_SIZE - 1, segment->name);
+    snprintf(temporary_name, sizeof(temporary_name), "%s.tmp", compressed_name);
+
+    int output_fd = open(temporary_name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    gzFile output = output_fd >= 0 ? gzdopen(output_fd, "wb") : NULL;
+    if (output == NULL) {
+        if (output_fd >= 0)
+            close(output_fd);
+        close(input);
+        return 1;
+    }
+
+    char buffer[LOG_COMPRESS_BUFFER_SIZE];
+    bool is_complete = true;
+    ssize_t length;
+    while ((length = read(input, buffer, sizeof(buffer))) != 0) {
+        if (length < 0 && errno == EINTR)
+            continue;
+        if (length < 0 || gzwrite(output, buffer, (unsigned int)length) != (int)length) {
+            is_complete = false;
+            break;
+        }
+    }
+    is_complete = gzclose(output) == Z_OK && is_complete;
+
+    struct stat status;
+    if (is_complete && rename(temporary_name, compressed_name) == 0) {
+        // keeps the age of the segment for retention
+        struct timespec times[2] = { { 0, UTIME_OMIT }, segment->modified };
+        utimensat(AT_FDCWD, compressed_name, times, 0);
+
+        unlink(segment->name);
+        strcpy(segment->name, compressed_name);
+        segment->is_compressed = true;
+        if (stat(compressed_name, &status) == 0)
+            segment->size = (unsigned long long)status.st_size;
+    }
+    else
+        unlink(temporary_name);
+
+    close(input);
+    return !segment->is_compressed;
+}
+
+/**
+ * Points the log files at the shards of this process or back at the shared files, they are reopened on the next write.
+ * A new shard counts as a new segment so call sites define their formats in it again.
+ */
+static void switch_log_files(bool is_sharded){
+    pthread_mutex_lock(&log_files_lock);
+    for (int kind = 0; kind < LOG_RECORD_KIND_COUNT; kind++) {
+        if (log_fds[kind] >= 0)
+            close(log_fds[kind]);
+        log_fds[kind] = -1;
+    }
+    if (is_sharded)
+        name_log_shards();
+    else
+        for (int kind = 0; kind < LOG_RECORD_KIND_COUNT; kind++)
+            log_file_paths[kind] = log_file_names[kind];
+    __atomic_store_n(&is_sharded_logging, is_sharded, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&log_files_lock);
+}
+
+static void name_log_shards(void){
+    for (int kind = 0; kind < LOG_RECORD_KIND_COUNT; kind++) {
+        snprintf(log_shard_names[kind], LOG_SEGMENT_NAME_SIZE, LOG_SHARD_PREFIX "%ld%s", (long)getpid(), log_shard_suffixes[kind]);
+        log_file_paths[kind] = log_shard_names[kind];
+    }
+    __atomic_add_fetch(&shard_generation, 1, __ATOMIC_RELEASE);
+}
+
+static void free_log_batches(void){
+    for (int kind = 0; kind < LOG_RECORD_KIND_COUNT; kind++) {
+        free(log_batches[kind]);
+        log_batches[kind] = NULL;
+    }
+}
+
+/**
+ * Starts the background thread that drains the ring, record_log uses the ring from then on
+ * \return non zero if the thread could not be started
+ */
+static int start_log_writer(Log_Ring *ring){
+    // a full lap of the ring fits, text messages get their newline and in sharded mode their stamp
+    for (int kind = 0; kind < LOG_RECORD_KIND_COUNT; kind++) {
+        log_batches[kind] = malloc(ring->capacity * (size_t)(LOG_MESSAGE_SIZE + LOG_TIMESTAMP_SIZE + 1));
+        if (log_batches[kind] == NULL) {
+            free_log_batches();
+            return 1;
+        }
+    }
+    is_log_writer_stopping = false;
+
+    // the thread must never take a signal meant for the program, its handlers belong to the main loop
+    sigset_t all_signals, previous;
+    sigfillset(&all_signals);
+    pthread_sigmask(SIG_SETMASK, &all_signals, &previous);
+    int result = pthread_create(&log_writer, NULL, log_writer_thread, ring);
+    pthread_sigmask(SIG_SETMASK, &previous, NULL);
+    if (result) {
+        free_log_batches();
+        return 1;
+    }
+
+    if (!is_exit_flush_registered)
+        is_exit_flush_registered = atexit(stop_logging) == 0;
+
+    __atomic_store_n(&log_ring, ring, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/**
+ * Maps the shared log ring, the first process creates and initialises it, the others wait for its magic
+ * \return mapped ring, NULL if it fails
+ */
+static Log_Ring *attach_shared_log_ring(void){
+    shared_ring_size = sizeof(Log_Ring) + SHARED_LOG_CAPACITY * sizeof(Log_Record);
+
+    bool is_creator = true;
+    int fd = shm_open(SHARED_LOG_RING_NAME, O_CREAT | O_EXCL | O_RDWR | O_CLOEXEC, 0666);
+    if (fd < 0 && errno == EEXIST) {
+        is_creator = false;
+        fd = shm_open(SHARED_LOG_RING_NAME, O_RDWR | O_CLOEXEC, 0666);
+    }
+    if (fd < 0)
+        return NULL;
+
+    // others wait until the creator sized the segment
+    long long deadline_ms = monotonic_ms() + SHARED_LOG_ATTACH_TIMEOUT_MS;
+    struct stat info;
+    while (!is_creator && !fstat(fd, &info) && info.st_size == 0 && monotonic_ms() < deadline_ms)
+        sched_yield();
+
+    if ((is_creator && ftruncate(fd, (off_t)shared_ring_size)) || fstat(fd, &info) || (size_t)info.st_size != shared_ring_size) {
+        close(fd);
+        return NULL;
+    }
+
+    Log_Ring *ring = mmap(NULL, shared_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (ring == MAP_FAILED) {
+        close(fd);
+        return NULL;
+    }
+
+    if (is_creator) {
+        init_log_ring(ring, SHARED_LOG_CAPACITY);
+        ring->version = SHARED_LOG_RING_VERSION;
+        __atomic_store_n(&ring->magic, SHARED_LOG_RING_MAGIC, __ATOMIC_RELEASE);
+    }
+    while (__atomic_load_n(&ring->magic, __ATOMIC_ACQUIRE) != SHARED_LOG_RING_MAGIC && monotonic_ms() < deadline_ms)
+        sched_yield();
+
+    if (ring->magic != SHARED_LOG_RING_MAGIC || ring->version != SHARED_LOG_RING_VERSION || ring->capacity != SHARED_LOG_CAPACITY) {
+        munmap(ring, shared_ring_size);
+        close(fd);
+        return NULL;
+    }
+
+    shared_ring_fd = fd;
+    return ring;
+}
+
+/**
+ * Empties the ring, record i is free for the producer of position i
+ */
+static void init_log_ring(Log_Ring *ring, unsigned int capacity){
+    ring->capacity = capacity;
+    ring->head = 0;
+    ring->tail = 0;
+    for (unsigned int index = 0; index < capacity; index++)
+        ring->records[index].sequence = index;
+}
+
+/**
+ * Claims the next record of the ring and copies the data in, safe from any number of threads and processes
+ * \return false if the ring is full
+ */
+static bool push_log_record(Log_Ring *ring, enum Log_Record_kind kind, const char *data, size_t length){
+    bool is_stamped = __atomic_load_n(&is_sharded_logging, __ATOMIC_RELAXED);
+    uint64_t timestamp_ns = 0;
+    unsigned int head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    Log_Record *record;
+
+    for (;;) {
+        record = &ring->records[head & (ring->capacity - 1)];
+        int turn = (int)(__atomic_load_n(&record->sequence, __ATOMIC_ACQUIRE) - head);
+
+        // free record, try to claim it, on failure head holds the new position
+        if (turn == 0) {
+            // shards are written in ring order and log_merge takes them as sorted, so the stamp is taken between
+            // seeing this position and claiming it, whoever claims a later one saw ours taken and stamps after us
+            if (is_stamped)
+                timestamp_ns = (uint64_t)monotonic_ns();
+            if (__atomic_compare_exchange_n(&ring->head, &head, head + 1, true, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+                break;
+        }
+        // writer has not taken this record yet, ring is full
+        else if (turn < 0)
+            return false;
+        // another producer claimed it first
+        else
+            head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    }
+
+    if (length > LOG_MESSAGE_SIZE)
+        length = LOG_MESSAGE_SIZE;
+    memcpy(record->message, data, length);
+    record->length = (unsigned short)length;
+    record->kind = (unsigned short)kind;
+    // the time binary records got when their header was written is replaced by the one that matches their position
+    if (is_stamped && kind == LOG_RECORD_TEXT)
+        record->timestamp_ns = timestamp_ns;
+    else if (is_stamped && length >= BINARY_LOG_HEADER_SIZE)
+        memcpy(record->message, &timestamp_ns, 8);
+
+    // publishes the message to the writer, unless the aggregator already gave up on us and skipped the record
+    unsigned int expected = head;
+    return __atomic_compare_exchange_n(&record->sequence, &expected, head + 1, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+}
+
+/**
+ * Takes every finished record off the ring and writes them out as one batch
+ * \return number of messages written
+ */
+static size_t drain_log_ring(Log_Ring *ring){
+    // shared mode, record the aggregator has been waiting for since stalled_since_ms
+    static unsigned int stalled_position = 0;
+    static long long stalled_since_ms = -1;
+
+    size_t lengths[LOG_RECORD_KIND_COUNT] = { 0, 0 };
+    size_t count = 0;
+    unsigned int tail = ring->tail;
+
+    // at most one lap, the batch buffer holds no more and producers may keep refilling the ring
+    while (count < ring->capacity) {
+        Log_Record *record = &ring->records[tail & (ring->capacity - 1)];
+        if (__atomic_load_n(&record->sequence, __ATOMIC_ACQUIRE) != tail + 1) {
+            // a claimed record still being copied ends the batch, it is taken next flush
+            if (!is_shared_logging || tail == __atomic_load_n(&ring->head, __ATOMIC_RELAXED))
+                break;
+
+            // in shared mode its producer may have died in between, after a while the record is skipped
+            long long now_ms = monotonic_ms();
+            if (stalled_since_ms < 0 || stalled_position != tail) {
+                stalled_position = tail;
+                stalled_since_ms = now_ms;
+                break;
+            }
+            unsigned int expected = tail;
+            if (now_ms - stalled_since_ms < SHARED_LOG_STALL_TIMEOUT_MS
+                || !__atomic_compare_exchange_n(&record->sequence, &expected, tail + ring->capacity, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+                break;
+
+            // if the producer is still alive its publish fails and it counts the message as dropped
+            stalled_since_ms = -1;
+            tail++;
+            continue;
+        }
+
+        size_t message_length = record->length < LOG_MESSAGE_SIZE ? record->length : LOG_MESSAGE_SIZE;
+        enum Log_Record_kind kind = record->kind == LOG_RECORD_BINARY ? LOG_RECORD_BINARY : LOG_RECORD_TEXT;
+        char *batch = log_batches[kind];
+        if (kind == LOG_RECORD_TEXT) {
+            batch[lengths[kind]++] = '\n';
+            if (is_sharded_logging)
+                lengths[kind] += (size_t)snprintf(batch + lengths[kind], LOG_TIMESTAMP_SIZE, "[%llu.%09llu] ",
+                    record->timestamp_ns / 1000000000ULL, record->timestamp_ns % 1000000000ULL);
+        }
+        memcpy(batch + lengths[kind], record->message, message_length);
+        lengths[kind] += message_length;
+        count++;
+
+        // hands the record back to producers for the next lap of the ring
+        __atomic_store_n(&record->sequence, tail + ring->capacity, __ATOMIC_RELEASE);
+        tail++;
+    }
+    __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+
+    for (int kind = 0; kind < LOG_RECORD_KIND_COUNT; kind++) {
+        if (lengths[kind] > 0) {
+            struct iovec batch = { log_batches[kind], lengths[kind] };
+            append_to_log((enum Log_Record_kind)kind, &batch, 1);
+        }
+    }
+    return count;
+}
+
+/**
+ * Shared mode election, the process that holds the flock on the ring drains it, the kernel
+ * hands the lock to the next one when the aggregator closes the ring or dies
+ * \return true if this process is the aggregator
+ */
+static bool is_log_aggregator(void){
+    if (!is_aggregator)
+        is_aggregator = flock(shared_ring_fd, LOCK_EX | LOCK_NB) == 0;
+    return is_aggregator;
+}
+
+/**
+ * Background thread of async and shared mode, flushes the ring every ASYNC_LOG_FLUSH_INTERVAL_MS until stopped
+ */
+static void *log_writer_thread(void *argument){
+    Log_Ring *ring = argument;
+    const struct timespec interval = { 0, ASYNC_LOG_FLUSH_INTERVAL_MS * 1000000L };
 
-    // Wait while lock exists if true allow message to be written
-    while (lock_exists()) { //  
-        sleep_ms(100);  // 100ms
+    while (!__atomic_load_n(&is_log_writer_stopping, __ATOMIC_ACQUIRE)) {
+        nanosleep(&interval, NULL);
+        if (!is_shared_logging || is_log_aggregator())
+            drain_log_ring(ring);
     }
 
-    // Create lock file 
-    FILE *lock_file = fopen("log.lock", "w");
-    if (lock_file == NULL) {
+    // producers are done, whatever is left goes out now
+    if (!is_shared_logging) {
+        drain_log_ring(ring);
+        return NULL;
+    }
+
+    // in shared mode our messages are out once the tail passed them, whoever the aggregator is
+    unsigned int last_position = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    long long deadline_ms = monotonic_ms() + SHARED_LOG_FLUSH_TIMEOUT_MS;
+    while ((int)(__atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) - last_position) < 0 && monotonic_ms() < deadline_ms) {
+        if (is_log_aggregator())
+            drain_log_ring(ring);
+        else
+            nanosleep(&interval, NULL);
+    }
+    return NULL;
+}
+
+static long long monotonic_ms(void){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+static unsigned long long monotonic_ns(void){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long)now.tv_sec * 1000000000ULL + (unsigned long long)now.tv_nsec;
+}
+
+/**
+ * Logs one deferred call, the first one also parses the format and logs its definition
+ */
+static void record_binary_log_arguments(Log_Format *format, const char *fmt, va_list args){
+    int state = __atomic_load_n(&format->state, __ATOMIC_ACQUIRE);
+    if (state == LOG_FORMAT_UNPARSED)
+        state = parse_log_format(format, fmt);
+
+    if (state == LOG_FORMAT_TEXT_ONLY) {
+        char message[LOG_MESSAGE_SIZE];
+        size_t prefix_length = format_log_prefix(format, message, sizeof(message), false);
+        vsnprintf(message + prefix_length, sizeof(message) - prefix_length, fmt, args);
+        record_log(message);
         return;
     }
-    fclose(lock_file);
 
-    // Open log file
-    FILE *log_file = fopen("system_log.txt", "a"); 
-    if (log_file == NULL) {
-        remove("log.lock");
-        return ;
+    unsigned char record[LOG_MESSAGE_SIZE];
+
+    // a new segment of system_log.bin gets the definition again, so every segment decodes on its own
+    unsigned int generation = log_segment_generation(LOG_RECORD_BINARY);
+    if (state == LOG_FORMAT_DEFINED && __atomic_load_n(&format->segment, __ATOMIC_RELAXED) != generation)
+        state = LOG_FORMAT_PARSED;
+
+    // definition goes first, if it can not be queued the next call tries again
+    if (state == LOG_FORMAT_PARSED) {
+        size_t prefix_length = format_log_prefix(format, (char *)record + BINARY_LOG_HEADER_SIZE, BINARY_LOG_MAX_PAYLOAD + 1, true);
+        size_t length = prefix_length + strlen(fmt);
+        memcpy(record + BINARY_LOG_HEADER_SIZE + prefix_length, fmt, length - prefix_length);
+        write_binary_header(record, format->id, length, BINARY_LOG_DEFINITION);
+        if (submit_binary_record(record, BINARY_LOG_HEADER_SIZE + length)) {
+            __atomic_store_n(&format->segment, generation, __ATOMIC_RELAXED);
+            __atomic_store_n(&format->state, LOG_FORMAT_DEFINED, __ATOMIC_RELEASE);
+        }
+    }
+
+    size_t payload_length = encode_log_arguments(format, args, record + BINARY_LOG_HEADER_SIZE);
+    write_binary_header(record, format->id, payload_length, BINARY_LOG_ENTRY);
+    submit_binary_record(record, BINARY_LOG_HEADER_SIZE + payload_length);
+}
+
+/**
+ * First call of a call site, finds the argument types of the format and its id,
+ * the module prefix of level macros is part of the format so it is hashed too
+ * \return new state of the call site
+ */
+static int parse_log_format(Log_Format *format, const char *fmt){
+    unsigned char types[LOG_MAX_ARGUMENTS];
+    unsigned int count = 0;
+    char prefix[LOG_MESSAGE_SIZE];
+    size_t prefix_length = format_log_prefix(format, prefix, sizeof(prefix), true);
+    int state = prefix_length + strlen(fmt) <= BINARY_LOG_MAX_PAYLOAD ? LOG_FORMAT_PARSED : LOG_FORMAT_TEXT_ONLY;
+
+    Log_Conversion conversion;
+    const char *next = fmt;
+    while (state == LOG_FORMAT_PARSED && (next = scan_log_conversion(next, &conversion)) != NULL) {
+        if (conversion.type == LOG_ARGUMENT_INVALID || count + (unsigned int)conversion.star_count + 1 > LOG_MAX_ARGUMENTS) {
+            state = LOG_FORMAT_TEXT_ONLY;
+            break;
+        }
+        if (conversion.type == LOG_ARGUMENT_NONE)
+            continue;
+        for (int star = 0; star < conversion.star_count; star++)
+            types[count++] = LOG_ARGUMENT_INT;
+        types[count++] = (unsigned char)conversion.type;
+    }
+
+    // threads racing on the first call all come to the same result
+    memcpy(format->argument_types, types, count);
+    format->argument_count = (unsigned char)count;
+    format->id = hash_log_format(hash_log_format(FNV_OFFSET_BASIS, prefix), fmt);
+    __atomic_store_n(&format->state, state, __ATOMIC_RELEASE);
+    return state;
+}
+
+/**
+ * Finds the next conversion of a printf format string
+ * \param fmt where to start looking
+ * \param conversion filled with the conversion found
+ * \return where to look for the next one, NULL if there is none left
+ */
+static const char *scan_log_conversion(const char *fmt, Log_Conversion *conversion){
+    const char *cursor = strchr(fmt, '%');
+    if (cursor == NULL)
+        return NULL;
+
+    conversion->start = cursor++;
+    conversion->star_count = 0;
+    conversion->type = LOG_ARGUMENT_INVALID;
+
+    if (*cursor == '%') {
+        conversion->type = LOG_ARGUMENT_NONE;
+        conversion->length = 2;
+        return cursor + 1;
+    }
+
+    // flags, width and precision
+    while (*cursor != '\0' && strchr("-+ #0'", *cursor) != NULL)
+        cursor++;
+    for (int part = 0; part < 2; part++) {
+        if (part == 1) {
+            if (*cursor != '.')
+                break;
+            cursor++;
+        }
+        if (*cursor == '*') {
+            conversion->star_count++;
+            cursor++;
+        }
+        while (*cursor >= '0' && *cursor <= '9')
+            cursor++;
+    }
+
+    // length modifier, h and hh are promoted to int anyway
+    enum Log_Argument_type integer = LOG_ARGUMENT_INT;
+    bool is_long_double = false;
+    bool is_wide = false;
+    if (cursor[0] == 'h')
+        cursor += cursor[1] == 'h' ? 2 : 1;
+    else if (cursor[0] == 'l' && cursor[1] == 'l')
+        integer = LOG_ARGUMENT_LONG_LONG, cursor += 2;
+    else if (cursor[0] == 'l')
+        integer = LOG_ARGUMENT_LONG, is_wide = true, cursor++;
+    else if (cursor[0] == 'z')
+        integer = LOG_ARGUMENT_SIZE, cursor++;
+    else if (cursor[0] == 'j')
+        integer = LOG_ARGUMENT_INTMAX, cursor++;
+    else if (cursor[0] == 't')
+        integer = LOG_ARGUMENT_PTRDIFF, cursor++;
+    else if (cursor[0] == 'L')
+        is_long_double = true, cursor++;
+
+    switch (*cursor) {
+    case 'd': case 'i': case 'u': case 'o': case 'x': case 'X':
+        conversion->type = is_long_double ? LOG_ARGUMENT_INVALID : integer;
+        break;
+    case 'c':
+        conversion->type = is_wide ? LOG_ARGUMENT_INVALID : LOG_ARGUMENT_INT;
+        break;
+    case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+        conversion->type = is_long_double ? LOG_ARGUMENT_INVALID : LOG_ARGUMENT_DOUBLE;
+        break;
+    case 's':
+        conversion->type = is_wide ? LOG_ARGUMENT_INVALID : LOG_ARGUMENT_STRING;
+        break;
+    case 'p':
+        conversion->type = LOG_ARGUMENT_POINTER;
+        break;
+    case '\0':
+        conversion->length = (size_t)(cursor - conversion->start);
+        return cursor;
+    default:
+        break;
+    }
+
+    conversion->length = (size_t)(cursor + 1 - conversion->start);
+    return cursor + 1;
+}
+
+/**
+ * Queues a binary record in async and shared mode, writes it to system_log.bin right away otherwise
+ * \return false if it was dropped
+ */
+static bool submit_binary_record(const unsigned char *record, size_t length){
+    Log_Ring *ring = __atomic_load_n(&log_ring, __ATOMIC_ACQUIRE);
+    if (ring != NULL) {
+        if (push_log_record(ring, LOG_RECORD_BINARY, (const char *)record, length))
+            return true;
+        __atomic_add_fetch(&dropped_log_count, 1, __ATOMIC_RELAXED);
+        return false;
+    }
+
+    struct iovec part = { (void *)record, length };
+    append_to_log(LOG_RECORD_BINARY, &part, 1);
+    return true;
+}
+
+static void write_binary_header(unsigned char *record, uint32_t id, size_t payload_length, int kind){
+    // shards are merged with their text lines, which are stamped with CLOCK_MONOTONIC
+    int record_clock = __atomic_load_n(&is_sharded_logging, __ATOMIC_RELAXED) ? BINARY_LOG_MONOTONIC : BINARY_LOG_REALTIME;
+    struct timespec now;
+    clock_gettime(record_clock == BINARY_LOG_MONOTONIC ? CLOCK_MONOTONIC : CLOCK_REALTIME, &now);
+    uint64_t timestamp_ns = (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+    uint16_t length = (uint16_t)payload_length;
+
+    memcpy(record, &timestamp_ns, 8);
+    memcpy(record + 8, &id, 4);
+    memcpy(record + 12, &length, 2);
+    record[14] = (unsigned char)kind;
+    record[15] = (unsigned char)record_clock;
+}
+
+/**
+ * Copies the raw arguments of a call into the payload of its record
+ * \return payload bytes used, at most BINARY_LOG_MAX_PAYLOAD
+ */
+static size_t encode_log_arguments(const Log_Format *format, va_list args, unsigned char *payload){
+    size_t length = 0;
+
+    for (unsigned int index = 0; index < format->argument_count; index++) {
+        size_t space = BINARY_LOG_MAX_PAYLOAD - length;
+        switch (format->argument_types[index]) {
+        case LOG_ARGUMENT_INT: {
+            int value = va_arg(args, int);
+            if (space < sizeof(int32_t))
+                return length;
+            int32_t stored = (int32_t)value;
+            memcpy(payload + length, &stored, sizeof(stored));
+            length += sizeof(stored);
+            break;
+        }
+        case LOG_ARGUMENT_STRING: {
+            const char *value = va_arg(args, const char *);
+            if (value == NULL)
+                value = "(null)";
+            if (space < sizeof(uint16_t))
+                return length;
+            uint16_t string_length = (uint16_t)strnlen(value, space - sizeof(uint16_t));
+            memcpy(payload + length, &string_length, sizeof(string_length));
+            memcpy(payload + length + sizeof(string_length), value, string_length);
+            length += sizeof(string_length) + string_length;
+            break;
+        }
+        default: {
+            // everything else fits a 64 bit word, stored as the type the decoder will read it as
+            unsigned char word[8];
+            switch (format->argument_types[index]) {
+            case LOG_ARGUMENT_LONG: { long long value = va_arg(args, long); memcpy(word, &value, 8); break; }
+            case LOG_ARGUMENT_LONG_LONG: { long long value = va_arg(args, long long); memcpy(word, &value, 8); break; }
+            case LOG_ARGUMENT_SIZE: { uint64_t value = va_arg(args, size_t); memcpy(word, &value, 8); break; }
+            case LOG_ARGUMENT_INTMAX: { int64_t value = va_arg(args, intmax_t); memcpy(word, &value, 8); break; }
+            case LOG_ARGUMENT_PTRDIFF: { int64_t value = va_arg(args, ptrdiff_t); memcpy(word, &value, 8); break; }
+            case LOG_ARGUMENT_DOUBLE: { double value = va_arg(args, double); memcpy(word, &value, 8); break; }
+            default: { uint64_t value = (uint64_t)(uintptr_t)va_arg(args, void *); memcpy(word, &value, 8); break; }
+            }
+            if (space < sizeof(word))
+                return length;
+            memcpy(payload + length, word, sizeof(word));
+            length += sizeof(word);
+            break;
+        }
+        }
+    }
+    return length;
+}
+
+/**
+ * Decoder side, formats one entry with the arguments stored in its payload
+ * \return length of the line
+ */
+static size_t render_log_entry(const char *fmt, const unsigned char *payload, size_t payload_length, char *line, size_t size){
+    size_t length = 0;
+    size_t offset = 0;
+    const char *literal = fmt;
+    Log_Conversion conversion;
+    const char *next;
+
+#define APPEND_TO_LINE(...) do { \
+        int written = snprintf(line + length, size - length, __VA_ARGS__); \
+        if (written > 0) \
+            length = length + (size_t)written < size ? length + (size_t)written : size - 1; \
+    } while (0)
+#define TAKE_FROM_PAYLOAD(value) (offset + sizeof(value) <= payload_length ? (memcpy(&(value), payload + offset, sizeof(value)), offset += sizeof(value), true) : false)
+
+    while ((next = scan_log_conversion(literal, &conversion)) != NULL) {
+        APPEND_TO_LINE("%.*s", (int)(conversion.start - literal), literal);
+        literal = next;
+        if (conversion.type == LOG_ARGUMENT_NONE) {
+            APPEND_TO_LINE("%%");
+            continue;
+        }
+
+        // the conversion again, with the stored width and precision in place of the stars
+        char spec[64];
+        size_t spec_length = 0;
+        bool is_complete = conversion.type != LOG_ARGUMENT_INVALID;
+        for (size_t index = 0; index < conversion.length && spec_length + 12 < sizeof(spec); index++) {
+            if (conversion.start[index] != '*') {
+                spec[spec_length++] = conversion.start[index];
+                continue;
+            }
+            int32_t star;
+            is_complete = is_complete && TAKE_FROM_PAYLOAD(star);
+            spec_length += (size_t)snprintf(spec + spec_length, sizeof(spec) - spec_length, "%d", is_complete ? (int)star : 0);
+        }
+        spec[spec_length] = '\0';
+
+        switch (is_complete ? conversion.type : LOG_ARGUMENT_INVALID) {
+        case LOG_ARGUMENT_INT: {
+            int32_t value;
+            if ((is_complete = TAKE_FROM_PAYLOAD(value)))
+                APPEND_TO_LINE(spec, (int)value);
+            break;
+        }
+        case LOG_ARGUMENT_STRING: {
+            uint16_t string_length;
+            if ((is_complete = TAKE_FROM_PAYLOAD(string_length) && offset + string_length <= payload_length)) {
+                char value[BINARY_LOG_MAX_PAYLOAD + 1];
+                memcpy(value, payload + offset, string_length);
+                value[string_length] = '\0';
+                offset += string_length;
+                APPEND_TO_LINE(spec, value);
+            }
+            break;
+        }
+        case LOG_ARGUMENT_LONG: { long long value; if ((is_complete = TAKE_FROM_PAYLOAD(value))) APPEND_TO_LINE(spec, (long)value); break; }
+        case LOG_ARGUMENT_LONG_LONG: { long long value; if ((is_complete = TAKE_FROM_PAYLOAD(value))) APPEND_TO_LINE(spec, value); break; }
+        case LOG_ARGUMENT_SIZE: { uint64_t value; if ((is_complete = TAKE_FROM_PAYLOAD(value))) APPEND_TO_LINE(spec, (size_t)value); break; }
+        case LOG_ARGUMENT_INTMAX: { int64_t value; if ((is_complete = TAKE_FROM_PAYLOAD(value))) APPEND_TO_LINE(spec, (intmax_t)value); break; }
+        case LOG_ARGUMENT_PTRDIFF: { int64_t value; if ((is_complete = TAKE_FROM_PAYLOAD(value))) APPEND_TO_LINE(spec, (ptrdiff_t)value); break; }
+        case LOG_ARGUMENT_DOUBLE: { double value; if ((is_complete = TAKE_FROM_PAYLOAD(value))) APPEND_TO_LINE(spec, value); break; }
+        case LOG_ARGUMENT_POINTER: { uint64_t value; if ((is_complete = TAKE_FROM_PAYLOAD(value))) APPEND_TO_LINE(spec, (void *)(uintptr_t)value); break; }
+        default:
+            is_complete = false;
+            break;
+        }
+
+        // record was cut short or the format is not the one it was logged with
+        if (!is_complete) {
+            APPEND_TO_LINE("<missing>");
+            return length;
+        }
     }
+    APPEND_TO_LINE("%s", literal);
+
+#undef APPEND_TO_LINE
+#undef TAKE_FROM_PAYLOAD
+    return length;
+}
+
+/**
+ * 32 bit FNV-1a of the format string, the same call site gets the same id in every process and run
+ * \param hash FNV_OFFSET_BASIS or the hash of the text before
+ */
+static uint32_t hash_log_format(uint32_t hash, const char *fmt){
+    for (; *fmt != '\0'; fmt++) {
+        hash ^= (unsigned char)*fmt;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/**
+ * "[module] LEVEL: " of the level macros, nothing for record_binary_log
+ * \param is_format escape '%' so the prefix can go in front of a format string
+ * \return length of the prefix, at most size - 1
+ */
+static size_t format_log_prefix(const Log_Format *format, char *prefix, size_t size, bool is_format){
+    size_t length = 0;
+    prefix[0] = '\0';
+    if (format->module == NULL)
+        return 0;
 
-    //writes the message to system log file
-    fprintf(log_file, "\n%s", message);
-    //close the system file
-    fclose(log_file);
-    remove("log.lock");
+    char text[LOG_MODULE_NAME_SIZE + 16];
+    int level = format->level >= LOG_LEVEL_DEBUG && format->level < LOG_LEVEL_NONE ? format->level : LOG_LEVEL_INFO;
+    snprintf(text, sizeof(text), "[%.*s] %s: ", LOG_MODULE_NAME_SIZE - 1, format->module, log_level_names[level]);
 
-}
\ No newline at end of file
+    for (const char *character = text; *character != '\0' && length + 2 < size; character++) {
+        if (is_format && *character == '%')
+            prefix[length++] = '%';
+        prefix[length++] = *character;
+    }
+    prefix[length] = '\0';
+    return length;
+}
+
+/**
+ * Looks a module up by name, log_modules_lock has to be held
+ * \param is_created add it with the default level if it is not there
+ * \return the module, NULL if it is not there or the table is full
+ */
+static Log_Module *find_log_module(const char *module, bool is_created){
+    for (unsigned int index = 0; index < log_module_count; index++)
+        if (!strncmp(log_modules[index].name, module, LOG_MODULE_NAME_SIZE - 1))
+            return &log_modules[index];
+
+    if (!is_created || log_module_count == LOG_MAX_MODULES)
+        return NULL;
+
+    Log_Module *entry = &log_modules[log_module_count];
+    snprintf(entry->name, sizeof(entry->name), "%s", module);
+    entry->level = default_log_level;
+    entry->has_own_level = false;
+    // call sites read the new entry without the lock once they have its pointer
+    __atomic_store_n(&log_module_count, log_module_count + 1, __ATOMIC_RELEASE);
+    return entry;
+}
+
+/**
+ * FSC_LOG_LEVEL="info,Navigation=debug,sensor lidar=none" sets the default and per module levels
+ */
+static void read_log_level_environment(void){
+    const char *setting = getenv("FSC_LOG_LEVEL");
+    if (setting == NULL)
+        return;
+
+    while (*setting != '\0') {
+        size_t length = strcspn(setting, ",");
+        const char *equals = memchr(setting, '=', length);
+
+        if (equals == NULL) {
+            int level = parse_log_level(setting, length);
+            if (level >= 0)
+                default_log_level = level;
+        }
+        else {
+            int level = parse_log_level(equals + 1, length - (size_t)(equals + 1 - setting));
+            char module[LOG_MODULE_NAME_SIZE];
+            snprintf(module, sizeof(module), "%.*s", (int)(equals - setting), setting);
+
+            // the default may still come later in the string, module levels are kept apart
+            Log_Module *entry = level >= 0 ? find_log_module(module, true) : NULL;
+            if (entry != NULL) {
+                entry->level = level;
+                entry->has_own_level = true;
+            }
+        }
+
+        setting += length;
+        if (*setting == ',')
+            setting++;
+    }
+
+    for (unsigned int index = 0; index < log_module_count; index++)
+        if (!log_modules[index].has_own_level)
+            log_modules[index].level = default_log_level;
+}
+
+/**
+ * \return level with this name (debug, info, warning, error, none or its number), -1 if unknown
+ */
+static int parse_log_level(const char *name, size_t length){
+    for (int level = LOG_LEVEL_DEBUG; level <= LOG_LEVEL_NONE; level++)
+        if (strlen(log_level_names[level]) == length && !strncasecmp(name, log_level_names[level], length))
+            return level;
+
+    if (length == 1 && name[0] >= '0' && name[0] <= '0' + LOG_LEVEL_NONE)
+        return name[0] - '0';
+    return -1;
+}
@@ -1,7 +1,140 @@
 #ifndef Mutex_Logging_H
 #define Mutex_Logging_H
 
+#include <stdio.h>
+#include <stdint.h>
+#include "log_levels.h"
+
+// tag of the log lines of a translation unit, define it before including this header
+#ifndef LOG_MODULE
+#define LOG_MODULE "main"
+#endif
+
+#define LOG_FILE_NAME "system_log.txt"
+// records of record_binary_log, rendered by log_decode
+#define BINARY_LOG_FILE_NAME "system_log.bin"
+
+// sharded mode, every process writes its own system_log.<pid>.txt and system_log.<pid>.bin, log_merge merges them
+#define LOG_SHARD_PREFIX "system_log."
+#define LOG_SHARD_SUFFIX ".txt"
+#define BINARY_LOG_SHARD_SUFFIX ".bin"
+
+// a log file that grew past this is sealed as a numbered segment (system_log.txt.000001), set_log_rotation changes it
+#define LOG_SEGMENT_SIZE (16ULL * 1024 * 1024)
+// sealed segments are compressed, the oldest are deleted while all of them together are larger than this
+#define LOG_RETENTION_SIZE (256ULL * 1024 * 1024)
+
+// longest message async mode keeps, including the terminating zero, also the largest binary record
+#define LOG_MESSAGE_SIZE 256
+// most arguments, '*' width and precision included, one record_binary_log call can carry
+#define LOG_MAX_ARGUMENTS 16
+
+// module names longer than this are cut
+#define LOG_MODULE_NAME_SIZE 32
+// modules with their own runtime level, later ones share the default level
+#define LOG_MAX_MODULES 32
+
+// call site of record_binary_log and the level macros, filled on its first call
+typedef struct Log_Format {
+    int state;
+    uint32_t id;                // hash of the format string
+    unsigned char argument_count;
+    unsigned char argument_types[LOG_MAX_ARGUMENTS];
+    const char *module;         // level macros only, NULL for record_binary_log
+    int level;
+    const int *threshold;       // runtime level of the module, looked up on the first call
+    unsigned int segment;       // generation of system_log.bin the definition went to, a new segment gets it again
+} Log_Format;
 
 void record_log(char message[]);
 
-#endif
\ No newline at end of file
+// async mode, record_log only queues the message and a background thread writes them out in batches
+int start_async_logging(void);
+// shared mode, every process queues into one shared memory ring and one of them writes it out
+int start_shared_logging(void);
+// sharded mode, async mode into a shard of this process, lines are stamped with CLOCK_MONOTONIC
+int start_sharded_logging(void);
+// leaves any of the modes above, queued messages are written out first
+void stop_logging(void);
+// older name of stop_logging
+void stop_async_logging(void);
+unsigned long long get_dropped_log_count(void);
+// size capped log files, 0 segment size lets them grow without limit
+void set_log_rotation(unsigned long long segment_size, unsigned long long retention_size);
+
+// deferred formatting, logs the format id, a timestamp and the raw arguments, log_decode renders them later
+// record_binary_log("[Navigation]: read packet %d from %s", packet_id, path);
+#define record_binary_log(...) do { \
+        static Log_Format log_format_ = { 0, 0, 0, { 0 }, NULL, LOG_LEVEL_INFO, NULL, 0 }; \
+        record_binary_log_format(&log_format_, __VA_ARGS__); \
+    } while (0)
+
+// levelled logging tagged with LOG_MODULE, log_debug("read %d", id)
+// levels below LOG_COMPILE_LEVEL are removed with their arguments, the rest is checked against the
+// runtime level of the module (set_log_level or FSC_LOG_LEVEL="debug,Navigation=warning").
+// Every level is formatted right away into system_log.txt as "[module] LEVEL: message"
+#define LOG_AT_LEVEL(log_level, ...) do { \
+        static Log_Format log_format_ = { 0, 0, 0, { 0 }, LOG_MODULE, log_level, NULL, 0 }; \
+        const int *log_threshold_ = __atomic_load_n(&log_format_.threshold, __ATOMIC_ACQUIRE); \
+        if (log_threshold_ == NULL) \
+            log_threshold_ = resolve_log_threshold(&log_format_); \
+        if ((log_level) >= __atomic_load_n(log_threshold_, __ATOMIC_RELAXED)) \
+            record_log_at_level(&log_format_, __VA_ARGS__); \
+    } while (0)
+
+// 1 sends log_debug lines to system_log.bin like record_binary_log instead, only the arguments are stored
+// and the lines are missing from system_log.txt until log_decode renders them (make LOG_DEFERRED_DEBUG=1)
+#ifndef LOG_DEFERRED_DEBUG
+#define LOG_DEFERRED_DEBUG 0
+#endif
+
+#if LOG_COMPILE_LEVEL <= LOG_LEVEL_DEBUG
+#define log_debug(...) LOG_AT_LEVEL(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#else
+#define log_debug(...) ((void)0)
+#endif
+#if LOG_COMPILE_LEVEL <= LOG_LEVEL_INFO
+#define log_info(...) LOG_AT_LEVEL(LOG_LEVEL_INFO, __VA_ARGS__)
+#else
+#define log_info(...) ((void)0)
+#endif
+#if LOG_COMPILE_LEVEL <= LOG_LEVEL_WARNING
+#define log_warning(...) LOG_AT_LEVEL(LOG_LEVEL_WARNING, __VA_ARGS__)
+#else
+#define log_warning(...) ((void)0)
+#endif
+#if LOG_COMPILE_LEVEL <= LOG_LEVEL_ERROR
+#define log_error(...) LOG_AT_LEVEL(LOG_LEVEL_ERROR, __VA_ARGS__)
+#else
+#define log_error(...) ((void)0)
+#endif
+
+void record_binary_log_format(Log_Format *format, const char *fmt, ...)
+#ifdef __GNUC__
+    __attribute__((format(printf, 2, 3)))
+#endif
+    ;
+void record_log_at_level(Log_Format *format, const char *fmt, ...)
+#ifdef __GNUC__
+    __attribute__((format(printf, 2, 3)))
+#endif
+    ;
+const int *resolve_log_threshold(Log_Format *format);
+// runtime level of a module, NULL module for the default of every module without its own
+int set_log_level(const char *module, int level);
+int decode_binary_log(FILE *input, FILE *output);
+
+// entry of a binary log, rendered
+typedef struct Log_Entry {
+    uint64_t timestamp_ns;
+    int is_monotonic;           // sharded mode stamps CLOCK_MONOTONIC, the other modes CLOCK_REALTIME
+    char line[4 * LOG_MESSAGE_SIZE];
+} Log_Entry;
+
+// streaming decoder of a binary log, remembers the format definitions it read
+typedef struct Log_Decoder Log_Decoder;
+Log_Decoder *create_log_decoder(void);
+void free_log_decoder(Log_Decoder *decoder);
+int read_binary_log_entry(Log_Decoder *decoder, FILE *input, Log_Entry *entry);
+
+#endif
@@ -1,17 +1,547 @@
+#define _GNU_SOURCE
+
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <libgen.h>
+#include <pthread.h>
+#include <sys/wait.h>
+#define LOG_MODULE "test"
 #include "mutex_logging.h"
 
+// lines logged in async mode, less than the ring holds so none may be dropped
+#define ORDER_TEST_MESSAGES 1000
+// lines each forked producer logs in shared mode
+#define SHARED_TEST_MESSAGES 500
+// binary records logged in async mode
+#define BINARY_TEST_MESSAGES 100
+// synchronous lines logged into small segments, hex noise keeps them from compressing to nothing
+#define ROTATION_TEST_MESSAGES 20000
+#define ROTATION_TEST_SEGMENT_SIZE (64 * 1024)
+#define ROTATION_TEST_RETENTION_SIZE (128 * 1024)
+// how long the background compressor gets to catch up
+#define ROTATION_TEST_TIMEOUT_MS 5000
+// text lines and binary records each forked producer logs in sharded mode
+#define SHARDED_TEST_MESSAGES 200
+// threads logging into one shard at once and the text lines and binary records each of them logs. Far more than
+// the ring holds, a thread stopped between stamping and claiming its record is what puts a shard out of order
+#define SHARD_ORDER_TEST_THREADS 8
+#define SHARD_ORDER_TEST_MESSAGES 20000
+#define TEST_LINE_SIZE (4 * LOG_MESSAGE_SIZE)
+
+// runtime levels the levels test starts with, read on the first level macro of the process
+#define TEST_LOG_LEVELS "warning,test=debug,other=error"
+
+static int failed_checks = 0;
+static char log_merge_command[PATH_MAX + 2];   // log_merge is built next to this test, quoted for the shell
+
+static void check(bool is_passed, const char *description);
+static void run_in_directory(void (*test)(void));
+static void remove_directory(const char *path);
+static void test_async_order(void);
+static void test_shared_producers(void);
+static void test_binary_round_trip(void);
+static void test_levels(void);
+static void test_rotation(void);
+static void test_sharded_merge(void);
+static void test_shard_order(void);
+static void *log_into_shard(void *argument);
+static bool is_text_shard_ordered(const char *path, int *line_count);
+static bool is_binary_shard_ordered(const char *path, int *record_count);
+static void log_other_module(void);
+static int count_lines_in_order(const char *path, const char *marker);
+static bool has_line(const char *path, const char *marker);
+static bool wait_for_retention(unsigned int *newest_segment, unsigned int *oldest_segment);
+
+static long long monotonic_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+int main(int argc, char *argv[]) {
+    (void)argc;
+    char self[PATH_MAX];
+    if (realpath(argv[0], self) == NULL) {
+        printf("failed to find the directory of %s\n", argv[0]);
+        return 1;
+    }
+    snprintf(log_merge_command, sizeof(log_merge_command), "'%.*s/log_merge'", PATH_MAX - 16, dirname(self));
+    setenv("FSC_LOG_LEVEL", TEST_LOG_LEVELS, 1);
+
+    run_in_directory(test_async_order);
+    run_in_directory(test_shared_producers);
+    run_in_directory(test_binary_round_trip);
+    run_in_directory(test_levels);
+    run_in_directory(test_rotation);
+    run_in_directory(test_sharded_merge);
+    run_in_directory(test_shard_order);
+
+    printf("result: %s\n", failed_checks == 0 ? "PASS" : "FAIL");
+    return failed_checks != 0;
+}
+
+static void check(bool is_passed, const char *description) {
+    printf("%s: %s\n", is_passed ? "PASS" : "FAIL", description);
+    if (!is_passed)
+        failed_checks++;
+}
+
+/**
+ * Runs the test in a child working in an empty directory of its own, log files stay open for the life
+ * of a process and are created in the working directory, a fresh child starts with none of them
+ */
+static void run_in_directory(void (*test)(void)) {
+    char directory[] = "/tmp/mutex_logging_test.XXXXXX";
+    if (mkdtemp(directory) == NULL) {
+        check(false, "create a test directory");
+        return;
+    }
+
+    fflush(stdout);
+    pid_t child = fork();
+    if (child == 0) {
+        if (chdir(directory))
+            exit(1);
+        test();
+        fflush(stdout);
+        _exit(failed_checks);
+    }
+
+    int status;
+    if (child < 0 || waitpid(child, &status, 0) < 0 || !WIFEXITED(status))
+        check(false, "test process exits");
+    else
+        failed_checks += WEXITSTATUS(status);
+    remove_directory(directory);
+}
+
+static void remove_directory(const char *path) {
+    DIR *directory = opendir(path);
+    if (directory == NULL)
+        return;
+
+    struct dirent *entry;
+    char file_path[PATH_MAX];
+    while ((entry = readdir(directory)) != NULL) {
+        if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, ".."))
+            continue;
+        snprintf(file_path, sizeof(file_path), "%s/%s", path, entry->d_name);
+        unlink(file_path);
+    }
+    closedir(directory);
+    rmdir(path);
+}
+
+/**
+ * Async mode writes every queued line, in the order they were logged
+ */
+static void test_async_order(void) {
+    char message[LOG_MESSAGE_SIZE];
+    if (start_async_logging()) {
+        check(false, "start async logging");
+        return;
+    }
+    for (int i = 0; i < ORDER_TEST_MESSAGES; i++) {
+        snprintf(message, sizeof(message), "order test %d", i);
+        record_log(message);
+    }
+    stop_logging();
+
+    check(get_dropped_log_count() == 0, "async mode drops nothing while the ring has room");
+    check(count_lines_in_order(LOG_FILE_NAME, "order test ") == ORDER_TEST_MESSAGES, "async mode writes every line to system_log.txt in order");
+}
+
+/**
+ * Two forked producers in shared mode end up in one system_log.txt, written by whichever is the aggregator.
+ * The ring is one per machine, another program in shared mode at the same time could become the aggregator.
+ */
+static void test_shared_producers(void) {
+    pid_t producers[2];
+    for (int producer = 0; producer < 2; producer++) {
+        producers[producer] = fork();
+        if (producers[producer] < 0) {
+            check(false, "fork the shared mode producers");
+            return;
+        }
+        if (producers[producer] > 0)
+            continue;
+
+        if (start_shared_logging())
+            _exit(1);
+        char message[LOG_MESSAGE_SIZE];
+        for (int i = 0; i < SHARED_TEST_MESSAGES; i++) {
+            snprintf(message, sizeof(message), "producer %d line %d", producer, i);
+            record_log(message);
+        }
+        stop_logging();
+        _exit(get_dropped_log_count() != 0);
+    }
+
+    bool is_clean_exit = true;
+    for (int producer = 0; producer < 2; producer++) {
+        int status;
+        if (waitpid(producers[producer], &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            is_clean_exit = false;
+    }
+
+    check(is_clean_exit, "shared mode producers start and drop nothing");
+    check(count_lines_in_order(LOG_FILE_NAME, "producer 0 line ") == SHARED_TEST_MESSAGES, "first producer's lines are all in system_log.txt in order");
+    check(count_lines_in_order(LOG_FILE_NAME, "producer 1 line ") == SHARED_TEST_MESSAGES, "second producer's lines are all in system_log.txt in order");
+}
+
+/**
+ * Arguments of record_binary_log come out of the decoder rendered like printf would have
+ */
+static void test_binary_round_trip(void) {
+    char expected[TEST_LINE_SIZE];
+    record_binary_log("binary test %d%% of %*.*f at %s, %zu %lld %c %x %u", 50, 8, 2, 3.14159, "sync", sizeof(int), -1LL, 'x', 0xbeefu, 7u);
+    snprintf(expected, sizeof(expected), "binary test %d%% of %*.*f at %s, %zu %lld %c %x %u", 50, 8, 2, 3.14159, "sync", sizeof(int), -1LL, 'x', 0xbeefu, 7u);
+
+    if (start_async_logging()) {
+        check(false, "start async logging");
+        return;
+    }
+    for (int i = 0; i < BINARY_TEST_MESSAGES; i++)
+        record_binary_log("binary test %d of %d, range %.2f m at %s", i, BINARY_TEST_MESSAGES, i * 0.25, "async");
+    stop_logging();
+
+    FILE *input = fopen(BINARY_LOG_FILE_NAME, "rb");
+    Log_Decoder *decoder = create_log_decoder();
+    if (input == NULL || decoder == NULL) {
+        check(false, "open system_log.bin for decoding");
+        if (input != NULL)
+            fclose(input);
+        free_log_decoder(decoder);
+        return;
+    }
+
+    Log_Entry entry;
+    bool is_sync_entry_found = false;
+    int async_entries = 0;
+    char async_expected[TEST_LINE_SIZE];
+    while (read_binary_log_entry(decoder, input, &entry) > 0) {
+        if (!strcmp(entry.line, expected))
+            is_sync_entry_found = true;
+
+        snprintf(async_expected, sizeof(async_expected), "binary test %d of %d, range %.2f m at %s",
+            async_entries, BINARY_TEST_MESSAGES, async_entries * 0.25, "async");
+        if (!strcmp(entry.line, async_expected))
+            async_entries++;
+    }
+    fclose(input);
+    free_log_decoder(decoder);
+
+    check(is_sync_entry_found, "binary record decodes to the same text as snprintf of its arguments");
+    check(async_entries == BINARY_TEST_MESSAGES, "binary records logged in async mode decode in order");
+}
+
+/**
+ * Lines under the runtime level of their module are not written, FSC_LOG_LEVEL sets levels per module
+ * and set_log_level overrides them
+ */
+static void test_levels(void) {
+    log_debug("levels test debug of test");
+    log_info("levels test info of test");
+    log_other_module();
+    set_log_level(NULL, LOG_LEVEL_ERROR);
+    log_warning("levels test warning of test after the default changed");
+
+#if LOG_COMPILE_LEVEL <= LOG_LEVEL_DEBUG
+    check(has_line(LOG_FILE_NAME, "[test] DEBUG: levels test debug of test"), "FSC_LOG_LEVEL test=debug lets debug lines of its module through");
+#else
+    check(!has_line(LOG_FILE_NAME, "levels test debug of test"), "debug lines below LOG_COMPILE_LEVEL are compiled out");
+#endif
+    check(has_line(LOG_FILE_NAME, "[test] INFO: levels test info of test"), "info lines of a module at debug are written");
+    check(!has_line(LOG_FILE_NAME, "levels test warning of other"), "FSC_LOG_LEVEL other=error filters warnings of its module");
+    check(has_line(LOG_FILE_NAME, "[other] ERROR: levels test error of other"), "errors of a module at error level are written");
+    check(has_line(LOG_FILE_NAME, "[other] INFO: levels test info of other after set_log_level"), "set_log_level overrides the level FSC_LOG_LEVEL set");
+    check(has_line(LOG_FILE_NAME, "levels test warning of test after the default changed"), "changing the default leaves modules with their own level alone");
+}
+
+/**
+ * Sealed segments are numbered and compressed, retention deletes the oldest ones
+ */
+static void test_rotation(void) {
+    char message[LOG_MESSAGE_SIZE];
+    unsigned int seed = 1;
+
+    set_log_rotation(ROTATION_TEST_SEGMENT_SIZE, ROTATION_TEST_RETENTION_SIZE);
+    for (int i = 0; i < ROTATION_TEST_MESSAGES; i++) {
+        snprintf(message, sizeof(message), "rotation test %05d %08x%08x%08x%08x", i, rand_r(&seed), rand_r(&seed), rand_r(&seed), rand_r(&seed));
+        record_log(message);
+    }
+
+    unsigned int newest_segment = 0;
+    unsigned int oldest_segment = 0;
+    bool is_retained = wait_for_retention(&newest_segment, &oldest_segment);
+    printf("rotation: segments %u to %u left\n", oldest_segment, newest_segment);
+
+    check(newest_segment > 1, "log file is sealed into numbered segments");
+    check(is_retained, "sealed segments are compressed to .gz and kept under the retention size");
+    check(oldest_segment > 1, "retention deletes the oldest segments");
+}
+
+/**
+ * Shards of two forked producers merge into one timestamp ordered view, every line tagged with its pid
+ */
+static void test_sharded_merge(void) {
+    pid_t producers[2];
+    for (int producer = 0; producer < 2; producer++) {
+        producers[producer] = fork();
+        if (producers[producer] < 0) {
+            check(false, "fork the sharded mode producers");
+            return;
+        }
+        if (producers[producer] > 0)
+            continue;
+
+        if (start_sharded_logging())
+            _exit(1);
+        char message[LOG_MESSAGE_SIZE];
+        for (int i = 0; i < SHARDED_TEST_MESSAGES; i++) {
+            snprintf(message, sizeof(message), "sharded line %d", i);
+            record_log(message);
+            record_binary_log("sharded binary %d", i);
+        }
+        stop_logging();
+        _exit(get_dropped_log_count() != 0);
+    }
+    for (int producer = 0; producer < 2; producer++)
+        waitpid(producers[producer], NULL, 0);
+
+    FILE *merged = popen(log_merge_command, "r");
+    if (merged == NULL) {
+        check(false, "run log_merge");
+        return;
+    }
+
+    char line[TEST_LINE_SIZE];
+    unsigned long long previous_ns = 0;
+    bool is_ordered = true;
+    bool is_tagged = true;
+    int lines[2] = { 0, 0 };
+    int records[2] = { 0, 0 };
+    while (fgets(line, sizeof(line), merged) != NULL) {
+        unsigned long long seconds, nanoseconds;
+        long pid;
+        int offset = 0;
+        if (sscanf(line, "[%llu.%llu] [%ld] %n", &seconds, &nanoseconds, &pid, &offset) != 3 || offset == 0) {
+            is_tagged = false;
+            continue;
+        }
+
+        unsigned long long timestamp_ns = seconds * 1000000000ULL + nanoseconds;
+        if (timestamp_ns < previous_ns)
+            is_ordered = false;
+        previous_ns = timestamp_ns;
+
+        int producer = pid == (long)producers[0] ? 0 : pid == (long)producers[1] ? 1 : -1;
+        if (producer < 0)
+            is_tagged = false;
+        else if (strstr(line + offset, "sharded line ") != NULL)
+            lines[producer]++;
+        else if (strstr(line + offset, "sharded binary ") != NULL)
+            records[producer]++;
+    }
+    bool is_merged = pclose(merged) == 0;
+
+    check(is_merged, "log_merge reads the shards");
+    check(is_ordered, "log_merge output is ordered by timestamp");
+    check(is_tagged, "every merged line is tagged with the pid of its shard");
+    check(lines[0] == SHARDED_TEST_MESSAGES && lines[1] == SHARDED_TEST_MESSAGES, "text lines of both shards are merged");
+    check(records[0] == SHARDED_TEST_MESSAGES && records[1] == SHARDED_TEST_MESSAGES, "binary records of both shards are merged");
+}
+
+/**
+ * Lines several threads log into one shard at the same time are written in the order of their stamps,
+ * log_merge only merges the shards and takes each of them as sorted. A thread has to be preempted at the
+ * wrong moment for it to go wrong, so a broken ring does not fail this on every run
+ */
+static void test_shard_order(void) {
+    if (start_sharded_logging()) {
+        check(false, "start sharded logging");
+        return;
+    }
+    pthread_t threads[SHARD_ORDER_TEST_THREADS];
+    int started = 0;
+    while (started < SHARD_ORDER_TEST_THREADS && pthread_create(&threads[started], NULL, log_into_shard, NULL) == 0)
+        started++;
+    for (int index = 0; index < started; index++)
+        pthread_join(threads[index], NULL);
+    stop_logging();
+
+    char text_path[64];
+    char binary_path[64];
+    snprintf(text_path, sizeof(text_path), LOG_SHARD_PREFIX "%ld" LOG_SHARD_SUFFIX, (long)getpid());
+    snprintf(binary_path, sizeof(binary_path), LOG_SHARD_PREFIX "%ld" BINARY_LOG_SHARD_SUFFIX, (long)getpid());
+    int line_count = 0;
+    int record_count = 0;
+    bool is_text_ordered = is_text_shard_ordered(text_path, &line_count);
+    bool is_binary_ordered = is_binary_shard_ordered(binary_path, &record_count);
+
+    unsigned long long logged = (unsigned long long)line_count + (unsigned long long)record_count + get_dropped_log_count();
+    check(started == SHARD_ORDER_TEST_THREADS, "start the logging threads");
+    check(logged == 2ULL * SHARD_ORDER_TEST_THREADS * SHARD_ORDER_TEST_MESSAGES, "every line and record of the threads is in the shard or counted as dropped");
+    check(is_text_ordered, "text shard lines are in stamp order");
+    check(is_binary_ordered, "binary shard records are in stamp order");
+}
+
+static void *log_into_shard(void *argument) {
+    (void)argument;
+    char message[LOG_MESSAGE_SIZE];
+    for (int i = 0; i < SHARD_ORDER_TEST_MESSAGES; i++) {
+        snprintf(message, sizeof(message), "shard order %d", i);
+        record_log(message);
+        record_binary_log("shard order binary %d", i);
+    }
+    return NULL;
+}
 
+static bool is_text_shard_ordered(const char *path, int *line_count) {
+    FILE *input = fopen(path, "r");
+    if (input == NULL)
+        return false;
+
+    char line[TEST_LINE_SIZE];
+    unsigned long long previous_ns = 0;
+    bool is_ordered = true;
+    while (fgets(line, sizeof(line), input) != NULL) {
+        unsigned long long seconds, nanoseconds;
+        if (sscanf(line, "[%llu.%llu]", &seconds, &nanoseconds) != 2)
+            continue;
+        unsigned long long timestamp_ns = seconds * 1000000000ULL + nanoseconds;
+        if (timestamp_ns < previous_ns)
+            is_ordered = false;
+        previous_ns = timestamp_ns;
+        (*line_count)++;
+    }
+    fclose(input);
+    return is_ordered;
+}
+
+static bool is_binary_shard_ordered(const char *path, int *record_count) {
+    FILE *input = fopen(path, "rb");
+    Log_Decoder *decoder = create_log_decoder();
+    bool is_ordered = input != NULL && decoder != NULL;
+
+    Log_Entry entry;
+    uint64_t previous_ns = 0;
+    while (is_ordered && read_binary_log_entry(decoder, input, &entry) > 0) {
+        if (entry.timestamp_ns < previous_ns)
+            is_ordered = false;
+        previous_ns = entry.timestamp_ns;
+        (*record_count)++;
+    }
+    if (input != NULL)
+        fclose(input);
+    free_log_decoder(decoder);
+    return is_ordered;
+}
+
+/**
+ * Counts the lines containing the marker followed by 0, 1, 2 ... in that order
+ * \return number of lines, -1 if one is missing or out of order
+ */
+static int count_lines_in_order(const char *path, const char *marker) {
+    FILE *input = fopen(path, "r");
+    if (input == NULL)
+        return -1;
+
+    char line[TEST_LINE_SIZE];
+    int count = 0;
+    while (fgets(line, sizeof(line), input) != NULL) {
+        const char *found = strstr(line, marker);
+        if (found == NULL)
+            continue;
+        if (atoi(found + strlen(marker)) != count) {
+            count = -1;
+            break;
+        }
+        count++;
+    }
+    fclose(input);
+    return count;
+}
+
+static bool has_line(const char *path, const char *marker) {
+    FILE *input = fopen(path, "r");
+    if (input == NULL)
+        return false;
+
+    char line[TEST_LINE_SIZE];
+    bool is_found = false;
+    while (!is_found && fgets(line, sizeof(line), input) != NULL)
+        is_found = strstr(line, marker) != NULL;
+    fclose(input);
+    return is_found;
+}
+
+/**
+ * Waits for the compressor until every sealed segment is compressed and together they fit the retention size
+ * \param newest_segment receives the highest segment number left
+ * \param oldest_segment receives the lowest segment number left
+ * \return true if that happened in time
+ */
+static bool wait_for_retention(unsigned int *newest_segment, unsigned int *oldest_segment) {
+    long long deadline_ns = monotonic_ns() + ROTATION_TEST_TIMEOUT_MS * 1000000LL;
+    const struct timespec interval = { 0, 10 * 1000000L };
+
+    for (;;) {
+        DIR *directory = opendir(".");
+        if (directory == NULL)
+            return false;
+
+        bool is_all_compressed = true;
+        unsigned long long compressed_size = 0;
+        unsigned int compressed_count = 0;
+        *newest_segment = 0;
+        *oldest_segment = UINT_MAX;
+        struct dirent *entry;
+        while ((entry = readdir(directory)) != NULL) {
+            unsigned int number;
+            int length = 0;
+            if (sscanf(entry->d_name, LOG_FILE_NAME ".%6u%n", &number, &length) != 1 || length == 0)
+                continue;
+
+            if (number > *newest_segment)
+                *newest_segment = number;
+            if (number < *oldest_segment)
+                *oldest_segment = number;
+
+            FILE *segment = fopen(entry->d_name, "rb");
+            if (strcmp(entry->d_name + length, ".gz") || segment == NULL || fseek(segment, 0, SEEK_END)) {
+                is_all_compressed = false;
+            }
+            else {
+                compressed_size += (unsigned long long)ftell(segment);
+                compressed_count++;
+            }
+            if (segment != NULL)
+                fclose(segment);
+        }
+        closedir(directory);
+
+        if (is_all_compressed && compressed_count > 0 && compressed_size <= ROTATION_TEST_RETENTION_SIZE)
+            return true;
+        if (monotonic_ns() > deadline_ns)
+            return false;
+        nanosleep(&interval, NULL);
+    }
+}
 
-int main() {
-    record_log("test");
-    record_log("test");
-    record_log("test");
-    record_log("test");
-    record_log("test");
-    record_log("test");
+// module with a level of its own, FSC_LOG_LEVEL sets it to error
+#undef LOG_MODULE
+#define LOG_MODULE "other"
 
-    getchar(); // stops the command window from closing after its done
-    return 0;
+static void log_other_module(void) {
+    log_warning("levels test warning of other");
+    log_error("levels test error of other");
+    set_log_level("other", LOG_LEVEL_INFO);
+    log_info("levels test info of other after set_log_level");
 }
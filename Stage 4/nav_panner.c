@@ -3,22 +3,29 @@
  * Stage 2: Two-way two process IPC
  * Created by: Dominic, Karl
  *
- * This acts as the data consumer (Navigation Planner).
- * 1. Waits for the sender (Process A) to signal data is ready (by checking for data_ready.flag).
- * 2. Deletes the data_ready.flag (consumes the signal).
- * 3. Reads the data from lidar_data.txt.
- * 4. Repeats in a loop.
+ * This consumes the lidar data and produces the motor commands (Navigation Planner).
+ * 1. Reads the newest Lidar_Packet from the lidar_data latest value stream in shared memory (read_struct).
+ * 2. Sends a Motor_Command to the motor_commands latest value file stream once a second (send_struct, rate_hz).
+ * 3. Both streams are updated on 2 update workers, a slow scan never holds back a command.
+ * 4. Repeats until SIGINT/SIGTERM, then closes the streams and stops the sharded logging.
  *
  * This is over engineered implementation of the stage 2 solution for receiver.
  * All the file manipulation and data management is abstracted away and handled by file_system_communication.c
- * It gives us ability to send data, manage multiple sending and reading streams
- * and prevents race conditions by using flags and acs
+ * through a Fsc_Context, it gives us ability to send and read data over files or shared memory
+ * and manage multiple sending and reading streams
  */
 
+// rand_r and flockfile
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
+#include <signal.h>
 #include "file_system_communication.h"
+#include "robot_messages.h"
+// tag of our log lines, has to come before mutex_logging.h
+#define LOG_MODULE "Navigation"
 #include "mutex_logging.h"
 
 //cross-platform sleep
@@ -33,55 +40,111 @@
 #define LIDAR_STREAM_NAME "lidar_data"
 #define MOTOR_STREAM_NAME "motor_commands"
 
-//polling interval (ms)
-#define POLL_INTERVAL_MS 1000
+//motor command rate (here 1 Hz - 1 command per second)
+#define MOTOR_COMMAND_RATE_HZ 1.0
 
 static int data_counter = 0;
+// state of the motor command generator, rand is not safe to call from the update workers
+static unsigned int motor_command_seed = 0;
+
+// cleared by SIGINT/SIGTERM, the main loop ends and the streams get closed properly
+static volatile sig_atomic_t is_running = 1;
 
-void main_loop();
+void main_loop(Fsc_Context *fsc);
+void stop_running(int signal_number);
 void receiving_data(Data_Stream *context);
 void sending_motor_commands(Data_Stream *context);
 
 int main()
 {
     //seeding RNG
-    srand(time(NULL));
+    motor_command_seed = (unsigned int)time(NULL);
+
+    // Ctrl+C stops the main loop instead of killing us, so the stream latencies get reported on close
+    signal(SIGINT, stop_running);
+    signal(SIGTERM, stop_running);
+
+    // log lines from the callbacks are only queued, every program writes its own shard (system_log.<pid>.txt) without
+    // waiting on the others, log_merge puts the shards back into one timeline
+    if(start_sharded_logging()){
+        fprintf(stderr, "Failed to start sharded logging, logging synchronously\n");
+    }
+
+    // every stream of this process lives in this context
+    Fsc_Context *fsc = fsc_context_create();
+    if(fsc == NULL){
+        fprintf(stderr, "We failed to create the framework context!\n");
+        log_error("We failed to create the framework context!");
+        return 1;
+    }
+
+    // FSC_TRACE_FILE=trace.json puts every callback into a Chrome trace, all three programs can share the file
+    const char *trace_path = getenv("FSC_TRACE_FILE");
+    if(trace_path != NULL && set_trace_output(fsc, trace_path, "nav_planner")){
+        fprintf(stderr, "Failed to open trace file %s, running without tracing\n", trace_path);
+    }
+
+    // lidar frames come through shared memory, has to match the transport used by sensor_lidar
+    Data_Stream_Options lidar_options = default_data_stream_options();
+    lidar_options.transport = SHARED_MEMORY_TRANSPORT;
 
     // We create the sending data stream with name sensor_lidar, and pass our handle function to the event handler
-    if(create_new_data_stream(LIDAR_STREAM_NAME, READ_ONLY_STREAM, receiving_data)){
+    // only the newest scan matters, scans we were too slow for are skipped
+    if(create_new_data_stream_with_options(fsc, LIDAR_STREAM_NAME, LATEST_VALUE_READ_STREAM, receiving_data, &lidar_options) == NULL){
         fprintf(stderr, "We failed to create new stream!\n");
-        record_log("[Navigation]: We failed to create new stream!");
+        log_error("We failed to create new stream!");
         return 1;
     }
 
-    if(create_new_data_stream(MOTOR_STREAM_NAME, WRITE_ONLY_STREAM, sending_motor_commands)){
+    // new commands go out at a fixed rate, independent of how often scans arrive
+    Data_Stream_Options motor_options = default_data_stream_options();
+    motor_options.rate_hz = MOTOR_COMMAND_RATE_HZ;
+
+    // motor controller should always act on our newest decision, it never waits for an ack
+    if(create_new_data_stream_with_options(fsc, MOTOR_STREAM_NAME, LATEST_VALUE_WRITE_STREAM, sending_motor_commands, &motor_options) == NULL){
         fprintf(stderr, "We failed to create new motor command stream!\n");
-        record_log( "[Navigation]: We failed to create new motor command stream!");
+        log_error("We failed to create new motor command stream!");
         return 1;
     }
 
+    // scan processing and motor commands run on their own workers, a slow scan never holds back a command
+    if(set_update_worker_threads(fsc, 2)){
+        fprintf(stderr, "Failed to start update workers, running single threaded\n");
+    }
+
     fprintf(stdout, "Process B (nav_planner) started.\n");
-    record_log("[Navigation]: Process B (nav_planner) started.\n");
+    log_info("Process B (nav_planner) started.");
     fprintf(stdout, "This process reads from %s using the File System Communication framework\n\n", LIDAR_STREAM_NAME);
 
     // Calling the main loop, program will hold here until its terminated 
-    main_loop();
+    main_loop(fsc);
 
+    fsc_context_destroy(fsc);
+    fprintf(stdout, "Process B (nav_planner) stopped.\n");
+    log_info("Process B (nav_planner) stopped.");
+    stop_logging();
     return 0;
 }
 
 /**
- * Main loop that loops through the main logic of the code
- * with selected interval
+ * Signal handler, lets the main loop finish its current round and return
  */
-void main_loop(){
-    while (1)
-    {
-        // Function provided by File System Communication framework that automatically invokes events when data is ready
-        update_streams();
+void stop_running(int signal_number)
+{
+    (void)signal_number;
+    is_running = 0;
+}
 
-        // Set sensor refresh rate (here 1 Hz - 1 sample per second)
-        sleep_ms(POLL_INTERVAL_MS);
+/**
+ * Main loop that loops through the main logic of the code,
+ * the framework keeps the rate of every stream
+ */
+void main_loop(Fsc_Context *fsc){
+    while (is_running)
+    {
+        // Function provided by File System Communication framework that automatically invokes events when data is ready,
+        // sleeps until a stream is due or data arrives
+        wait_and_update_streams(fsc, -1);
     }
 }
 
@@ -92,24 +155,37 @@ void main_loop(){
  */
 void receiving_data(Data_Stream *context)
 {
-    char line_buffer[256]; //a buffer memory to read lines from the data file
+    Lidar_Packet packet;
+
+    // runs on a worker next to sending_motor_commands, the lock keeps our lines together
+    flockfile(stdout);
 
     //---read the data ---
     fprintf(stdout, "\n\nReading data from %s...\n", context->data_file_path);
+    if (context->skipped_frames > 0)
+        fprintf(stdout, "Skipped %llu older scans\n", context->skipped_frames);
     
-    
-    printf("--- [DATA START] ---\n");
-    while (context->read_line(context, line_buffer, sizeof(line_buffer)) != NULL)
+    if (context->read_struct(context, &Lidar_Packet_descriptor, &packet))
     {
-        printf("  %s", line_buffer); // print the line (includes newline)
+        fprintf(stderr, "Frame from %s holds no lidar packet\n", context->data_file_path);
+        funlockfile(stdout);
+        return;
     }
+
+    printf("--- [DATA START] ---\n");
+    printf("  packet_id: %d\n", (int)packet.packet_id);
+    printf("  verifier_code: %d\n", (int)packet.verifier_code);
+    printf("  angle_min: %.2f\n", packet.angle_min);
+    printf("  angle_max: %.2f\n", packet.angle_max);
+    printf("  range_0: %.2f\n", packet.range_0);
+    printf("  range_1: %.2f\n", packet.range_1);
+    printf("  range_2: %.2f\n", packet.range_2);
     printf("--- [DATA END] ---\n");
+    funlockfile(stdout);
 
     
-    // log data
-    char log_message[255];
-    snprintf(log_message, sizeof(log_message), "[Navigation]: Successfully read data from %s.", context->data_file_path);
-    record_log(log_message);
+    // log data, per frame lines are debug level, make LOG_LEVEL=INFO compiles them out
+    log_debug("Successfully read data from %s.", context->data_file_path);
 }
 
 
@@ -119,23 +195,24 @@ void sending_motor_commands(Data_Stream *context)
 
     fprintf(stdout, "Writing data packet %d to %s...\n", data_counter, context->data_file_path);
 
-    // generate some LIDAR data
+    // generate some motor commands
+    Motor_Command command;
+    command.command_id = data_counter;
     // speed_left in range 0.0 to 1.0
-    double speed_left = (double)rand() / RAND_MAX * 1.0;
+    // only this callback uses the seed and a stream is on one worker at a time
+    command.speed_left = (double)rand_r(&motor_command_seed) / RAND_MAX * 1.0;
     // speed_right in range 0.0 to 1.0
-    double speed_right = (double)rand() / RAND_MAX * 1.0;
-
-    const char * direction = rand() > RAND_MAX / 2 ? "FORWARD" : "BACKWARD";
+    command.speed_right = (double)rand_r(&motor_command_seed) / RAND_MAX * 1.0;
+    command.direction = rand_r(&motor_command_seed) > RAND_MAX / 2 ? MOTOR_FORWARD : MOTOR_BACKWARD;
 
     // writing the data to the stream
-    context->send_line(context, "command_id: %d\n", data_counter);
-    context->send_line(context, "speed_left: %.2f\n", speed_left);
-    context->send_line(context, "speed_right: %.2f\n", speed_right);
-    context->send_line(context, "direction: %s\n", direction);
+    if (context->send_struct(context, &Motor_Command_descriptor, &command))
+    {
+        fprintf(stderr, "Failed to write data packet %d\n", data_counter);
+        return;
+    }
 
     
-    // log data
-    char log_message[255];
-    snprintf(log_message, sizeof(log_message), "[Navigation]: Successfully wrote data packet %d to %s.", data_counter, context->data_file_path);
-    record_log(log_message);
+    // log data, per frame lines are debug level, make LOG_LEVEL=INFO compiles them out
+    log_debug("Successfully wrote data packet %d to %s.", data_counter, context->data_file_path);
 }
\ No newline at end of file
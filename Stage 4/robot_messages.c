@@ -0,0 +1,12 @@
+/*******************************************************************************
+ * Title                 :   Robot Messages
+ * Filename              :   robot_messages.c
+ * Author                :   Dominic
+ * Origin Date           :   17/10/2026
+ * Version               :   0.0.1
+ * Notes                 :   Encoders, decoders and descriptors generated from robot_messages.h
+ *******************************************************************************/
+
+#include "robot_messages.h"
+
+ROBOT_MESSAGES(DEFINE_MESSAGE)
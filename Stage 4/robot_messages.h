@@ -0,0 +1,44 @@
+/****************************************************************************
+* Title                 :   Robot Messages
+* Filename              :   robot_messages.h
+* Author                :   Dominic
+* Origin Date           :   17/10/2026
+* Version               :   0.0.1
+* Notes                 :   Binary messages exchanged by sensor_lidar, nav_panner and motor_ctrl.
+*                           Add a field to the list and every struct, encoder and decoder follows,
+*                           both ends of a stream have to be rebuilt together.
+*****************************************************************************/
+#ifndef ROBOT_MESSAGES_H
+#define ROBOT_MESSAGES_H
+
+#include "message_schema.h"
+
+enum Motor_Direction
+{
+    MOTOR_FORWARD,
+    MOTOR_BACKWARD
+};
+
+#define LIDAR_PACKET_FIELDS(FIELD) \
+    FIELD(int32_t, packet_id) \
+    FIELD(int32_t, verifier_code) \
+    FIELD(double, angle_min) \
+    FIELD(double, angle_max) \
+    FIELD(double, range_0) \
+    FIELD(double, range_1) \
+    FIELD(double, range_2)
+
+#define MOTOR_COMMAND_FIELDS(FIELD) \
+    FIELD(int32_t, command_id) \
+    FIELD(double, speed_left) \
+    FIELD(double, speed_right) \
+    FIELD(int32_t, direction)   /* enum Motor_Direction */
+
+// every message of the robot, type ids have to stay unique and must not be reused
+#define ROBOT_MESSAGES(MESSAGE) \
+    MESSAGE(Lidar_Packet, 1, LIDAR_PACKET_FIELDS) \
+    MESSAGE(Motor_Command, 2, MOTOR_COMMAND_FIELDS)
+
+ROBOT_MESSAGES(DECLARE_MESSAGE)
+
+#endif
@@ -4,10 +4,9 @@
  * Created by: Dominic
  *
  * This acts as the data producer (LIDAR sensor).
- * 1. Waits for lidar_data.ack from the receiver unless its the first invocation of the stream
- * 2. Writes new simulated data to lidar_data.txt.
- * 3. Creates lidar_data.flag to signal that new data is available.
- * 4. Repeats in a loop.
+ * 1. Writes new simulated data to the lidar_data latest value stream in shared memory.
+ * 2. Never waits for the receiver, a newer scan simply replaces the previous one.
+ * 3. Repeats in a loop.
  *
  * This is over engineered implementation of the stage 2 solution.
  * All the file manipulation and data management is abstracted away and handled by file_system_communication.c
@@ -18,8 +17,12 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
+#include <signal.h>
 #include "file_system_communication.h"
-#include"mutex_logging.h"
+#include "robot_messages.h"
+// tag of our log lines, has to come before mutex_logging.h
+#define LOG_MODULE "sensor lidar"
+#include "mutex_logging.h"
 
 //cross-platform sleep
 #ifdef _WIN32
@@ -32,10 +35,14 @@
 
 #define LIDAR_STREAM_NAME "lidar_data"
 
-//polling interval (ms)
-#define POLL_INTERVAL_MS 1000
+//sensor refresh rate (here 1 Hz - 1 sample per second)
+#define LIDAR_RATE_HZ 1.0
 
-void main_loop();
+// cleared by SIGINT/SIGTERM, the main loop ends and the streams get closed properly
+static volatile sig_atomic_t is_running = 1;
+
+void main_loop(Fsc_Context *fsc);
+void stop_running(int signal_number);
 void sending_data(Data_Stream * context);
 
 static int data_counter = 0;
@@ -44,42 +51,83 @@ int main()
 {
     //seeding RNG
     srand(time(NULL));
+
+    // Ctrl+C stops the main loop instead of killing us, so the stream latencies get reported on close
+    signal(SIGINT, stop_running);
+    signal(SIGTERM, stop_running);
+
+    // log lines from the callbacks are only queued, every program writes its own shard (system_log.<pid>.txt) without
+    // waiting on the others, log_merge puts the shards back into one timeline
+    if(start_sharded_logging()){
+        fprintf(stderr, "Failed to start sharded logging, logging synchronously\n");
+    }
+
+    // every stream of this process lives in this context
+    Fsc_Context *fsc = fsc_context_create();
+    if(fsc == NULL){
+        fprintf(stderr, "We failed to create the framework context!\n");
+        log_error("We failed to create the framework context!");
+        return 1;
+    }
+
+    // FSC_TRACE_FILE=trace.json puts every callback into a Chrome trace, all three programs can share the file
+    const char *trace_path = getenv("FSC_TRACE_FILE");
+    if(trace_path != NULL && set_trace_output(fsc, trace_path, "sensor_lidar")){
+        fprintf(stderr, "Failed to open trace file %s, running without tracing\n", trace_path);
+    }
     
+    // lidar frames go through shared memory, the planner needs them with as little latency as possible
+    Data_Stream_Options lidar_options = default_data_stream_options();
+    lidar_options.transport = SHARED_MEMORY_TRANSPORT;
+    lidar_options.rate_hz = LIDAR_RATE_HZ;
+
     // We create the sending data stream with name sensor_lidar, and pass our handle function to the event handler
-    if(create_new_data_stream(LIDAR_STREAM_NAME, WRITE_ONLY_STREAM, sending_data)){
+    // only the newest scan matters, the planner should never work on a queued up old one
+    if(create_new_data_stream_with_options(fsc, LIDAR_STREAM_NAME, LATEST_VALUE_WRITE_STREAM, sending_data, &lidar_options) == NULL){
         fprintf(stderr, "We failed to create new stream!\n");
-        record_log("[sensor lidar]: We failed to create new stream!");
+        log_error("We failed to create new stream!");
         return 1;
     }
 
     fprintf(stdout, "Process A (sensor_lidar) started.\n");
-    record_log("[sensor lidar]: Process A (sensor_lidar) started.");
+    log_info("Process A (sensor_lidar) started.");
     fprintf(stdout, "This process writes to %s using the File System Communication framework\n", LIDAR_STREAM_NAME);
     
     // Calling the main loop, program will hold here until its terminated 
-    main_loop();
+    main_loop(fsc);
 
+    fsc_context_destroy(fsc);
+    fprintf(stdout, "Process A (sensor_lidar) stopped.\n");
+    log_info("Process A (sensor_lidar) stopped.");
+    stop_logging();
     return 0;
 }
 
 /**
- * Main loop that loops through the main logic of the code
- * with selected interval
+ * Signal handler, lets the main loop finish its current round and return
  */
-void main_loop(){
-    while (1)
-    {
-        // Function provided by File System Communication framework that automatically invokes events when data is ready
-        update_streams();
+void stop_running(int signal_number)
+{
+    (void)signal_number;
+    is_running = 0;
+}
 
-        // Set sensor refresh rate (here 1 Hz - 1 sample per second)
-        sleep_ms(POLL_INTERVAL_MS);
+/**
+ * Main loop that loops through the main logic of the code,
+ * the framework keeps the rate of every stream
+ */
+void main_loop(Fsc_Context *fsc){
+    while (is_running)
+    {
+        // Function provided by File System Communication framework that automatically invokes events when data is ready,
+        // sleeps until a stream is due or data arrives
+        wait_and_update_streams(fsc, -1);
     }
 }
 
 /**
  * This function is automatically called by the File System Communication framework,
- * when its the first call and when data has been read by the receiver.
+ * on every update, the previous scan is overwritten whether it was read or not.
  * It generates mock data and sends them using the provided framework
  */
 void sending_data(Data_Stream *context)
@@ -93,29 +141,28 @@ void sending_data(Data_Stream *context)
     
 
     // generate some LIDAR data
+    Lidar_Packet packet;
+    packet.packet_id = data_counter;
+    packet.verifier_code = verifier_code;
     // angle_min in range -2.0 to -1.0
-    double angle_min = -2.0 + (double)rand() / RAND_MAX * 1.0;
+    packet.angle_min = -2.0 + (double)rand() / RAND_MAX * 1.0;
     // angle_max in range 1.0 to 2.0
-    double angle_max = 1.0 + (double)rand() / RAND_MAX * 1.0;
+    packet.angle_max = 1.0 + (double)rand() / RAND_MAX * 1.0;
     // range readings between 5.0 and 15.0
-    double range_0 = 5.0 + (double)rand() / RAND_MAX * 10.0;
-    double range_1 = 5.0 + (double)rand() / RAND_MAX * 10.0;
-    double range_2 = 5.0 + (double)rand() / RAND_MAX * 10.0;
-
-    // writing the data to the stream
-    context->send_line(context, "packet_id: %d\n", data_counter);
-    context->send_line(context, "verifier_code: %d\n", verifier_code);
-    context->send_line(context, "angle_min: %.2f\n", angle_min);
-    context->send_line(context, "angle_max: %.2f\n", angle_max);
-    context->send_line(context, "range_0: %.2f\n", range_0);
-    context->send_line(context, "range_1: %.2f\n", range_1);
-    context->send_line(context, "range_2: %.2f\n", range_2);
+    packet.range_0 = 5.0 + (double)rand() / RAND_MAX * 10.0;
+    packet.range_1 = 5.0 + (double)rand() / RAND_MAX * 10.0;
+    packet.range_2 = 5.0 + (double)rand() / RAND_MAX * 10.0;
+
+    // writing the data to the stream, binary so the planner gets the exact values
+    if (context->send_struct(context, &Lidar_Packet_descriptor, &packet))
+    {
+        fprintf(stderr, "Failed to write data packet %d\n", data_counter);
+        return;
+    }
 
     
-    // log data
-    char log_message[255];
-    snprintf(log_message, sizeof(log_message), "[sensor lidar]: Successfully wrote data packet %d (Verify Code: %d) to %s.", data_counter, verifier_code, context->data_file_path);
-    record_log(log_message);
+    // log data, per frame lines are debug level, make LOG_LEVEL=INFO compiles them out
+    log_debug("Successfully wrote data packet %d (Verify Code: %d) to %s.", data_counter, verifier_code, context->data_file_path);
 }
 
 
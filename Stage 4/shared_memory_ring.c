@@ -0,0 +1,454 @@
+/*******************************************************************************
+ * Title                 :   Shared Memory Ring
+ * Filename              :   shared_memory_ring.c
+ * Author                :   Dominic
+ * Origin Date           :   17/10/2026
+ * Version               :   0.0.1
+ * Notes                 :   Single producer / single consumer ring in POSIX shared memory.
+ *                           Whichever side attaches first creates and initializes the segment,
+ *                           the other side waits (NOT_READY) until the magic is published.
+ *                           The producer unlinks the segment when it closes, a consumer notices
+ *                           with shared_memory_ring_is_replaced and attaches to the next one.
+ *                           After attaching, frames move without any syscalls, synchronization
+ *                           is done with acquire/release loads and stores on head and tail.
+ *                           Latest value mode ignores tail, the producer overwrites the oldest slot
+ *                           and marks it while writing so the consumer can detect torn copies.
+ *                           Publish and release bump an event counter that doubles as futex word,
+ *                           the futex wake syscall is only made when the other side is actually asleep.
+ *******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <limits.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+#include "shared_memory_ring.h"
+
+#define SHARED_MEMORY_RING_MAGIC 0x46534352u // "FSCR"
+#define CACHE_LINE_SIZE 64
+// copies of a latest value frame attempted before giving up until next update
+#define COPY_LATEST_ATTEMPTS 16
+
+static size_t _slot_stride(uint32_t slot_size);
+static size_t _segment_size(uint32_t slot_count, uint32_t slot_size);
+static unsigned char *_slot_at(Shared_Memory_Ring *ring, uint64_t sequence);
+static int _map_segment(Shared_Memory_Ring *ring, int fd, size_t size);
+static void _remember_segment(Shared_Memory_Ring *ring, const struct stat *info);
+static void _event_words(Shared_Memory_Ring *ring, enum Shared_Memory_Ring_Event event, uint32_t **events, uint32_t **waiters);
+
+/**
+ * Builds the shared memory object name for given stream, '/' is not allowed inside the name
+ * \param stream_name name of the stream
+ * \param shm_name buffer that receives the name
+ * \param size size of the buffer
+ */
+void shared_memory_ring_get_name(const char *stream_name, char *shm_name, size_t size)
+{
+    snprintf(shm_name, size, "%s%s", SHARED_MEMORY_RING_PREFIX, stream_name);
+
+    for (char *c = shm_name + 1; *c != '\0'; c++)
+    {
+        if (*c == '/')
+            *c = '_';
+    }
+}
+
+/**
+ * Maps the ring of given stream, creating the segment if it does not exist yet
+ * \param ring handle to fill in
+ * \param stream_name name of the stream, determines the shared memory object name
+ * \param slot_count number of frames the ring can hold
+ * \param slot_size maximum size of one frame in bytes
+ * \return SHARED_MEMORY_RING_ATTACHED on success, SHARED_MEMORY_RING_NOT_READY if the other
+ *         side is still initializing the segment (try again later), SHARED_MEMORY_RING_ERROR on failure
+ */
+int shared_memory_ring_attach(Shared_Memory_Ring *ring, const char *stream_name, uint32_t slot_count, uint32_t slot_size)
+{
+    size_t size = _segment_size(slot_count, slot_size);
+
+    memset(ring, 0, sizeof(*ring));
+    ring->slot_stride = _slot_stride(slot_size);
+    shared_memory_ring_get_name(stream_name, ring->shm_name, sizeof(ring->shm_name));
+
+    // try to be the one creating the segment
+    int fd = shm_open(ring->shm_name, O_CREAT | O_EXCL | O_RDWR, 0666);
+    if (fd >= 0)
+    {
+        struct stat info;
+        if (ftruncate(fd, (off_t)size) || fstat(fd, &info) || _map_segment(ring, fd, size))
+        {
+            close(fd);
+            shm_unlink(ring->shm_name);
+            return SHARED_MEMORY_RING_ERROR;
+        }
+        close(fd);
+        _remember_segment(ring, &info);
+
+        // fresh segment is zero filled, only the geometry has to be written before the magic
+        ring->header->slot_count = slot_count;
+        ring->header->slot_size = slot_size;
+        __atomic_store_n(&ring->header->magic, SHARED_MEMORY_RING_MAGIC, __ATOMIC_RELEASE);
+        return SHARED_MEMORY_RING_ATTACHED;
+    }
+
+    if (errno != EEXIST)
+        return SHARED_MEMORY_RING_ERROR;
+
+    fd = shm_open(ring->shm_name, O_RDWR, 0666);
+    if (fd < 0)
+        return SHARED_MEMORY_RING_NOT_READY; // creator might have unlinked it in between
+
+    struct stat info;
+    if (fstat(fd, &info))
+    {
+        close(fd);
+        return SHARED_MEMORY_RING_ERROR;
+    }
+
+    // creator did not get to ftruncate yet
+    if (info.st_size == 0)
+    {
+        close(fd);
+        return SHARED_MEMORY_RING_NOT_READY;
+    }
+
+    // segment was created with different geometry
+    if ((size_t)info.st_size != size)
+    {
+        close(fd);
+        return SHARED_MEMORY_RING_ERROR;
+    }
+
+    if (_map_segment(ring, fd, size))
+    {
+        close(fd);
+        return SHARED_MEMORY_RING_ERROR;
+    }
+    close(fd);
+    _remember_segment(ring, &info);
+
+    // creator did not publish the geometry yet
+    if (__atomic_load_n(&ring->header->magic, __ATOMIC_ACQUIRE) != SHARED_MEMORY_RING_MAGIC)
+    {
+        shared_memory_ring_detach(ring, false);
+        return SHARED_MEMORY_RING_NOT_READY;
+    }
+
+    if (ring->header->slot_count != slot_count || ring->header->slot_size != slot_size)
+    {
+        shared_memory_ring_detach(ring, false);
+        return SHARED_MEMORY_RING_ERROR;
+    }
+
+    return SHARED_MEMORY_RING_ATTACHED;
+}
+
+/**
+ * Unmaps the ring and optionally removes the shared memory object
+ * \param ring handle to unmap, safe to call on a handle that was never attached
+ * \param unlink_segment true to remove the object from /dev/shm, existing mappings stay valid
+ */
+void shared_memory_ring_detach(Shared_Memory_Ring *ring, bool unlink_segment)
+{
+    if (ring->header != NULL)
+    {
+        munmap(ring->header, ring->map_size);
+        ring->header = NULL;
+        ring->slots = NULL;
+    }
+
+    if (unlink_segment && ring->shm_name[0] != '\0')
+        shm_unlink(ring->shm_name);
+}
+
+/**
+ * Checks whether the mapped segment is still the one under the ring's name. The writer unlinks the
+ * segment when it closes and a restarted writer creates a new one, a reader that keeps the old
+ * mapping would never see another frame.
+ * \param ring attached handle
+ * \return true if the segment was removed or replaced, the handle should be detached and attached again
+ */
+bool shared_memory_ring_is_replaced(Shared_Memory_Ring *ring)
+{
+    int fd = shm_open(ring->shm_name, O_RDONLY, 0);
+    if (fd < 0)
+        return errno == ENOENT;
+
+    struct stat info;
+    bool is_replaced = fstat(fd, &info) == 0
+        && ((uint64_t)info.st_dev != ring->segment_device || (uint64_t)info.st_ino != ring->segment_inode);
+    close(fd);
+    return is_replaced;
+}
+
+/**
+ * Producer side, returns payload of the next free slot
+ * \return pointer to slot payload of header->slot_size bytes, NULL if the ring is full
+ */
+unsigned char *shared_memory_ring_claim(Shared_Memory_Ring *ring)
+{
+    uint64_t head = ring->header->head; // only we write head
+    uint64_t tail = __atomic_load_n(&ring->header->tail, __ATOMIC_ACQUIRE);
+
+    if (head - tail >= ring->header->slot_count)
+        return NULL;
+
+    return _slot_at(ring, head) + sizeof(Shared_Memory_Slot_Header);
+}
+
+/**
+ * Producer side, makes the previously claimed slot visible to the consumer
+ * \param length number of payload bytes written into the slot
+ * \param stamp publish time and trace handed to the consumer with the frame
+ */
+void shared_memory_ring_publish(Shared_Memory_Ring *ring, uint32_t length, const Shared_Memory_Frame_Stamp *stamp)
+{
+    uint64_t head = ring->header->head;
+    Shared_Memory_Slot_Header *slot = (Shared_Memory_Slot_Header *)_slot_at(ring, head);
+
+    slot->length = length;
+    slot->stamp = *stamp;
+    __atomic_store_n(&slot->sequence, head, __ATOMIC_RELEASE);
+    __atomic_store_n(&ring->header->head, head + 1, __ATOMIC_RELEASE);
+    shared_memory_ring_notify(ring, SHARED_MEMORY_RING_DATA);
+}
+
+/**
+ * Producer side, checks for a free slot without claiming it. Safe to call from a thread other than the producer
+ */
+bool shared_memory_ring_has_space(Shared_Memory_Ring *ring)
+{
+    uint64_t head = __atomic_load_n(&ring->header->head, __ATOMIC_RELAXED);
+    uint64_t tail = __atomic_load_n(&ring->header->tail, __ATOMIC_ACQUIRE);
+    return head - tail < ring->header->slot_count;
+}
+
+/**
+ * Consumer side, returns the oldest unread frame without consuming it
+ * \param length receives payload length
+ * \param stamp receives the producer's publish time and trace, can be NULL
+ * \return pointer to the payload, NULL if the ring is empty
+ */
+const unsigned char *shared_memory_ring_peek(Shared_Memory_Ring *ring, uint32_t *length, Shared_Memory_Frame_Stamp *stamp)
+{
+    uint64_t tail = ring->header->tail; // only we write tail
+    uint64_t head = __atomic_load_n(&ring->header->head, __ATOMIC_ACQUIRE);
+
+    if (tail == head)
+        return NULL;
+
+    Shared_Memory_Slot_Header *slot = (Shared_Memory_Slot_Header *)_slot_at(ring, tail);
+    *length = slot->length;
+    if (stamp != NULL)
+        *stamp = slot->stamp;
+    return (unsigned char *)slot + sizeof(Shared_Memory_Slot_Header);
+}
+
+/**
+ * Consumer side, gives the slot returned by peek back to the producer
+ */
+void shared_memory_ring_release(Shared_Memory_Ring *ring)
+{
+    __atomic_store_n(&ring->header->tail, ring->header->tail + 1, __ATOMIC_RELEASE);
+    shared_memory_ring_notify(ring, SHARED_MEMORY_RING_SPACE);
+}
+
+/**
+ * Latest value producer side, returns payload of the oldest slot without waiting for the consumer.
+ * The slot is marked as being written until shared_memory_ring_publish is called.
+ * \return pointer to slot payload of header->slot_size bytes
+ */
+unsigned char *shared_memory_ring_claim_overwrite(Shared_Memory_Ring *ring)
+{
+    Shared_Memory_Slot_Header *slot = (Shared_Memory_Slot_Header *)_slot_at(ring, ring->header->head);
+
+    __atomic_store_n(&slot->sequence, SHARED_MEMORY_SLOT_WRITING, __ATOMIC_RELAXED);
+    // consumer must not see any payload byte before the mark
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    return (unsigned char *)slot + sizeof(Shared_Memory_Slot_Header);
+}
+
+/**
+ * Number of frames the producer published so far, newest frame has sequence count - 1
+ */
+uint64_t shared_memory_ring_published_count(Shared_Memory_Ring *ring)
+{
+    return __atomic_load_n(&ring->header->head, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * Number of frames the consumer released so far, producers use it to see which frames were taken
+ */
+uint64_t shared_memory_ring_consumed_count(Shared_Memory_Ring *ring)
+{
+    return __atomic_load_n(&ring->header->tail, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * Latest value consumer side, copies the newest published frame out of the ring.
+ * Retries when the producer overwrote the slot during the copy.
+ * \param buffer receives the payload, has to hold header->slot_size bytes
+ * \param length receives payload length
+ * \param sequence receives sequence number of the copied frame
+ * \param stamp receives the producer's publish time and trace of the copied frame
+ * \return false if nothing was published yet or no consistent copy could be made
+ */
+bool shared_memory_ring_copy_latest(Shared_Memory_Ring *ring, unsigned char *buffer, uint32_t *length, uint64_t *sequence, Shared_Memory_Frame_Stamp *stamp)
+{
+    // bounded, a producer that died in the middle of a write would keep the slot marked forever
+    for (int attempt = 0; attempt < COPY_LATEST_ATTEMPTS; attempt++)
+    {
+        uint64_t head = shared_memory_ring_published_count(ring);
+        if (head == 0)
+            return false;
+
+        Shared_Memory_Slot_Header *slot = (Shared_Memory_Slot_Header *)_slot_at(ring, head - 1);
+        uint64_t before = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+        if (before != head - 1)
+            continue; // producer lapped us, newer head is available
+
+        uint32_t slot_length = slot->length;
+        Shared_Memory_Frame_Stamp slot_stamp = slot->stamp;
+        if (slot_length > ring->header->slot_size)
+            continue;
+        memcpy(buffer, (unsigned char *)slot + sizeof(Shared_Memory_Slot_Header), slot_length);
+
+        // copy has to be finished before the sequence is checked again
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&slot->sequence, __ATOMIC_RELAXED) != before)
+            continue;
+
+        *length = slot_length;
+        *sequence = before;
+        *stamp = slot_stamp;
+        return true;
+    }
+    return false;
+}
+
+/**
+ * Current value of the event counter, pass it to shared_memory_ring_wait to sleep until it changes
+ */
+uint32_t shared_memory_ring_events(Shared_Memory_Ring *ring, enum Shared_Memory_Ring_Event event)
+{
+    uint32_t *events, *waiters;
+    _event_words(ring, event, &events, &waiters);
+    return __atomic_load_n(events, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * Sleeps until the event counter moves past seen. Can return early on signals or spurious
+ * wake ups, callers check their condition again. Without futex it sleeps for a millisecond.
+ * \param seen value returned by shared_memory_ring_events before the condition was checked,
+ *             an event that happened in between makes the call return right away
+ */
+void shared_memory_ring_wait(Shared_Memory_Ring *ring, enum Shared_Memory_Ring_Event event, uint32_t seen)
+{
+    uint32_t *events, *waiters;
+    _event_words(ring, event, &events, &waiters);
+
+    // registering before the check pairs with notify bumping before it looks at waiters, one of us sees the other
+    __atomic_fetch_add(waiters, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(events, __ATOMIC_SEQ_CST) == seen)
+    {
+#ifdef __linux__
+        // not FUTEX_PRIVATE, the word is shared with the other process
+        syscall(SYS_futex, events, FUTEX_WAIT, seen, NULL, NULL, 0);
+#else
+        usleep(1000);
+#endif
+    }
+    __atomic_fetch_sub(waiters, 1, __ATOMIC_SEQ_CST);
+}
+
+/**
+ * Bumps the event counter and wakes everyone sleeping on it, called by publish and release
+ */
+void shared_memory_ring_notify(Shared_Memory_Ring *ring, enum Shared_Memory_Ring_Event event)
+{
+    uint32_t *events, *waiters;
+    _event_words(ring, event, &events, &waiters);
+
+    __atomic_fetch_add(events, 1, __ATOMIC_SEQ_CST);
+#ifdef __linux__
+    if (__atomic_load_n(waiters, __ATOMIC_SEQ_CST) != 0)
+        syscall(SYS_futex, events, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+#endif
+}
+
+/**
+ * Picks the counter and waiter count of given event
+ */
+static void _event_words(Shared_Memory_Ring *ring, enum Shared_Memory_Ring_Event event, uint32_t **events, uint32_t **waiters)
+{
+    if (event == SHARED_MEMORY_RING_DATA)
+    {
+        *events = &ring->header->data_events;
+        *waiters = &ring->header->data_waiters;
+    }
+    else
+    {
+        *events = &ring->header->space_events;
+        *waiters = &ring->header->space_waiters;
+    }
+}
+
+/**
+ * Size of one slot, header + payload rounded up to whole cache lines
+ */
+static size_t _slot_stride(uint32_t slot_size)
+{
+    size_t stride = sizeof(Shared_Memory_Slot_Header) + slot_size;
+    return (stride + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE * CACHE_LINE_SIZE;
+}
+
+/**
+ * Total size of the shared memory object
+ */
+static size_t _segment_size(uint32_t slot_count, uint32_t slot_size)
+{
+    return sizeof(Shared_Memory_Ring_Header) + (size_t)slot_count * _slot_stride(slot_size);
+}
+
+/**
+ * Returns start of the slot (its header) that holds given sequence number
+ */
+static unsigned char *_slot_at(Shared_Memory_Ring *ring, uint64_t sequence)
+{
+    return ring->slots + (sequence % ring->header->slot_count) * ring->slot_stride;
+}
+
+/**
+ * Maps the segment and sets up the pointers of the handle
+ * \return 0 if all goes well
+ */
+static int _map_segment(Shared_Memory_Ring *ring, int fd, size_t size)
+{
+    void *memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (memory == MAP_FAILED)
+        return 1;
+
+    ring->header = memory;
+    ring->slots = (unsigned char *)memory + sizeof(Shared_Memory_Ring_Header);
+    ring->map_size = size;
+    return 0;
+}
+
+/**
+ * Keeps the identity of the mapped segment for shared_memory_ring_is_replaced
+ */
+static void _remember_segment(Shared_Memory_Ring *ring, const struct stat *info)
+{
+    ring->segment_device = (uint64_t)info->st_dev;
+    ring->segment_inode = (uint64_t)info->st_ino;
+}
@@ -0,0 +1,120 @@
+/****************************************************************************
+* Title                 :   Shared Memory Ring
+* Filename              :   shared_memory_ring.h
+* Author                :   Dominic
+* Origin Date           :   17/10/2026
+* Version               :   0.0.1
+* Notes                 :   Single producer / single consumer ring of fixed size slots
+*                           living in POSIX shared memory (/dev/shm). Used as the
+*                           SHARED_MEMORY_TRANSPORT of the File System Communication framework.
+*                           The overwrite functions turn it into a latest value buffer where the
+*                           producer never waits and the consumer copies out the newest frame.
+*                           Either side can block until the other one publishes or releases with
+*                           shared_memory_ring_wait, a futex on the shared header.
+*****************************************************************************/
+#ifndef SHARED_MEMORY_RING_H
+#define SHARED_MEMORY_RING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHARED_MEMORY_RING_PREFIX "/fsc_"
+#define SHARED_MEMORY_RING_DIRECTORY "/dev/shm"
+#define SHARED_MEMORY_RING_MAX_NAME 96
+
+// slot sequence while the producer is overwriting it
+#define SHARED_MEMORY_SLOT_WRITING UINT64_MAX
+
+// attach return codes
+#define SHARED_MEMORY_RING_ATTACHED 0
+#define SHARED_MEMORY_RING_NOT_READY 1
+#define SHARED_MEMORY_RING_ERROR -1
+
+/**
+ * Metadata handed from the producer to the consumer with every frame, the ring does not look at it
+ */
+typedef struct Shared_Memory_Frame_Stamp
+{
+    uint64_t publish_ns; // CLOCK_MONOTONIC time the producer published the frame, same clock in every process
+    uint64_t trace_id;   // trace the frame belongs to, 0 if it is not traced
+    uint64_t origin_ns;  // CLOCK_MONOTONIC time the first frame of the trace was produced
+} Shared_Memory_Frame_Stamp;
+
+/**
+ * Header of every slot, payload follows right after it
+ */
+typedef struct Shared_Memory_Slot_Header
+{
+    uint64_t sequence;  // sequence number of the frame stored in the slot, SHARED_MEMORY_SLOT_WRITING while overwritten
+    Shared_Memory_Frame_Stamp stamp;
+    uint32_t length;    // payload length in bytes
+    uint32_t reserved;
+} Shared_Memory_Slot_Header;
+
+/**
+ * Layout of the start of the shared memory segment.
+ * head is only written by the producer, tail only by the consumer,
+ * they are kept on separate cache lines so the two processes do not fight over one line.
+ */
+typedef struct Shared_Memory_Ring_Header
+{
+    uint32_t magic;         // set last by the creator, marks the segment as initialized
+    uint32_t slot_count;
+    uint32_t slot_size;     // payload bytes per slot
+    uint32_t reserved;
+    char pad_0[48];
+    uint64_t head;          // sequence of the next frame to be written
+    uint32_t data_events;   // bumped on every publish, futex word blocked consumers sleep on
+    uint32_t data_waiters;  // consumers sleeping on data_events, publish only calls futex wake if there are any
+    char pad_1[48];
+    uint64_t tail;          // sequence of the next frame to be read
+    uint32_t space_events;  // bumped on every release, futex word blocked producers sleep on
+    uint32_t space_waiters;
+    char pad_2[48];
+} Shared_Memory_Ring_Header;
+
+/**
+ * What a blocked side of the ring waits for
+ */
+enum Shared_Memory_Ring_Event
+{
+    SHARED_MEMORY_RING_DATA,    // consumer, a frame was published
+    SHARED_MEMORY_RING_SPACE    // producer, a slot was released
+};
+
+/**
+ * Process local handle of a mapped ring
+ */
+typedef struct Shared_Memory_Ring
+{
+    Shared_Memory_Ring_Header *header;
+    unsigned char *slots;
+    size_t map_size;
+    size_t slot_stride;     // slot header + payload rounded up to cache line
+    uint64_t segment_device; // identity of the mapped segment, a recreated segment under the same name has a new inode
+    uint64_t segment_inode;
+    char shm_name[SHARED_MEMORY_RING_MAX_NAME];
+} Shared_Memory_Ring;
+
+int shared_memory_ring_attach(Shared_Memory_Ring *ring, const char *stream_name, uint32_t slot_count, uint32_t slot_size);
+void shared_memory_ring_detach(Shared_Memory_Ring *ring, bool unlink_segment);
+bool shared_memory_ring_is_replaced(Shared_Memory_Ring *ring);
+void shared_memory_ring_get_name(const char *stream_name, char *shm_name, size_t size);
+
+unsigned char *shared_memory_ring_claim(Shared_Memory_Ring *ring);
+void shared_memory_ring_publish(Shared_Memory_Ring *ring, uint32_t length, const Shared_Memory_Frame_Stamp *stamp);
+bool shared_memory_ring_has_space(Shared_Memory_Ring *ring);
+const unsigned char *shared_memory_ring_peek(Shared_Memory_Ring *ring, uint32_t *length, Shared_Memory_Frame_Stamp *stamp);
+void shared_memory_ring_release(Shared_Memory_Ring *ring);
+
+unsigned char *shared_memory_ring_claim_overwrite(Shared_Memory_Ring *ring);
+uint64_t shared_memory_ring_published_count(Shared_Memory_Ring *ring);
+uint64_t shared_memory_ring_consumed_count(Shared_Memory_Ring *ring);
+bool shared_memory_ring_copy_latest(Shared_Memory_Ring *ring, unsigned char *buffer, uint32_t *length, uint64_t *sequence, Shared_Memory_Frame_Stamp *stamp);
+
+uint32_t shared_memory_ring_events(Shared_Memory_Ring *ring, enum Shared_Memory_Ring_Event event);
+void shared_memory_ring_wait(Shared_Memory_Ring *ring, enum Shared_Memory_Ring_Event event, uint32_t seen);
+void shared_memory_ring_notify(Shared_Memory_Ring *ring, enum Shared_Memory_Ring_Event event);
+
+#endif